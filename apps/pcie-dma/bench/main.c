@@ -0,0 +1,506 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Benchmark the DMA and register paths, and write the results to stdout as JSON. Each DMA run
+// streams a number of buffers from the RNG with one ring geometry and one way of consuming them:
+//
+//   read:      read() one buffer at a time into a userspace array
+//   readmulti: read() up to 16 buffers at a time
+//   mmap:      FPGALINK_ACQUIRE/FPGALINK_RELEASE, reading the buffers in-place
+//   ring:      busy-poll the shared ring header, with no syscalls unless the queue goes idle
+//   splice:    splice() each buffer into a pipe, and from there into /dev/null
+//
+// For each run it reports the throughput, the CPU time (user+system, of this process only) spent
+// per GB, and percentiles of how long each buffer took to arrive, measured from when the consumer
+// asked for it. The register benchmarks time single reads and writes, batches, and direct access.
+// With -t, it also measures host-to-FPGA throughput, with write() and with the mapped TX queue;
+// this needs an FPGA which supports it.
+//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "fpgalink.h"
+
+#define MAX_LIST 16
+#define MULTI_BUFS 16
+#define BATCH_LEN 16
+
+typedef enum {M_READ, M_READMULTI, M_MMAP, M_RING, M_SPLICE, NUM_MODES} Mode;
+static const char *const modeNames[NUM_MODES] = {"read", "readmulti", "mmap", "ring", "splice"};
+
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpuNs(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return
+		(uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+		(uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static int compareU64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Sort the samples, then print their percentiles as a JSON object
+//
+static void printPercentiles(const char *name, uint64_t *samples, size_t n) {
+	static const double pcts[] = {50.0, 90.0, 99.0, 99.9};
+	size_t i;
+	qsort(samples, n, sizeof(uint64_t), compareU64);
+	printf("\"%s\": {", name);
+	for ( i = 0; i < sizeof(pcts)/sizeof(*pcts); i++ ) {
+		const size_t idx = (size_t)((double)(n - 1) * pcts[i] / 100.0);
+		printf("\"p%g\": %llu, ", pcts[i], (unsigned long long)samples[idx]);
+	}
+	printf("\"max\": %llu}", (unsigned long long)samples[n - 1]);
+}
+
+// Parse a comma-separated list of numbers
+//
+static size_t parseList(const char *str, uint32_t *list) {
+	size_t n = 0;
+	char *end;
+	while ( *str && n < MAX_LIST ) {
+		list[n] = (uint32_t)strtoul(str, &end, 0);
+		if ( end == str ) {
+			break;  // not a number
+		}
+		n++;
+		str = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+// Wait for the FPGA to finish any DMA requests left over from the previous run, which it does once
+// its completion count stops moving.
+//
+static void settle(int dev) {
+	struct RingStats prev, cur;
+	flGetStats(dev, &prev);
+	for ( ; ; ) {
+		usleep(5000);
+		flGetStats(dev, &cur);
+		if ( cur.completed == prev.completed ) {
+			return;
+		}
+		prev = cur;
+	}
+}
+
+// Stream numBufs buffers using the given mode, timing how long each one takes to arrive. Returns
+// the number of bytes consumed, or zero on failure.
+//
+static uint64_t runMode(
+	int dev, Mode mode, const struct RingConfig *cfg, uint32_t numBufs, uint64_t *samples)
+{
+	const size_t bufSize = cfg->bufSize;
+	uint64_t bytes = 0, t0;
+	volatile uint64_t sink = 0;
+	uint32_t i = 0, tail, got, k;
+	const uint8_t *buffers = NULL;
+	struct RingHeader *hdr = NULL;
+	uint8_t *array = NULL;
+	int pipeFds[2] = {-1, -1}, devNull = -1, index;
+	ssize_t n;
+
+	switch ( mode ) {
+	case M_READ:
+	case M_READMULTI:
+		array = (uint8_t *)malloc(bufSize * MULTI_BUFS);
+		if ( !array ) {
+			goto exit;
+		}
+		flStartDMA(dev);
+		while ( i < numBufs ) {
+			const uint32_t want = (mode == M_READ) ? 1 : MULTI_BUFS;
+			t0 = nowNs();
+			n = read(dev, array, bufSize * (numBufs - i < want ? numBufs - i : want));
+			if ( n <= 0 ) {
+				goto exit;
+			}
+			// Only one sample per read(), so spread it over the buffers it actually returned (a
+			// flushed buffer is short, so round up)
+			t0 = nowNs() - t0;
+			got = (uint32_t)(((size_t)n + bufSize - 1) / bufSize);
+			for ( k = 0; k < got && i + k < numBufs; k++ ) {
+				samples[i + k] = t0 / got;
+			}
+			bytes += (uint64_t)n;
+			i += got;
+		}
+		break;
+
+	case M_MMAP:
+		buffers = flMapBuffers(dev, cfg);
+		if ( !buffers ) {
+			goto exit;
+		}
+		flStartDMA(dev);
+		for ( ; i < numBufs; i++ ) {
+			t0 = nowNs();
+			index = flAcquireBuffer(dev);
+			if ( index < 0 ) {
+				goto exit;
+			}
+			samples[i] = nowNs() - t0;
+			sink += *(const uint64_t *)(buffers + (size_t)index * cfg->bufStride);
+			flReleaseBuffer(dev, index);
+			bytes += bufSize;
+		}
+		break;
+
+	case M_RING:
+		buffers = flMapBuffers(dev, cfg);
+		hdr = flMapHeader(dev);
+		if ( !buffers || !hdr ) {
+			goto exit;
+		}
+		flStartDMA(dev);
+		for ( tail = 0; tail < numBufs; tail++ ) {
+			t0 = nowNs();
+			while ( flRingHead(hdr) == tail );
+			samples[tail] = nowNs() - t0;
+			sink += *(const uint64_t *)(buffers + (size_t)(tail & (cfg->numBufs - 1)) * cfg->bufStride);
+			flRingRelease(dev, hdr, tail + 1);
+			bytes += bufSize;
+		}
+		i = tail;
+		break;
+
+	case M_SPLICE:
+		devNull = open("/dev/null", O_WRONLY);
+		if ( devNull < 0 || pipe(pipeFds) ) {
+			goto exit;
+		}
+		if ( fcntl(pipeFds[1], F_SETPIPE_SZ, (int)bufSize) < (int)bufSize ) {
+			goto exit;
+		}
+		flStartDMA(dev);
+		for ( ; i < numBufs; i++ ) {
+			t0 = nowNs();
+			n = splice(dev, NULL, pipeFds[1], NULL, bufSize, SPLICE_F_MOVE);
+			if ( n <= 0 ) {
+				goto exit;
+			}
+			samples[i] = nowNs() - t0;
+			if ( splice(pipeFds[0], NULL, devNull, NULL, (size_t)n, SPLICE_F_MOVE) != n ) {
+				goto exit;
+			}
+			bytes += (uint64_t)n;
+		}
+		break;
+
+	default:
+		break;
+	}
+exit:
+	if ( hdr ) {
+		flUnmapHeader(hdr);
+	}
+	if ( buffers ) {
+		flUnmapBuffers(buffers, cfg);
+	}
+	if ( pipeFds[0] >= 0 ) {
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+	}
+	if ( devNull >= 0 ) {
+		close(devNull);
+	}
+	free(array);
+	(void)sink;
+	return (i == numBufs) ? bytes : 0;
+}
+
+// Run and report each combination of ring geometry and consumer mode
+//
+static void benchDMA(
+	int dev, uint32_t numBufs, const uint32_t *depths, size_t numDepths,
+	const uint32_t *sizes, size_t numSizes, const int *modes)
+{
+	uint64_t *const samples = (uint64_t *)calloc(numBufs, sizeof(uint64_t));
+	struct RingConfig cfg;
+	size_t d, s;
+	int m, first = 1;
+	if ( !samples ) {
+		return;
+	}
+	printf("  \"dma\": [");
+	for ( d = 0; d < numDepths; d++ ) {
+		for ( s = 0; s < numSizes; s++ ) {
+			settle(dev);
+			if ( flSetupRing(dev, depths[d], sizes[s], 0, &cfg) ) {
+				fprintf(stderr, "Unable to set up %u buffers of %u bytes: %s\n", depths[d], sizes[s], strerror(errno));
+				continue;
+			}
+			for ( m = 0; m < NUM_MODES; m++ ) {
+				uint64_t bytes, t0, c0, elapsed, cpu;
+				if ( !modes[m] ) {
+					continue;
+				}
+				settle(dev);
+				flReadRegister(dev, 0);  // read any register to reset RNG
+				t0 = nowNs();
+				c0 = cpuNs();
+				bytes = runMode(dev, (Mode)m, &cfg, numBufs, samples);
+				elapsed = nowNs() - t0;
+				cpu = cpuNs() - c0;
+				if ( !bytes ) {
+					fprintf(stderr, "The %s run failed: %s\n", modeNames[m], strerror(errno));
+					continue;
+				}
+				printf("%s\n    {\"mode\": \"%s\", \"numBufs\": %u, \"bufSize\": %u, ", first ? "" : ",", modeNames[m], cfg.numBufs, cfg.bufSize);
+				printf("\"bytes\": %llu, \"seconds\": %.6f, ", (unsigned long long)bytes, (double)elapsed / 1e9);
+				printf("\"MBps\": %.1f, \"buffersPerSec\": %.1f, ", (double)bytes * 1e3 / (double)elapsed, (double)numBufs * 1e9 / (double)elapsed);
+				printf("\"cpuSecPerGB\": %.4f, ", ((double)cpu / 1e9) / ((double)bytes / 1e9));
+				printPercentiles("latencyNs", samples, numBufs);
+				printf("}");
+				first = 0;
+			}
+		}
+	}
+	printf("\n  ],\n");
+	free(samples);
+}
+
+// Send numBufs TX buffers to the FPGA, by write() or in-place, and report the throughput
+//
+static void benchTx(int dev, uint32_t numBufs) {
+	struct RingConfig cfg;
+	uint8_t *array = NULL, *buffers = NULL;
+	uint64_t bytes, t0, c0, elapsed, cpu;
+	uint32_t i;
+	int inPlace, index;
+	if ( flGetTxRing(dev, &cfg) ) {
+		return;
+	}
+	array = (uint8_t *)calloc(1, cfg.bufSize);
+	buffers = flMapTxBuffers(dev, &cfg);
+	if ( !array || !buffers ) {
+		fprintf(stderr, "Unable to set up the TX benchmark: %s\n", strerror(errno));
+		goto exit;
+	}
+	printf("  \"tx\": [");
+	for ( inPlace = 0; inPlace < 2; inPlace++ ) {
+		bytes = 0;
+		t0 = nowNs();
+		c0 = cpuNs();
+		for ( i = 0; i < numBufs; i++ ) {
+			if ( inPlace ) {
+				index = flTxAcquire(dev);
+				if ( index < 0 ) {
+					break;
+				}
+				memset(buffers + (size_t)index * cfg.bufStride, (int)i, cfg.bufSize);
+				if ( flTxSubmit(dev, index, cfg.bufSize) ) {
+					break;
+				}
+			} else if ( write(dev, array, cfg.bufSize) != (ssize_t)cfg.bufSize ) {
+				break;
+			}
+			bytes += cfg.bufSize;
+		}
+		if ( i < numBufs || flTxFlush(dev) ) {
+			fprintf(stderr, "The TX run failed: %s\n", strerror(errno));
+			break;
+		}
+		elapsed = nowNs() - t0;
+		cpu = cpuNs() - c0;
+		printf("%s\n    {\"mode\": \"%s\", \"numBufs\": %u, \"bufSize\": %u, ", inPlace ? "," : "", inPlace ? "mmap" : "write", cfg.numBufs, cfg.bufSize);
+		printf("\"bytes\": %llu, \"seconds\": %.6f, ", (unsigned long long)bytes, (double)elapsed / 1e9);
+		printf("\"MBps\": %.1f, ", (double)bytes * 1e3 / (double)elapsed);
+		printf("\"cpuSecPerGB\": %.4f}", ((double)cpu / 1e9) / ((double)bytes / 1e9));
+	}
+	printf("\n  ],\n");
+exit:
+	if ( buffers ) {
+		flUnmapTxBuffers(buffers, &cfg);
+	}
+	free(array);
+}
+
+// Time the various ways of reading and writing registers
+//
+static void benchRegs(int dev, uint32_t iterations) {
+	uint64_t *const samples = (uint64_t *)calloc(iterations, sizeof(uint64_t));
+	struct Cmd cmds[BATCH_LEN];
+	uint32_t words[1 + BATCH_LEN];
+	volatile uint32_t *regs;
+	volatile uint32_t sink = 0;
+	uint32_t i, j;
+	uint64_t t0;
+	if ( !samples ) {
+		return;
+	}
+	printf("  \"registers\": {\n    ");
+
+	for ( i = 0; i < iterations; i++ ) {
+		t0 = nowNs();
+		sink += flReadRegister(dev, 2);
+		samples[i] = nowNs() - t0;
+	}
+	printPercentiles("readNs", samples, iterations);
+
+	for ( i = 0; i < iterations; i++ ) {
+		t0 = nowNs();
+		flWriteRegister(dev, 2, i);
+		samples[i] = nowNs() - t0;
+	}
+	printf(",\n    ");
+	printPercentiles("writeNs", samples, iterations);
+
+	// The same number of reads, BATCH_LEN to a FPGALINK_CMDLIST, timed per register
+	for ( j = 0; j < BATCH_LEN; j++ ) {
+		cmds[j].op = OP_RD;
+		cmds[j].reg = 2;
+		cmds[j].val = 0;
+	}
+	for ( i = 0; i < iterations; i++ ) {
+		t0 = nowNs();
+		flCmdList(dev, cmds);
+		samples[i] = (nowNs() - t0) / BATCH_LEN;
+	}
+	printf(",\n    ");
+	printPercentiles("cmdListReadNs", samples, iterations);
+
+	// ...and as an FPGALINK_CMDBATCH block read
+	for ( i = 0; i < iterations; i++ ) {
+		words[0] = FL_BATCH_CMD(FL_BATCH_RD, BATCH_LEN, 2);
+		t0 = nowNs();
+		flCmdBatch(dev, words, 1 + BATCH_LEN, NULL);
+		samples[i] = (nowNs() - t0) / BATCH_LEN;
+	}
+	printf(",\n    ");
+	printPercentiles("cmdBatchReadNs", samples, iterations);
+
+	// ...and directly through the register mapping
+	regs = flMapRegs(dev);
+	if ( regs ) {
+		for ( i = 0; i < iterations; i++ ) {
+			t0 = nowNs();
+			sink += flPeek(regs, 2);
+			samples[i] = nowNs() - t0;
+		}
+		printf(",\n    ");
+		printPercentiles("mmapReadNs", samples, iterations);
+		for ( i = 0; i < iterations; i++ ) {
+			t0 = nowNs();
+			flPoke(regs, 2, i);
+			samples[i] = nowNs() - t0;
+		}
+		printf(",\n    ");
+		printPercentiles("mmapWriteNs", samples, iterations);
+		flUnmapRegs(regs);
+	}
+	printf("\n  }\n");
+	free(samples);
+	(void)sink;
+}
+
+static void usage(const char *prog) {
+	fprintf(
+		stderr,
+		"Synopsis: %s [-d <device>] [-n <numBufs>] [-r <depth,...>] [-s <bufSize,...>]\n"
+		"          [-m <mode,...>] [-i <regIterations>] [-t]\n"
+		"Modes: read, readmulti, mmap, ring, splice\n",
+		prog
+	);
+}
+
+int main(int argc, char *argv[]) {
+	int retVal = 0, dev, opt, m, modes[NUM_MODES] = {1, 1, 1, 1, 1}, doTx = 0;
+	const char *device = "/dev/fpga0";
+	uint32_t numBufs = 4096, iterations = 100000, depths[MAX_LIST] = {NUM_BUFS};
+	uint32_t sizes[MAX_LIST] = {BUF_SIZE};
+	size_t numDepths = 1, numSizes = 1;
+	char *tok;
+
+	while ( (opt = getopt(argc, argv, "d:n:r:s:m:i:t")) != -1 ) {
+		switch ( opt ) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			numBufs = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			numDepths = parseList(optarg, depths);
+			break;
+		case 's':
+			numSizes = parseList(optarg, sizes);
+			break;
+		case 'm':
+			memset(modes, 0, sizeof(modes));
+			for ( tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",") ) {
+				for ( m = 0; m < NUM_MODES && strcmp(tok, modeNames[m]); m++ );
+				if ( m == NUM_MODES ) {
+					usage(argv[0]);
+					retVal = 1; goto exit;
+				}
+				modes[m] = 1;
+			}
+			break;
+		case 'i':
+			iterations = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			doTx = 1;
+			break;
+		default:
+			usage(argv[0]);
+			retVal = 1; goto exit;
+		}
+	}
+	if ( !numBufs || !numDepths || !numSizes || !iterations ) {
+		usage(argv[0]);
+		retVal = 1; goto exit;
+	}
+
+	// Connect to the kernel driver...
+	dev = open(device, O_RDWR|O_SYNC);
+	if ( dev < 0 ) {
+		fprintf(stderr, "Unable to open %s. Did you forget to install the driver?\n", device);
+		retVal = 2; goto exit;
+	}
+
+	printf("{\n");
+	benchDMA(dev, numBufs, depths, numDepths, sizes, numSizes, modes);
+	if ( doTx ) {
+		benchTx(dev, numBufs);
+	}
+	benchRegs(dev, iterations);
+	printf("}\n");
+
+	// Close device
+	close(dev);
+exit:
+	return retVal;
+}
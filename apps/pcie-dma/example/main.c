@@ -23,20 +23,34 @@
 #include <unistd.h>
 #include "fpgalink.h"
 
-void doRaw(int dev, int numChunks) {
+int doRaw(int dev, int numChunks) {
 	int i;
-	uint8_t array[BUF_SIZE];
+	struct RingConfig cfg;
+	uint8_t *array;
 	ssize_t numBytes;
 
+	// Find out how big the driver's buffers are
+	if ( flGetRing(dev, &cfg) ) {
+		fprintf(stderr, "Unable to query the driver's circular queue geometry!\n");
+		return -1;
+	}
+	array = (uint8_t *)malloc(cfg.bufSize);
+	if ( !array ) {
+		fprintf(stderr, "Unable to allocate %u bytes!\n", cfg.bufSize);
+		return -1;
+	}
+
 	// Start Stream-DMA
 	flReadRegister(dev, 0);  // read any register to reset RNG
 	flStartDMA(dev);
 
 	// Get raw data
 	for ( i = 0; i < numChunks; i++ ) {
-		numBytes = read(dev, array, BUF_SIZE);
+		numBytes = read(dev, array, cfg.bufSize);
 		fwrite(array, (size_t)numBytes, 1, stdout);
 	}
+	free(array);
+	return 0;
 }
 
 int main(int argc, const char *argv[]) {
@@ -61,7 +75,9 @@ int main(int argc, const char *argv[]) {
 	}
 
 	// Read some data from the RNG...
-	doRaw(dev, numChunks);
+	if ( doRaw(dev, numChunks) ) {
+		retVal = 4;
+	}
 
 	// Close device
 	close(dev);
@@ -96,6 +96,11 @@ begin
 			-- DMA stream
 			dmaData_in       => dmaData,
 			dmaValid_in      => dmaValid,
-			dmaReady_out     => dmaReady
+			dmaReady_out     => dmaReady,
+
+			-- Host-to-FPGA DMA stream: discard it, so the host can measure TX throughput
+			hostData_out     => open,
+			hostValid_out    => open,
+			hostReady_in     => '1'
 		);
 end architecture;
@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Pipelined version of the DMA example. The main thread does nothing but drain the circular queue:
+// it borrows each filled buffer zero-copy and hands it to a pool of writer threads through a
+// lock-free queue. The writers each pwrite() whichever buffers they get straight to the right place
+// in the output file, and then hand them back. Only the main thread touches the fl::Device, so
+// buffers are given back to the driver from there, once their writers are done with them.
+//
+// The main thread sleeps in poll() on the device and on an eventfd the writers signal when they
+// give a buffer back, so it can never end up waiting for the FPGA while the FPGA is waiting for
+// buffers. The writers sleep on an eventfd used as a semaphore, counting buffers in the queue.
+//
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "fpgalink.hpp"
+#include "mpmc_queue.hpp"
+
+struct Pipeline {
+	MpmcQueue<fl::BufferView> work;     // filled buffers, on their way to the writers
+	MpmcQueue<fl::BufferView> finished; // written buffers, on their way back to the main thread
+	int workReady;                      // semaphore: number of buffers in work
+	int finishedReady;                  // signalled whenever something is put in finished
+	int outFile;
+	off_t bufSize;                      // the file offset between one buffer and the next
+	std::atomic<bool> failed;
+
+	Pipeline(size_t numBufs, off_t size, int out)
+		: work(numBufs), finished(numBufs),
+		  workReady(eventfd(0, EFD_SEMAPHORE)), finishedReady(eventfd(0, EFD_NONBLOCK)),
+		  outFile(out), bufSize(size), failed(false)
+	{
+		if ( workReady < 0 || finishedReady < 0 ) {
+			fl::throwErrno("eventfd()");
+		}
+	}
+	~Pipeline() {
+		close(workReady);
+		close(finishedReady);
+	}
+};
+
+// Writer thread: wait for a buffer, write it to the file at the offset given by its sequence
+// number, then pass it back. Each buffer gets a whole ring buffer's worth of the file, so one the
+// FPGA flushed early leaves a hole rather than moving everything after it. An empty view means
+// there's no more work.
+//
+static void writer(Pipeline *p) {
+	fl::BufferView buf;
+	uint64_t n;
+	for ( ; ; ) {
+		if ( read(p->workReady, &n, sizeof(n)) != sizeof(n) ) {
+			continue;  // interrupted
+		}
+		while ( !p->work.pop(buf) );  // the semaphore says it's there, or about to be
+		if ( !buf ) {
+			return;
+		}
+		const off_t offset = (off_t)buf.sequence() * p->bufSize;
+		if ( pwrite(p->outFile, buf.data(), buf.size(), offset) != (ssize_t)buf.size() ) {
+			p->failed = true;
+		}
+		p->finished.push(std::move(buf));  // can't fail: there are never more than numBufs
+		n = 1;
+		if ( write(p->finishedReady, &n, sizeof(n)) != sizeof(n) ) {
+			p->failed = true;
+		}
+	}
+}
+
+static int doPipeline(fl::Device &dev, uint32_t numChunks, int outFile, unsigned int numWriters) {
+	Pipeline p(dev.ring().numBufs, dev.ring().bufSize, outFile);
+	std::vector<std::thread> writers;
+	uint32_t numAcquired = 0, numFinished = 0;
+	fl::BufferView buf;
+	uint64_t n = 1;
+	for ( unsigned int i = 0; i < numWriters; i++ ) {
+		writers.emplace_back(writer, &p);
+	}
+
+	// Start Stream-DMA
+	dev.readRegister(0);  // read any register to reset RNG
+	dev.startDMA();
+
+	while ( numFinished < numChunks ) {
+		// Give back whatever the writers have finished with
+		while ( p.finished.pop(buf) ) {
+			buf.release();
+			numFinished++;
+		}
+
+		// Take as many filled buffers as there are, and pass them on
+		if ( numAcquired < numChunks ) {
+			buf = dev.acquire();
+			if ( buf ) {
+				p.work.push(std::move(buf));
+				if ( write(p.workReady, &n, sizeof(n)) != sizeof(n) ) {
+					fl::throwErrno("write()");
+				}
+				numAcquired++;
+				continue;
+			}
+		}
+
+		// Wait for the FPGA, or for a writer
+		if ( numFinished < numChunks ) {
+			struct pollfd fds[2] = {
+				{p.finishedReady, POLLIN, 0},
+				{dev.fd(), POLLIN, 0}
+			};
+			if ( poll(fds, (numAcquired < numChunks) ? 2 : 1, -1) < 0 ) {
+				continue;  // interrupted
+			}
+			if ( fds[0].revents & POLLIN ) {
+				if ( read(p.finishedReady, &n, sizeof(n)) != sizeof(n) ) {
+					continue;
+				}
+				n = 1;
+			}
+		}
+	}
+
+	// Tell the writers to stop
+	for ( unsigned int i = 0; i < numWriters; i++ ) {
+		p.work.push(fl::BufferView());
+		if ( write(p.workReady, &n, sizeof(n)) != sizeof(n) ) {
+			fl::throwErrno("write()");
+		}
+	}
+	for ( std::thread &t : writers ) {
+		t.join();
+	}
+	if ( p.failed ) {
+		fprintf(stderr, "Writing to the output file failed!\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, const char *argv[]) {
+	int retVal = 0, outFile;
+	uint32_t numChunks;
+	unsigned int numWriters = 4;
+
+	// Get numChunks, the output file and optionally the number of writer threads
+	if ( argc != 3 && argc != 4 ) {
+		fprintf(stderr, "Synopsis: %s <numChunks> <outFile> [<numWriters>]\n", argv[0]);
+		retVal = 1; goto exit;
+	}
+	numChunks = (uint32_t)strtoul(argv[1], NULL, 0);
+	if ( argc == 4 ) {
+		numWriters = (unsigned int)strtoul(argv[3], NULL, 0);
+	}
+	if ( !numChunks || !numWriters ) {
+		fprintf(stderr, "Synopsis: %s <numChunks> <outFile> [<numWriters>]\n", argv[0]);
+		retVal = 2; goto exit;
+	}
+	outFile = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if ( outFile < 0 ) {
+		fprintf(stderr, "Unable to open %s for writing!\n", argv[2]);
+		retVal = 3; goto exit;
+	}
+
+	try {
+		// Connect to the kernel driver, and read some data from the RNG...
+		fl::Device dev("/dev/fpga0", O_RDWR|O_NONBLOCK);
+		if ( doPipeline(dev, numChunks, outFile, numWriters) ) {
+			retVal = 5;
+		}
+	}
+	catch ( const std::system_error &e ) {
+		fprintf(stderr, "%s. Did you forget to install the driver?\n", e.what());
+		retVal = 4;
+	}
+	close(outFile);
+exit:
+	return retVal;
+}
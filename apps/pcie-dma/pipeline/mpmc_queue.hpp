@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Bounded lock-free multi-producer, multi-consumer queue (after Dmitry Vyukov's design). Each cell
+// has a sequence number saying whose turn it is: producers claim a cell by advancing the enqueue
+// position, and publish it by bumping the cell's sequence; consumers do the same on the other side.
+// Neither push() nor pop() ever blocks: they fail if the queue is full or empty, respectively.
+//
+#ifndef MPMC_QUEUE_HPP
+#define MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+template<typename T>
+class MpmcQueue {
+	struct Cell {
+		std::atomic<size_t> seq;
+		T data;
+	};
+	const size_t mask_;
+	std::unique_ptr<Cell[]> cells_;
+	alignas(64) std::atomic<size_t> enqueuePos_;
+	alignas(64) std::atomic<size_t> dequeuePos_;
+
+public:
+	// The capacity must be a power of two
+	explicit MpmcQueue(size_t capacity)
+		: mask_(capacity - 1), cells_(new Cell[capacity]), enqueuePos_(0), dequeuePos_(0)
+	{
+		if ( !capacity || (capacity & mask_) ) {
+			throw std::invalid_argument("MpmcQueue capacity must be a power of two");
+		}
+		for ( size_t i = 0; i < capacity; i++ ) {
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+	MpmcQueue(const MpmcQueue &) = delete;
+	MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+	bool push(T &&item) {
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		Cell *cell;
+		for ( ; ; ) {
+			cell = &cells_[pos & mask_];
+			const size_t seq = cell->seq.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if ( diff == 0 ) {
+				if ( enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) {
+					break;
+				}
+			} else if ( diff < 0 ) {
+				return false;  // full
+			} else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(item);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &item) {
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		Cell *cell;
+		for ( ; ; ) {
+			cell = &cells_[pos & mask_];
+			const size_t seq = cell->seq.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if ( diff == 0 ) {
+				if ( dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) {
+					break;
+				}
+			} else if ( diff < 0 ) {
+				return false;  // empty
+			} else {
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		item = std::move(cell->data);
+		cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,624 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Capture-to-disk recorder for the pcie-dma design, meant to keep up with the link for hours on end.
+// Filled buffers are borrowed zero-copy from the circular queue and gathered into batches of a few
+// MiB, which a writer thread writes with O_DIRECT into preallocated segment files, so nothing goes
+// through the page cache. A batch's buffers are only given back to the FPGA once it has been
+// written. Each segment gets an index of the sequence numbers and timestamps of the buffers in it
+// (see segment.hpp), and with -k only the newest few segments are kept, so it can run indefinitely.
+//
+// Where the kernel won't take the circular queue's pages for O_DIRECT (the contiguous queue is
+// mapped as raw PFNs, so writes from it fail with EFAULT), batches are copied into an aligned bounce
+// buffer and written from there instead; and so are any batches with a buffer that isn't aligned for
+// O_DIRECT (a flushed buffer may be any multiple of 128 bytes long).
+//
+// As in the pipeline example, only the main thread touches the fl::Device, and it sleeps in poll()
+// on the device and on an eventfd the writer signals when it hands a batch back. There are two
+// batches, one being filled while the other is written, and each is limited to a quarter of the
+// circular queue, so the FPGA always has at least half of it to fill.
+//
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include "fpgalink.hpp"
+#include "segment.hpp"
+
+static const size_t DIO_ALIGN = 4096;  // O_DIRECT offsets, lengths and addresses are multiples of this
+static const int MAX_IOV = 1024;       // most iovecs pwritev() will take in one call
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+	g_stop = 1;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t roundUp(uint64_t x) {
+	return (x + DIO_ALIGN - 1) & ~(uint64_t)(DIO_ALIGN - 1);
+}
+
+// Some buffers borrowed from the circular queue, on their way to the disk
+struct Batch {
+	std::vector<fl::BufferView> views;
+	size_t bytes;
+	Batch() : bytes(0) { }
+};
+
+// Writes batches into rotating segment files. Only the writer thread uses it. Failures are reported
+// by throwing std::system_error.
+class SegmentWriter {
+	const std::string prefix_;
+	const uint64_t segBytes_;
+	const uint32_t keep_;         // how many segments to keep, or zero for all of them
+	const uint32_t bufSize_;
+	uint8_t *bounce_;
+	std::vector<struct iovec> iov_;
+	bool copy_;                   // whether every batch is copied through bounce_
+	bool direct_;                 // whether the filesystem supports O_DIRECT
+	bool prealloc_;               // whether it supports fallocate()
+	int fd_;
+	uint32_t segNum_;             // the segment being written (if fd_ is open), or the next one
+	uint64_t offset_;             // where the next batch goes in it
+	uint64_t dataEnd_;            // the end of the data written to it so far
+	std::vector<SegmentEntry> index_;
+
+	std::string path(uint32_t seg, const char *ext) const {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "-%06u.%s", seg, ext);
+		return prefix_ + buf;
+	}
+
+	void pwriteAll(const uint8_t *data, size_t len, uint64_t offset) {
+		while ( len ) {
+			const ssize_t n = pwrite(fd_, data, len, (off_t)offset);
+			if ( n < 0 ) {
+				if ( errno == EINTR ) {
+					continue;
+				}
+				fl::throwErrno("pwrite()");
+			}
+			data += n;
+			len -= (size_t)n;
+			offset += (uint64_t)n;
+		}
+	}
+
+	// Write a batch straight from the circular queue. Returns false if the kernel won't take the
+	// queue's pages for O_DIRECT.
+	bool writeDirect(const Batch &b) {
+		uint64_t offset = offset_;
+		size_t i = 0;
+		while ( i < b.views.size() ) {
+			size_t len = 0;
+			int num = 0;
+			for ( ; i < b.views.size() && num < MAX_IOV; i++, num++ ) {
+				iov_[(size_t)num].iov_base = const_cast<uint8_t *>(b.views[i].data());
+				iov_[(size_t)num].iov_len = b.views[i].size();
+				len += b.views[i].size();
+			}
+			ssize_t n;
+			do {
+				n = pwritev(fd_, iov_.data(), num, (off_t)offset);
+			} while ( n < 0 && errno == EINTR );
+			if ( n < 0 && (errno == EFAULT || errno == EINVAL) ) {
+				return false;
+			}
+			if ( n < 0 ) {
+				fl::throwErrno("pwritev()");
+			}
+			if ( (size_t)n != len ) {
+				errno = ENOSPC;  // a short write to a regular file means the disk is full
+				fl::throwErrno("pwritev()");
+			}
+			offset += len;
+		}
+		return true;
+	}
+
+	// Finish the current segment: trim off the preallocated space it didn't use, and write its index
+	void finish() {
+		if ( fd_ < 0 ) {
+			return;
+		}
+		const int fd = fd_;
+		fd_ = -1;
+		if ( ftruncate(fd, (off_t)dataEnd_) || fdatasync(fd) ) {
+			const int e = errno; ::close(fd); errno = e;
+			fl::throwErrno("Finishing segment");
+		}
+		::close(fd);
+
+		SegmentHeader hdr;
+		memcpy(hdr.magic, FL_SEGMENT_MAGIC, sizeof(hdr.magic));
+		hdr.numEntries = (uint32_t)index_.size();
+		hdr.bufSize = bufSize_;
+		hdr.dataBytes = dataEnd_;
+		const std::string idx = path(segNum_, "idx");
+		FILE *f = fopen(idx.c_str(), "wb");
+		if ( !f ) {
+			fl::throwErrno(idx.c_str());
+		}
+		bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+		ok = ok && fwrite(index_.data(), sizeof(SegmentEntry), index_.size(), f) == index_.size();
+		if ( fclose(f) || !ok ) {
+			fl::throwErrno(idx.c_str());
+		}
+		index_.clear();
+		segNum_++;
+	}
+
+	// Finish the current segment, if any, and start the next, dropping the oldest if need be
+	void next() {
+		finish();
+		const std::string dat = path(segNum_, "dat");
+		fd_ = open(dat.c_str(), O_WRONLY|O_CREAT|O_TRUNC|(direct_ ? O_DIRECT : 0), 0644);
+		if ( fd_ < 0 && direct_ && errno == EINVAL ) {
+			fprintf(stderr, "This filesystem doesn't support O_DIRECT: writing through the page cache\n");
+			direct_ = false;
+			fd_ = open(dat.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		}
+		if ( fd_ < 0 ) {
+			fl::throwErrno(dat.c_str());
+		}
+		if ( prealloc_ && fallocate(fd_, 0, 0, (off_t)segBytes_) ) {
+			if ( errno != EOPNOTSUPP ) {
+				fl::throwErrno("fallocate()");
+			}
+			fprintf(stderr, "This filesystem doesn't support fallocate(): segments won't be preallocated\n");
+			prealloc_ = false;
+		}
+		offset_ = dataEnd_ = 0;
+		if ( keep_ && segNum_ >= keep_ ) {
+			unlink(path(segNum_ - keep_, "dat").c_str());
+			unlink(path(segNum_ - keep_, "idx").c_str());
+		}
+	}
+
+public:
+	SegmentWriter(
+		const std::string &prefix, uint64_t segBytes, uint32_t keep, uint32_t bufSize,
+		size_t maxBatchBytes, bool copy)
+		: prefix_(prefix), segBytes_(segBytes), keep_(keep), bufSize_(bufSize), bounce_(nullptr),
+		  iov_(MAX_IOV), copy_(copy), direct_(true), prealloc_(true), fd_(-1), segNum_(0),
+		  offset_(0), dataEnd_(0)
+	{
+		void *p;
+		if ( posix_memalign(&p, DIO_ALIGN, roundUp(maxBatchBytes)) ) {
+			throw std::system_error(ENOMEM, std::generic_category(), "posix_memalign()");
+		}
+		bounce_ = (uint8_t *)p;
+	}
+	SegmentWriter(const SegmentWriter &) = delete;
+	SegmentWriter &operator=(const SegmentWriter &) = delete;
+	~SegmentWriter() {
+		if ( fd_ >= 0 ) {
+			::close(fd_);
+		}
+		free(bounce_);
+	}
+
+	// The number of segments finished so far
+	uint32_t segments() const { return segNum_; }
+
+	void write(const Batch &b) {
+		const uint64_t padded = roundUp(b.bytes);
+		bool aligned = true;
+		if ( fd_ < 0 || offset_ + padded > segBytes_ ) {
+			next();
+		}
+		for ( const fl::BufferView &v : b.views ) {
+			if ( (uintptr_t)v.data() % DIO_ALIGN || v.size() % DIO_ALIGN ) {
+				aligned = false;
+			}
+		}
+		if ( copy_ || !aligned || !writeDirect(b) ) {
+			if ( !copy_ && aligned ) {
+				fprintf(stderr, "Can't write straight from the circular queue (%s): copying from now on\n",
+					strerror(errno));
+				copy_ = true;
+			}
+			uint8_t *p = bounce_;
+			for ( const fl::BufferView &v : b.views ) {
+				memcpy(p, v.data(), v.size());
+				p += v.size();
+			}
+			memset(p, 0, (size_t)(padded - b.bytes));
+			pwriteAll(bounce_, (size_t)padded, offset_);
+		}
+
+		uint64_t offset = offset_;
+		for ( const fl::BufferView &v : b.views ) {
+			SegmentEntry e;
+			e.offset = offset;
+			e.desc = v.descriptor();
+			index_.push_back(e);
+			offset += v.size();
+		}
+		dataEnd_ = offset_ + b.bytes;
+		offset_ += padded;
+	}
+
+	// Finish the last segment
+	void close() {
+		finish();
+	}
+};
+
+// What the main thread and the writer thread share
+struct Shared {
+	std::mutex lock;
+	std::condition_variable ready;  // signalled when something is put in toWrite, or stop is set
+	std::deque<Batch*> toWrite;     // filled batches, on their way to the writer
+	std::deque<Batch*> written;     // written batches, on their way back to the main thread
+	bool stop;
+	int writtenReady;               // eventfd, signalled whenever something is put in written
+	std::atomic<bool> failed;
+	std::string error;
+
+	Shared() : stop(false), writtenReady(eventfd(0, EFD_NONBLOCK)), failed(false) {
+		if ( writtenReady < 0 ) {
+			fl::throwErrno("eventfd()");
+		}
+	}
+	~Shared() {
+		close(writtenReady);
+	}
+};
+
+// Writer thread: write each batch it's given, then pass it back. After a failure the batches are
+// just passed back.
+//
+static void writer(Shared *s, SegmentWriter *w) {
+	const uint64_t n = 1;
+	for ( ; ; ) {
+		Batch *b;
+		{
+			std::unique_lock<std::mutex> l(s->lock);
+			s->ready.wait(l, [s]{ return s->stop || !s->toWrite.empty(); });
+			if ( s->toWrite.empty() ) {
+				break;
+			}
+			b = s->toWrite.front();
+			s->toWrite.pop_front();
+		}
+		try {
+			if ( !s->failed ) {
+				w->write(*b);
+			}
+		}
+		catch ( const std::system_error &e ) {
+			std::lock_guard<std::mutex> l(s->lock);
+			s->error = e.what();
+			s->failed = true;
+		}
+		{
+			std::lock_guard<std::mutex> l(s->lock);
+			s->written.push_back(b);
+		}
+		if ( write(s->writtenReady, &n, sizeof(n)) != sizeof(n) ) {
+			s->failed = true;
+		}
+	}
+	try {
+		if ( !s->failed ) {
+			w->close();
+		}
+	}
+	catch ( const std::system_error &e ) {
+		std::lock_guard<std::mutex> l(s->lock);
+		s->error = e.what();
+		s->failed = true;
+	}
+}
+
+struct RecordOptions {
+	const char *prefix;
+	uint64_t numBufs;     // zero to run until interrupted
+	uint64_t segBytes;
+	uint32_t keep;
+	size_t batchBytes;
+	bool copy;
+	double interval;
+};
+
+static int doRecord(fl::Device &dev, const RecordOptions &opt) {
+	const RingConfig &ring = dev.ring();
+	size_t perBatch = opt.batchBytes / ring.bufSize;
+	if ( perBatch > ring.numBufs / 4 ) {
+		perBatch = ring.numBufs / 4;
+	}
+	if ( !perBatch ) {
+		perBatch = 1;
+	}
+	if ( roundUp((uint64_t)perBatch * ring.bufSize) > opt.segBytes ) {
+		fprintf(stderr, "Segments must be big enough to hold at least one batch!\n");
+		return -1;
+	}
+	Shared s;
+	SegmentWriter w(opt.prefix, opt.segBytes, opt.keep, ring.bufSize, perBatch * ring.bufSize, opt.copy);
+	Batch batches[2];
+	std::vector<Batch*> spare = {&batches[0], &batches[1]}, done;
+	Batch *cur = nullptr;
+	unsigned int inFlight = 0;
+	uint64_t numAcquired = 0, numWritten = 0, bytesWritten = 0, n;
+	bool idle = false;
+	double start = now(), lastReport = start;
+
+	fprintf(stderr, "Writing batches of %zu buffers (%.1f MiB)\n",
+		perBatch, (double)(perBatch * ring.bufSize) / 1048576.0);
+	std::thread t(writer, &s, &w);
+
+	// From here on, a failure must still stop and join the writer, so it's recorded like the
+	// writer's own failures are, rather than thrown past the thread
+	try {
+		// Start Stream-DMA
+		dev.readRegister(0);  // read any register to reset RNG
+		dev.startDMA();
+		start = lastReport = now();
+
+		for ( ; ; ) {
+			// Give back the buffers of the batches the writer has finished with
+			{
+				std::lock_guard<std::mutex> l(s.lock);
+				while ( !s.written.empty() ) {
+					done.push_back(s.written.front());
+					s.written.pop_front();
+				}
+			}
+			for ( Batch *b : done ) {
+				numWritten += b->views.size();
+				bytesWritten += b->bytes;
+				b->views.clear();
+				b->bytes = 0;
+				spare.push_back(b);
+				inFlight--;
+			}
+			done.clear();
+
+			// Pass on the current batch when it's full, or if nothing has arrived for a while
+			const bool finishing =
+				g_stop || s.failed || (opt.numBufs && numAcquired == opt.numBufs);
+			if ( !cur && !spare.empty() ) {
+				cur = spare.back();
+				spare.pop_back();
+			}
+			if ( cur && !cur->views.empty() && (cur->views.size() == perBatch || finishing || idle) ) {
+				{
+					std::lock_guard<std::mutex> l(s.lock);
+					s.toWrite.push_back(cur);
+				}
+				s.ready.notify_one();
+				cur = nullptr;
+				inFlight++;
+				continue;
+			}
+			if ( finishing && !inFlight ) {
+				break;
+			}
+
+			// Take as many filled buffers as there are
+			if ( cur && !finishing ) {
+				fl::BufferView buf = dev.acquire();
+				if ( buf ) {
+					cur->bytes += buf.size();
+					cur->views.push_back(std::move(buf));
+					numAcquired++;
+					idle = false;
+					continue;
+				}
+			}
+
+			// Wait for the FPGA, or for the writer
+			struct pollfd fds[2] = {
+				{s.writtenReady, POLLIN, 0},
+				{dev.fd(), POLLIN, 0}
+			};
+			const int rc = poll(fds, (cur && !finishing) ? 2 : 1, 100);
+			if ( rc < 0 && errno != EINTR ) {
+				fl::throwErrno("poll()");
+			}
+			idle = (rc == 0);
+			if ( rc > 0 && (fds[0].revents & POLLIN) && read(s.writtenReady, &n, sizeof(n)) < 0 ) {
+				fl::throwErrno("read()");
+			}
+			if ( opt.interval > 0 && now() - lastReport >= opt.interval ) {
+				const RingStats st = dev.stats();
+				lastReport = now();
+				fprintf(stderr, "%.1f s: %llu MiB recorded at %.1f MB/s; FPGA starved %llu times\n",
+					lastReport - start, (unsigned long long)(bytesWritten >> 20),
+					(double)bytesWritten / 1e6 / (lastReport - start),
+					(unsigned long long)st.ringFull);
+			}
+		}
+	}
+	catch ( const std::system_error &e ) {
+		std::lock_guard<std::mutex> l(s.lock);
+		s.error = e.what();
+		s.failed = true;
+	}
+
+	// Let the writer finish the last segment
+	{
+		std::lock_guard<std::mutex> l(s.lock);
+		s.stop = true;
+	}
+	s.ready.notify_one();
+	t.join();
+	if ( s.failed ) {
+		fprintf(stderr, "Recording failed: %s\n", s.error.c_str());
+		return -1;
+	}
+	const double elapsed = now() - start;
+	const RingStats st = dev.stats();
+	printf(
+		"Recorded %llu buffers (%llu bytes) in %.1f s (%.1f MB/s) to %u segments; the FPGA was starved "
+		"of buffers %llu times, for %.3f s\n",
+		(unsigned long long)numWritten, (unsigned long long)bytesWritten, elapsed,
+		(double)bytesWritten / 1e6 / elapsed, w.segments(), (unsigned long long)st.ringFull,
+		(double)st.starvedNs / 1e9
+	);
+	return 0;
+}
+
+// Print a segment's index
+static int dumpIndex(const char *path) {
+	FILE *f = fopen(path, "rb");
+	SegmentHeader hdr;
+	SegmentEntry e;
+	int retVal = 0;
+	if ( !f ) {
+		fprintf(stderr, "Unable to open %s!\n", path);
+		retVal = 1; goto exit;
+	}
+	if ( fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, FL_SEGMENT_MAGIC, sizeof(hdr.magic)) ) {
+		fprintf(stderr, "%s isn't a segment index!\n", path);
+		retVal = 1; goto exit;
+	}
+	printf("%u buffers (of up to %u bytes), %llu bytes of data\n",
+		hdr.numEntries, hdr.bufSize, (unsigned long long)hdr.dataBytes);
+	printf("       seq       offset   bytes flags     monotonicNs          realtimeNs  fpgaTime\n");
+	for ( uint32_t i = 0; i < hdr.numEntries; i++ ) {
+		if ( fread(&e, sizeof(e), 1, f) != 1 ) {
+			fprintf(stderr, "%s is truncated!\n", path);
+			retVal = 1; goto exit;
+		}
+		printf("%10u %12llu %7u  %c%c%c  %18llu %19llu",
+			e.desc.seq, (unsigned long long)e.offset, e.desc.bytes,
+			(e.desc.flags & FL_DESC_STALLED) ? 'S' : '-', (e.desc.flags & FL_DESC_FLUSHED) ? 'F' : '-',
+			(e.desc.flags & FL_DESC_FPGA_TIME) ? 'T' : '-', e.desc.timestampNs, e.desc.realtimeNs);
+		if ( e.desc.flags & FL_DESC_FPGA_TIME ) {
+			printf("  %08X", e.desc.fpgaTime);
+		}
+		printf("\n");
+	}
+exit:
+	if ( f ) {
+		fclose(f);
+	}
+	return retVal;
+}
+
+static void usage(const char *prog) {
+	fprintf(
+		stderr,
+		"Synopsis: %s [-d <device>] [-n <numBufs>] [-s <segmentMiB>] [-k <numSegments>]\n"
+		"          [-b <batchMiB>] [-q <queueDepth>] [-c] [-i <reportSecs>] <prefix>\n"
+		"      or: %s -x <indexFile>\n"
+		"  -n 0 (the default) runs until interrupted; -k 0 (the default) keeps every segment\n"
+		"  -q resizes the circular queue first; -c always copies through a bounce buffer\n",
+		prog, prog
+	);
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = "/dev/fpga0";
+	RecordOptions opt = {nullptr, 0, 1024ULL << 20, 0, 4 << 20, false, 10.0};
+	uint32_t queueDepth = 0;
+	RingConfig cfg;
+	int retVal = 0, opt_, fd;
+
+	while ( (opt_ = getopt(argc, argv, "d:n:s:k:b:q:ci:x:")) != -1 ) {
+		switch ( opt_ ) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			opt.numBufs = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			opt.segBytes = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'k':
+			opt.keep = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opt.batchBytes = (size_t)strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'q':
+			queueDepth = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opt.copy = true;
+			break;
+		case 'i':
+			opt.interval = strtod(optarg, NULL);
+			break;
+		case 'x':
+			retVal = dumpIndex(optarg);
+			goto exit;
+		default:
+			usage(argv[0]);
+			retVal = 1; goto exit;
+		}
+	}
+	if ( optind + 1 != argc || !opt.segBytes ) {
+		usage(argv[0]);
+		retVal = 1; goto exit;
+	}
+	opt.prefix = argv[optind];
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	// The Device maps the circular queue as it is, so resize it first if asked to
+	if ( queueDepth ) {
+		fd = open(device, O_RDWR);
+		if ( fd < 0 || flSetupRing(fd, queueDepth, 0, 0, &cfg) ) {
+			fprintf(stderr, "Unable to resize the circular queue of %s: %s\n", device, strerror(errno));
+			if ( fd >= 0 ) {
+				close(fd);
+			}
+			retVal = 4; goto exit;
+		}
+		::close(fd);
+	}
+
+	try {
+		// Connect to the kernel driver, and record the RNG's output...
+		fl::Device dev(device, O_RDWR|O_NONBLOCK);
+		if ( doRecord(dev, opt) ) {
+			retVal = 5;
+		}
+	}
+	catch ( const std::system_error &e ) {
+		fprintf(stderr, "%s. Did you forget to install the driver?\n", e.what());
+		retVal = 4;
+	}
+exit:
+	return retVal;
+}
@@ -0,0 +1,44 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// The on-disk format of a recording. The data goes into numbered segment files, prefix-000000.dat,
+// prefix-000001.dat and so on, each buffer at an offset aligned for O_DIRECT (so normally they're
+// back-to-back). When a segment is finished, an index is written next to it, prefix-000000.idx:
+// a SegmentHeader, then one SegmentEntry per buffer, in the order they were received.
+//
+#ifndef SEGMENT_HPP
+#define SEGMENT_HPP
+
+#include <cstdint>
+#include "fpgalink.h"
+
+#define FL_SEGMENT_MAGIC "FLSEGIX1"
+
+struct SegmentHeader {
+	char magic[8];         // FL_SEGMENT_MAGIC, without its NUL
+	uint32_t numEntries;   // number of SegmentEntry that follow
+	uint32_t bufSize;      // the circular queue's buffer size
+	uint64_t dataBytes;    // length of the segment file
+};
+
+struct SegmentEntry {
+	uint64_t offset;       // where the buffer's data starts in the segment file
+	BufferDesc desc;       // the driver's descriptor: sequence number, length, flags and timestamps
+};
+
+#endif
@@ -0,0 +1,300 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Online verifier for the pcie-dma design. Each filled buffer is borrowed zero-copy from the
+// circular queue, and compared with the same stretch of the dvr_rng64 stream, generated in lockstep
+// by the fast software model; nothing touches the disk, so it can run at full link rate for as long
+// as you like.
+//
+// While in sync, each buffer costs one Generate() and one memcmp(). On a mismatch the verifier
+// reports it, then indexes the next stretch of the model's stream, and looks each qword it receives
+// up in that until a run of them matches again. At that point it reports how many bad qwords it saw
+// and how far the stream jumped, and carries on from there (jumping the model ahead, rather than
+// stepping it). If the window runs out first, it's moved on and the search continues.
+//
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "fpgalink.hpp"
+#include "dvr_rng.hpp"
+#include "rng_jump.hpp"
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+	g_stop = 1;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t qword(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+class Verifier {
+	static const size_t CONFIRM = 16;  // qwords that must match to regain sync
+
+	const rng_jump &jump_;
+	const rng_fast origin_;      // the model, freshly seeded
+	rng_fast model_;             // the model, at modelPos_
+	const size_t window_;        // how far ahead (in qwords) to look for the stream after a mismatch
+	std::vector<uint32_t> expected_;
+	uint64_t modelPos_;          // the model qword expected next
+	uint64_t rxPos_;             // qwords received so far
+
+	// While out of sync: the model's stream from winPos_ on, and an index of it
+	bool lost_;
+	uint64_t lostModel_, lostRx_;
+	uint64_t winPos_;
+	std::vector<uint32_t> win_;
+	std::unordered_map<uint64_t, uint64_t> index_;
+
+	void seek(uint64_t pos) {
+		model_ = origin_;
+		jump_.Skip(model_, pos);
+		modelPos_ = pos;
+	}
+
+	uint64_t winQword(uint64_t pos) const {
+		const size_t i = (size_t)(pos - winPos_);
+		return ((uint64_t)win_[2*i + 1] << 32) | win_[2*i];
+	}
+
+	void buildWindow(uint64_t pos) {
+		rng_fast f(origin_);
+		jump_.Skip(f, pos);
+		win_.resize(2 * (window_ + CONFIRM));
+		f.Generate(win_.data(), window_ + CONFIRM);
+		winPos_ = pos;
+		index_.clear();
+		for ( size_t i = window_; i-- > 0; ) {
+			index_[winQword(pos + i)] = pos + i;  // so the earliest occurrence wins
+		}
+	}
+
+	// Does the received data match the window from pos on, for as much of it as there is?
+	bool confirm(const uint8_t *data, size_t avail, uint64_t pos) const {
+		const size_t num = (avail < CONFIRM) ? avail : CONFIRM;
+		for ( size_t i = 0; i < num; i++ ) {
+			if ( qword(data + 8*i) != winQword(pos + i) ) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	uint64_t numBad, numMismatches, numResyncs;
+
+	Verifier(const rng_jump &jump, const rng_fast &origin, size_t window, size_t bufQwords)
+		: jump_(jump), origin_(origin), model_(origin), window_(window),
+		  expected_(2 * bufQwords), modelPos_(0), rxPos_(0), lost_(false), lostModel_(0),
+		  lostRx_(0), winPos_(0), numBad(0), numMismatches(0), numResyncs(0)
+	{ }
+
+	uint64_t received() const { return rxPos_; }
+
+	// Check the next numQwords qwords of the stream
+	void check(const uint8_t *data, size_t numQwords) {
+		size_t i = 0;
+		while ( i < numQwords ) {
+			if ( !lost_ ) {
+				const size_t num = numQwords - i;
+				model_.Generate(expected_.data(), num);
+				if ( !memcmp(data + 8*i, expected_.data(), 8*num) ) {
+					modelPos_ += num;
+					rxPos_ += num;
+					return;
+				}
+
+				// Find the first bad qword
+				size_t j = 0;
+				while ( !memcmp(data + 8*(i + j), &expected_[2*j], 8) ) {
+					j++;
+				}
+				const uint64_t expected = ((uint64_t)expected_[2*j + 1] << 32) | expected_[2*j];
+				printf(
+					"Mismatch at byte 0x%llX (model qword %llu): expected %016llX, got %016llX\n",
+					(unsigned long long)(8*(rxPos_ + j)), (unsigned long long)(modelPos_ + j),
+					(unsigned long long)expected, (unsigned long long)qword(data + 8*(i + j))
+				);
+				numMismatches++;
+				i += j;
+				rxPos_ += j;
+				modelPos_ += j;
+				lost_ = true;
+				lostModel_ = modelPos_;
+				lostRx_ = rxPos_;
+				buildWindow(modelPos_);
+			}
+
+			// Out of sync: look for a run of qwords which matches the model somewhere
+			while ( i < numQwords ) {
+				const std::unordered_map<uint64_t, uint64_t>::const_iterator it =
+					index_.find(qword(data + 8*i));
+				if ( it != index_.end() && confirm(data + 8*i, numQwords - i, it->second) ) {
+					printf(
+						"Resync at byte 0x%llX (model qword %llu) after %llu bad qwords: net %lld qwords "
+						"dropped\n",
+						(unsigned long long)(8*rxPos_), (unsigned long long)it->second,
+						(unsigned long long)(rxPos_ - lostRx_),
+						(long long)(it->second - lostModel_) - (long long)(rxPos_ - lostRx_)
+					);
+					numResyncs++;
+					lost_ = false;
+					seek(it->second);
+					break;
+				}
+				numBad++;
+				i++;
+				rxPos_++;
+				if ( rxPos_ - lostRx_ >= winPos_ - lostModel_ + window_ ) {
+					buildWindow(winPos_ + window_);  // so many bad qwords they can't all be a drop
+				}
+			}
+		}
+	}
+};
+
+static int doVerify(fl::Device &dev, uint64_t numBufs, size_t window, double interval) {
+	const dvr_rng_params &p = DVR_RNG64;
+	const rng g(p.n, p.r, p.t, p.k, p.s);
+	const rng_jump jump(g);
+	rng_fast origin(g);
+	origin.Load(SeedState(g, p.seed));
+	Verifier v(jump, origin, window, dev.ring().bufSize / 8);
+	uint64_t numDone = 0;
+	double start, lastReport;
+
+	// Start Stream-DMA
+	dev.readRegister(0);  // read any register to reset RNG
+	dev.startDMA();
+	start = lastReport = now();
+
+	while ( !g_stop && (!numBufs || numDone < numBufs) ) {
+		fl::BufferView buf = dev.acquire();
+		if ( buf ) {
+			if ( buf.size() % 8 ) {
+				fprintf(stderr, "Buffer %u has %zu bytes, which isn't a whole number of qwords!\n",
+					buf.sequence(), buf.size());
+				return -1;
+			}
+			v.check(buf.data(), buf.size() / 8);
+			numDone++;
+		} else {
+			struct pollfd fd = {dev.fd(), POLLIN, 0};
+			if ( poll(&fd, 1, 100) < 0 && errno != EINTR ) {
+				fl::throwErrno("poll()");
+			}
+		}
+		if ( interval > 0 && now() - lastReport >= interval ) {
+			lastReport = now();
+			fprintf(stderr, "%.1f s: %llu MiB verified at %.1f MB/s; %llu mismatches, %llu bad qwords\n",
+				lastReport - start, (unsigned long long)(v.received() >> 17),
+				8.0 * (double)v.received() / 1e6 / (lastReport - start),
+				(unsigned long long)v.numMismatches, (unsigned long long)v.numBad);
+		}
+	}
+	const double elapsed = now() - start;
+	printf(
+		"Verified %llu buffers (%llu bytes) in %.1f s (%.1f MB/s): %llu mismatches, %llu bad qwords, "
+		"%llu resyncs\n",
+		(unsigned long long)numDone, (unsigned long long)(8*v.received()), elapsed,
+		8.0 * (double)v.received() / 1e6 / elapsed, (unsigned long long)v.numMismatches,
+		(unsigned long long)v.numBad, (unsigned long long)v.numResyncs
+	);
+	return v.numMismatches ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(
+		stderr,
+		"Synopsis: %s [-d <device>] [-n <numBufs>] [-w <windowQwords>] [-i <reportSecs>]\n"
+		"  -n 0 (the default) runs until interrupted\n",
+		prog
+	);
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = "/dev/fpga0";
+	uint64_t numBufs = 0;
+	size_t window = 1 << 20;
+	double interval = 10.0;
+	int retVal = 0, opt;
+
+	while ( (opt = getopt(argc, argv, "d:n:w:i:")) != -1 ) {
+		switch ( opt ) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			numBufs = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = (size_t)strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			retVal = 1; goto exit;
+		}
+	}
+	if ( optind != argc || !window ) {
+		usage(argv[0]);
+		retVal = 1; goto exit;
+	}
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	try {
+		// Connect to the kernel driver, and check the RNG's output against the model...
+		fl::Device dev(device, O_RDWR|O_NONBLOCK);
+		switch ( doVerify(dev, numBufs, window, interval) ) {
+		case 0:
+			break;
+		case 1:
+			retVal = 2;  // verification failed
+			break;
+		default:
+			retVal = 3;
+			break;
+		}
+	}
+	catch ( const std::system_error &e ) {
+		fprintf(stderr, "%s. Did you forget to install the driver?\n", e.what());
+		retVal = 4;
+	}
+exit:
+	return retVal;
+}
@@ -24,6 +24,11 @@
 
 int main(int argc, const char *argv[]) {
 	int retVal = 0, dev, i;
+	volatile uint32_t *regs;
+	uint32_t batch[] = {
+		FL_BATCH_CMD(FL_BATCH_WR, 6, 2), 0xDEADBEEF, 0xCAFEBABE, 0xF00DFACE, 0x12345678, 0x9ABCDEF0, 0x0F1E2D3C,
+		FL_BATCH_CMD(FL_BATCH_RD, 6, 2), 0, 0, 0, 0, 0, 0
+	};
 	struct Cmd cmds[] = {
 		WR(2, 0x34D9E13F),
 		WR(3, 0x863FFC01),
@@ -58,6 +63,43 @@ int main(int argc, const char *argv[]) {
 		}
 	}
 
+	// Do the same again, as a single batch
+	printf("Write six registers & readback, batched:\n");
+	if ( flCmdBatch(dev, batch, sizeof(batch)/sizeof(*batch), NULL) ) {
+		fprintf(stderr, "FPGALINK_CMDBATCH failed!\n");
+		retVal = 2; goto close;
+	}
+	for ( i = 0; i < 6; i++ ) {
+		printf("  %d: 0x%08X", i+2, batch[8+i]);
+		if ( batch[8+i] == batch[1+i] ) {
+			printf(" (✓)\n");
+		} else {
+			printf(" (✗)\n");
+		}
+	}
+
+	// And again, through the register mapping
+	printf("Write six registers & readback, mmap()'d:\n");
+	regs = flMapRegs(dev);
+	if ( !regs ) {
+		fprintf(stderr, "Unable to map the FPGA registers!\n");
+		retVal = 3; goto close;
+	}
+	for ( i = 0; i < 6; i++ ) {
+		flPoke(regs, (uint32_t)i+2, cmds[i].val ^ 0xFFFFFFFF);
+	}
+	for ( i = 0; i < 6; i++ ) {
+		const uint32_t val = flPeek(regs, (uint32_t)i+2);
+		printf("  %d: 0x%08X", i+2, val);
+		if ( val == (cmds[i].val ^ 0xFFFFFFFF) ) {
+			printf(" (✓)\n");
+		} else {
+			printf(" (✗)\n");
+		}
+	}
+	flUnmapRegs(regs);
+
+close:
 	// Close device
 	close(dev);
 exit:
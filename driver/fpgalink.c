@@ -17,19 +17,30 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
 #include <linux/cdev.h>
 #include <linux/delay.h>
+#include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/eventfd.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/iopoll.h>
 #include <linux/jiffies.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include "ioctl_defs.h"
 
-// The number of DMA buffers to use in the circular queue
-#define NUM_BUFS 32
+#define CREATE_TRACE_POINTS
+#include "fpgalink_trace.h"
 
 // Allow numeric macros to be stringified by the preprocessor
 #define STR(a) _STR(a)
@@ -43,9 +54,51 @@
 #define DMABASE(x) ((x)+0*2+1)
 #define DMACTRL(x) ((x)+1*2+1)
 
+// Each register is accessed at a 64-bit-aligned offset (plus one dword) into BAR0, so the number of
+// registers the driver can reach depends on how much of BAR0 it maps.
+#define REG_ADDR(x, reg) ((x)+(reg)*2+1)
+#define NUM_REGS (barMinLen[0]/8)
+
+// The FPGA writes its status records round-robin into the 512 slots of one 4KiB page; see
+// tlp_core.vhdl. Each record is a 64-bit word: the number of TLPs written in bits 9:0, whether the
+// buffer was flushed early in bit 31, and the record's sequence number in bits 63:32. Writing the
+// page's address to DMABASE with bit 0 set turns them on, and resets the sequence number.
+#define FL_STATUS_RECORDS 512
+#define FL_STATUS_SIZE (FL_STATUS_RECORDS * sizeof(u64))
+#define FL_STATUS_TLPS(r) ((u32)(r) & 0x3FF)
+#define FL_STATUS_FLUSHED(r) ((r) & 0x80000000ULL)
+#define FL_STATUS_SEQ(r) ((u32)((r) >> 32))
+
+// More of the DMA register protocol in tlp_core.vhdl. The low bits of a DMABASE write select what
+// the address is for: a receive buffer, the status-record page, or the TX status word, which the
+// FPGA sets to its count of finished host-to-FPGA transfers. Setting FL_DMACTRL_TX in a DMACTRL
+// write makes it a host-to-FPGA transfer of the buffer at the last DMABASE address. Bit 32 of the
+// TX status word is set if the FPGA abandoned the last transfer because one of its reads failed.
+#define FL_DMABASE_STATUS   0x1
+#define FL_DMABASE_TXSTATUS 0x2
+#define FL_DMACTRL_TX       (1 << 15)
+#define FL_TXSTATUS_FAILED(s) ((s) & (1ULL << 32))
+
+// The most receive buffers the FPGA is given at once. tlp_core queues them in a 32-entry FIFO;
+// once that's full, the DMABASE/DMACTRL writes for more back up in its rx_fifo, holding up the TX
+// completions behind them and stalling the CPU on posted writes with ape->lock held. The rest of
+// the free buffers are submitted as the FPGA completes these, however many the ring has.
+#define FL_MAX_INFLIGHT 28
+
+// The FPGA can't be told to forget the buffers it's been given; they're only done with once it's
+// filled them (or flushed them, if flushing is on). This is how long starting a new streaming
+// session waits for those left over from the last one.
+#define FL_DRAIN_MSECS 1000
+
+// How long fsync() waits for the FPGA to finish with another TX buffer before giving up
+#define FL_TX_TIMEOUT_MSECS 1000
+
 // Driver name
 #define DRV_NAME "fpgalink"
 
+// Maximum number of cards; each one gets a minor number, and appears as /dev/fpgaN
+#define FL_MAX_DEVICES 16
+
 // Number of BARs on the device
 #define APE_BAR_NUM (1)
 
@@ -61,13 +114,78 @@ static const unsigned long barMinLen[APE_BAR_NUM] = {
 	256
 };
 
-// The form of this struct is known also to ip/pcie/tlp_core.vhdl, so if you
-// edit it here, you'll probably have to edit something there too. One important
-// thing to remember is that each buffer must be aligned to a 128-byte (TLP)
-// boundary, otherwise you get weird kernel hangs.
+// Geometry of the circular queue each device starts with; userspace may change it with
+// FPGALINK_SETUP before starting DMA.
+//
+static unsigned int defaultNumBufs = NUM_BUFS;
+module_param_named(numBufs, defaultNumBufs, uint, S_IRUGO);
+MODULE_PARM_DESC(numBufs, "Number of DMA buffers in the circular queue (a power of two)");
+
+static unsigned int defaultBufSize = BUF_SIZE;
+module_param_named(bufSize, defaultBufSize, uint, S_IRUGO);
+MODULE_PARM_DESC(bufSize, "Size in bytes of each DMA buffer (a multiple of 128)");
+
+static unsigned int defaultRingMode = FL_RING_CONTIGUOUS;
+module_param_named(ringMode, defaultRingMode, uint, S_IRUGO);
+MODULE_PARM_DESC(ringMode, "How to allocate the circular queue (1=contiguous, 2=scatter)");
+
+// Interrupt coalescing. The FPGA raises one MSI per completed buffer, and each one must be counted,
+// so interrupts are never masked. Instead, the interrupt handler just publishes the new head, and
+// the expensive part (resubmitting buffers and waking readers) is deferred to the IRQ thread until
+// coalesceCount completions have accumulated, or until coalesceUsecs have passed since the first
+// of them. With at most FL_MAX_INFLIGHT buffers in flight, more than half that many can't be
+// coalesced without starving the FPGA, so coalesceCount is capped there. These may be changed at
+// any time through /sys/module/fpgalink/parameters.
+//
+static unsigned int coalesceCount = 1;
+module_param(coalesceCount, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(coalesceCount, "Completions to batch up before resubmitting and waking readers (1=no coalescing)");
+
+static unsigned int coalesceUsecs = 100;
+module_param(coalesceUsecs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(coalesceUsecs, "Maximum time in microseconds a coalesced completion may wait");
+
+// Partial-buffer flushing. If flushUsecs is nonzero when DMA is started, the FPGA closes out any
+// partly-filled buffer once its data source has been idle for that long, and reports how much of
+// each buffer it actually filled in a status record. That gives low latency for sparse data, at the
+// cost of one extra (8-byte) write to host memory per buffer.
+//
+static unsigned int flushUsecs = 0;
+module_param(flushUsecs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(flushUsecs, "Idle time in microseconds after which a partly-filled buffer is completed (0=never)");
+
+// A register holding a free-running FPGA counter, to be read into each buffer's descriptor when it
+// completes. It's an extra uncached read in the interrupt handler, so it's off (-1) by default.
+//
+static int timestampReg = -1;
+module_param(timestampReg, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(timestampReg, "FPGA register to read into each buffer descriptor's fpgaTime (-1=none)");
+
+// Geometry of each device's host-to-FPGA (TX) queue, which is always contiguous
+//
+static unsigned int txNumBufs = TX_NUM_BUFS;
+module_param(txNumBufs, uint, S_IRUGO);
+MODULE_PARM_DESC(txNumBufs, "Number of DMA buffers in the TX queue (a power of two)");
+
+static unsigned int txBufSize = TX_BUF_SIZE;
+module_param(txBufSize, uint, S_IRUGO);
+MODULE_PARM_DESC(txBufSize, "Size in bytes of each TX DMA buffer (a multiple of 128)");
+
+// A circular queue of numBufs DMA buffers of bufSize bytes, which appear at intervals of bufStride
+// bytes when mmap()'d by userspace. In FL_RING_CONTIGUOUS mode the buffers are carved out of one
+// block of coherent memory, and in FL_RING_SCATTER mode each buffer is a separately-allocated
+// (compound) page with a streaming DMA mapping. Either way, the address of each buffer is looked up
+// in the virt[] and bus[] tables. The descs[] array holds each slot's struct BufferDesc, and is
+// allocated with vmalloc_user() so it can be mapped into userspace.
 //
-struct Buffer {
-	u8 data[BUF_SIZE];
+struct Ring {
+	u32 mode, numBufs, bufSize, bufStride;
+	u8 *blockVirt;
+	dma_addr_t blockBus;
+	struct page **pages;
+	u8 **virt;
+	dma_addr_t *bus;
+	struct BufferDesc *descs;
 };
 
 // Altera PCI Express ('ape') board specific book keeping data
@@ -87,19 +205,98 @@ struct AlteraDevice {
 	// Board revision
 	u8 revision;
 
-	// Array of NUM_BUFS blocks implementing a circular buffer
-	struct Buffer *bufferArrayVirt;
-	dma_addr_t bufferArrayBus;
-
-	// Circular buffer metadata and spinlock
-	u32 numAvailable, numSubmitted, outIndex;
+	// The DMA buffers implementing a circular buffer. The ringMutex serialises changes to the ring
+	// with everything that touches the buffers from process context, and bufferMaps counts the
+	// userspace mappings that would stop it being changed.
+	struct Ring ring;
+	struct mutex ringMutex;
+	atomic_t bufferMaps;
+
+	// Circular buffer metadata and spinlock. These are free-running counts of buffers: buffer N lives
+	// in slot (N & (numBufs-1)). Buffers move through the queue in order: they're submitted to the
+	// FPGA, filled by the FPGA (head), acquired by userspace (either implicitly by read(), or
+	// explicitly with FPGALINK_ACQUIRE), and then released by userspace (tail), before being
+	// resubmitted. The head and tail are published to userspace through the ringHeader page.
+	struct RingHeader *ringHeader;
+	u32 head, acquired, tail, submitted;
 	spinlock_t lock;
 	wait_queue_head_t wq;
 
-	// Character device and major number
-	int major;
+	// Whether the queue has been started with OP_SD, and its statistics since then. The FPGA is
+	// starved if it's been left with no buffers to fill, in which case starvedSince is when that
+	// started.
+	int running;
+	struct RingStats stats;
+	u64 starvedSince;
+
+	// The FPGA's status records (see FL_STATUS_RECORDS), and the flush timeout (in the FPGA's units
+	// of 128 clocks) for this run of DMA. Status records are only used if the timeout is nonzero.
+	u64 *statusRecords;
+	dma_addr_t statusBus;
+	u32 flushUnits;
+
+	// Completions not yet handled by drainQueue(), and the timer bounding how long they may wait
+	u32 pending;
+	struct hrtimer coalesceTimer;
+
+	// When the oldest pending and the newest completions were interrupted; only kept up to date
+	// while the corresponding tracepoints are enabled, and zero if they weren't at the time
+	u64 pendingSince, irqNs;
+
+	// The host-to-FPGA (TX) queue, which works like the receive queue in reverse. These are also
+	// free-running counts of buffers: they're acquired by userspace (acquired), filled and submitted
+	// to the driver (head), sent to the FPGA (submitted), and read by the FPGA (done), at which point
+	// they're free again. The FPGA only does one transfer at a time, so at most one buffer is ever
+	// in flight. Each buffer's length is kept in its descriptor. The txMutex serialises writers; the
+	// spinlock protects submitted and done, and the DMA registers, which are shared with receive.
+	struct Ring txRing;
+	struct mutex txMutex;
+	u32 txAcquired, txHead, txSubmitted, txDone;
+	wait_queue_head_t txWq;
+	u64 *txStatus;
+
+	// The open file (if any) which has acquired TX buffers with FPGALINK_TXACQUIRE that it hasn't
+	// submitted yet, protected by the txMutex. Only it may submit them, and they're given back if
+	// it's closed first.
+	struct FileState *txOwner;
+
+	// The open file (if any) which owns the streaming session, protected by the spinlock. Only the
+	// owner may start DMA or move buffers through the queue; other opens are limited to register
+	// access and looking at the queue.
+	struct FileState *streamOwner;
+
+	// Character device, its minor number and its sysfs node
+	int minor;
 	struct cdev charDevice;
+	struct device *classDevice;
+};
+
+// Per-open-file state
+//
+struct FileState {
+	struct AlteraDevice *ape;
+	int streaming;
+
+	// Command batches submitted with FPGALINK_SUBMIT: they're run in order by asyncWork, and then
+	// wait on the done list to be reaped with FPGALINK_REAP. Completions are announced by waking
+	// asyncWq (so poll() reports POLLPRI), and by signalling asyncEventFd, if userspace gave us
+	// one. All protected by asyncLock.
+	spinlock_t asyncLock;
+	struct list_head asyncQueued, asyncDone;
+	u32 asyncCount;
+	struct work_struct asyncWork;
+	wait_queue_head_t asyncWq;
+	struct eventfd_ctx *asyncEventFd;
+};
+
+// A command batch submitted with FPGALINK_SUBMIT, and the kernel's copy of its words
+//
+struct AsyncJob {
+	struct list_head list;
+	struct CmdAsync req;
+	u32 words[];
 };
+static void asyncWorker(struct work_struct *work);
 
 // Using the subsystem vendor id and subsystem id, it is possible to
 // distinguish between different cards bases around the same
@@ -115,6 +312,18 @@ static const struct pci_device_id ids[] = {
 };
 MODULE_DEVICE_TABLE(pci, ids);
 
+// The char device region shared by all cards, the minor numbers in use, and the sysfs class through
+// which udev creates the /dev/fpgaN nodes.
+//
+static dev_t flDevBase;
+static DEFINE_IDA(flMinors);
+static struct class *flClass;
+
+// Asynchronous command batches run here rather than on the system workqueue, because a batch may
+// spend a while polling a register.
+//
+static struct workqueue_struct *flAsyncWq;
+
 // Used to register the driver with the PCI kernel subsystem (see LDD3 page 311)
 //
 static int  __devinit pcieProbe(struct pci_dev *dev, const struct pci_device_id *id);
@@ -126,51 +335,347 @@ static struct pci_driver pciDriver = {
 	.remove = pcieRemove
 };
 
-// Callbacks for file operations on /dev/fpga0
+// Callbacks for file operations on /dev/fpgaN
 //
 static int cdevOpen(struct inode *inode, struct file *filp);
 static int cdevRelease(struct inode *inode, struct file *filp);
-static ssize_t cdevRead(struct file *filp, char __user *buf, size_t count, loff_t *filePos);
+static ssize_t cdevReadIter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t cdevWriteIter(struct kiocb *iocb, struct iov_iter *from);
+static int cdevFsync(struct file *filp, loff_t start, loff_t end, int datasync);
 static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg);
+static int cdevMMap(struct file *filp, struct vm_area_struct *vma);
+static unsigned int cdevPoll(struct file *filp, poll_table *wait);
 static const struct file_operations cdevFileOps = {
 	.owner          = THIS_MODULE,
 	.open           = cdevOpen,
 	.release        = cdevRelease,
-	.read           = cdevRead,
-	.unlocked_ioctl = cdevIOCtl
+	.read_iter      = cdevReadIter,
+	.write_iter     = cdevWriteIter,
+	.splice_read    = generic_file_splice_read,
+	.fsync          = cdevFsync,
+	.poll           = cdevPoll,
+	.unlocked_ioctl = cdevIOCtl,
+	.mmap           = cdevMMap
 };
 
-// Submit a DMA request for the given number of TLPs at the specified address
+// Whether there's a TX buffer userspace could acquire
+//
+static inline int txBufferFree(const struct AlteraDevice *ape) {
+	return READ_ONCE(ape->txAcquired) - READ_ONCE(ape->txDone) < ape->txRing.numBufs;
+}
+
+// Get the kernel virtual address of the given buffer
+//
+static inline u8 *bufferVirt(const struct AlteraDevice *ape, u32 n) {
+	return ape->ring.virt[n & (ape->ring.numBufs - 1)];
+}
+
+// Get the bus address of the given buffer
+//
+static inline dma_addr_t bufferBus(const struct AlteraDevice *ape, u32 n) {
+	return ape->ring.bus[n & (ape->ring.numBufs - 1)];
+}
+
+// Streaming DMA mappings need to be handed back and forth between the CPU and the device. This is a
+// no-op for coherent memory.
+//
+static inline void bufferForCpu(struct AlteraDevice *ape, u32 n) {
+	if ( ape->ring.mode == FL_RING_SCATTER ) {
+		dma_sync_single_for_cpu(
+			&ape->pciDevice->dev, bufferBus(ape, n), ape->ring.bufSize, DMA_FROM_DEVICE
+		);
+	}
+}
+
+static inline void bufferForDevice(struct AlteraDevice *ape, u32 n) {
+	if ( ape->ring.mode == FL_RING_SCATTER ) {
+		dma_sync_single_for_device(
+			&ape->pciDevice->dev, bufferBus(ape, n), ape->ring.bufSize, DMA_FROM_DEVICE
+		);
+	}
+}
+
+// Submit a DMA request for the given number of TLPs at the specified address. The flush timeout goes
+// in the top half of the control word.
 //
 static inline void submitDmaReq(struct AlteraDevice *ape, dma_addr_t addr, u32 numTLPs) {
 	u32 __iomem *const regSpace = (u32 __iomem *)ape->bar[0];
 	iowrite32((u32)addr, DMABASE(regSpace));
-	iowrite32(numTLPs, DMACTRL(regSpace));
+	iowrite32(numTLPs | (ape->flushUnits << 16), DMACTRL(regSpace));
+}
+
+// Pick up any buffers userspace has released by advancing the shared tail. Return nonzero if the
+// tail moved. Must be called with ape->lock held.
+//
+static int syncTail(struct AlteraDevice *ape) {
+	// Userspace has finished reading any buffers before the tail. It can only advance, and it cannot
+	// pass the head, so anything else is just ignored.
+	const u32 tail = smp_load_acquire(&ape->ringHeader->tail);
+	if ( tail == ape->tail || tail - ape->tail > ape->head - ape->tail ) {
+		return 0;
+	}
+	if ( tail - ape->tail > ape->acquired - ape->tail ) {
+		ape->acquired = tail;  // userspace consumed buffers without FPGALINK_ACQUIRE
+	}
+	ape->stats.delivered += tail - ape->tail;
+	ape->tail = tail;
+	return 1;
+}
+
+// Userspace has finished with the buffers before the given tail. Must be called with ape->lock held.
+//
+static inline void advanceTail(struct AlteraDevice *ape, u32 tail) {
+	ape->stats.delivered += tail - ape->tail;
+	ape->tail = tail;
+	WRITE_ONCE(ape->ringHeader->tail, tail);
+}
+
+// Keep the FPGA supplied with as many free buffers as will fit, up to FL_MAX_INFLIGHT. Must be
+// called with ape->lock held.
+//
+static void refillQueue(struct AlteraDevice *ape) {
+	struct RingHeader *const hdr = ape->ringHeader;
+	if ( !ape->running ) {
+		return;
+	}
+	syncTail(ape);
+	for ( ; ; ) {
+		// Resubmit unused buffers, as many as the FPGA can take
+		while (
+			ape->submitted - ape->tail < ape->ring.numBufs &&
+			ape->submitted - ape->head < FL_MAX_INFLIGHT
+		) {
+			ape->ring.descs[ape->submitted & (ape->ring.numBufs - 1)].flags =
+				ape->starvedSince ? FL_DESC_STALLED : 0;
+			bufferForDevice(ape, ape->submitted);
+			submitDmaReq(ape, bufferBus(ape, ape->submitted), ape->ring.bufSize/128);
+			trace_fpgalink_submit(
+				ape->minor, ape->submitted, ape->submitted & (ape->ring.numBufs - 1),
+				bufferBus(ape, ape->submitted), ape->ring.bufSize/128
+			);
+			ape->submitted++;
+		}
+		if ( ape->submitted != ape->head ) {
+			// There are DMA requests in flight, so we'll be back here on the next completion
+			if ( ape->starvedSince ) {
+				ape->stats.starvedNs += ktime_get_ns() - ape->starvedSince;
+				ape->starvedSince = 0;
+			}
+			WRITE_ONCE(hdr->idle, 0);
+			return;
+		}
+
+		// The FPGA has no buffers left, because userspace is holding all of them
+		if ( !ape->starvedSince ) {
+			ape->starvedSince = ktime_get_ns();
+			ape->stats.ringFull++;
+		}
+
+		// Nothing in flight, so there won't be another completion: from now on userspace must tell
+		// us with FPGALINK_SYNC when it advances the tail. Check it didn't do so just before it
+		// could see the idle flag.
+		WRITE_ONCE(hdr->idle, 1);
+		smp_mb();
+		if ( !syncTail(ape) ) {
+			return;
+		}
+	}
+}
+
+// Reset the circular buffer and start the FPGA filling it. Any DMA requests still in flight would
+// complete into the new session's buffers, so stop resubmitting and wait up to FL_DRAIN_MSECS for
+// them first. Returns -EBUSY if they're still outstanding after that, and -ERESTARTSYS if the wait
+// is interrupted by a signal. Must be called in process context, without ape->lock.
+//
+static int startQueue(struct AlteraDevice *ape) {
+	u32 usecs;
+	unsigned long flags;
+	long rc;
+	spin_lock_irqsave(&ape->lock, flags);
+	ape->running = 0;
+	spin_unlock_irqrestore(&ape->lock, flags);
+	rc = wait_event_interruptible_timeout(
+		ape->wq, READ_ONCE(ape->head) == READ_ONCE(ape->submitted), msecs_to_jiffies(FL_DRAIN_MSECS)
+	);
+	if ( rc < 0 ) {
+		return rc;
+	}
+	mutex_lock(&ape->ringMutex);
+	spin_lock_irqsave(&ape->lock, flags);
+	if ( ape->head != ape->submitted ) {
+		spin_unlock_irqrestore(&ape->lock, flags);
+		mutex_unlock(&ape->ringMutex);
+		printk(KERN_DEBUG "startQueue(): the FPGA still has %u buffers!\n", ape->submitted - ape->head);
+		return -EBUSY;
+	}
+	usecs = min_t(u32, READ_ONCE(flushUsecs), 0xFFFF * 128 / 125);
+	ape->flushUnits = DIV_ROUND_UP(usecs * 125, 128);
+	if ( ape->flushUnits ) {
+		// Invalidate the old records, and have the FPGA start writing new ones from slot zero
+		memset(ape->statusRecords, 0xFF, FL_STATUS_SIZE);
+		wmb();
+		iowrite32((u32)ape->statusBus | FL_DMABASE_STATUS, DMABASE((u32 __iomem *)ape->bar[0]));
+	}
+	ape->head = ape->acquired = ape->tail = ape->submitted = ape->pending = 0;
+	memset(&ape->stats, 0, sizeof(struct RingStats));
+	ape->starvedSince = 0;
+	ape->running = 1;
+	WRITE_ONCE(ape->ringHeader->head, 0);
+	WRITE_ONCE(ape->ringHeader->tail, 0);
+	refillQueue(ape);
+	spin_unlock_irqrestore(&ape->lock, flags);
+	mutex_unlock(&ape->ringMutex);
+	return 0;
+}
+
+// Send the next TX buffer to the FPGA, if it's not already busy with one. Must be called with
+// ape->lock held.
+//
+static void kickTx(struct AlteraDevice *ape) {
+	u32 __iomem *const regSpace = (u32 __iomem *)ape->bar[0];
+	u32 slot;
+	if ( ape->txSubmitted != ape->txDone || ape->txSubmitted == ape->txHead ) {
+		return;
+	}
+	slot = ape->txSubmitted & (ape->txRing.numBufs - 1);
+	iowrite32((u32)ape->txRing.bus[slot], DMABASE(regSpace));
+	iowrite32(FL_DMACTRL_TX | ape->txRing.descs[slot].bytes/128, DMACTRL(regSpace));
+	ape->txSubmitted++;
+}
+
+// Handle all the completions counted since the last time: keep the FPGA supplied with buffers, and
+// wake up anyone waiting for them.
+//
+static void drainQueue(struct AlteraDevice *ape) {
+	unsigned long flags;
+	u64 t0;
+	spin_lock_irqsave(&ape->lock, flags);
+	t0 = trace_fpgalink_lock_enabled() ? ktime_get_ns() : 0;
+	hrtimer_try_to_cancel(&ape->coalesceTimer);
+	if ( trace_fpgalink_drain_enabled() && ape->pending && ape->pendingSince ) {
+		// Batches which started before the tracepoint was enabled have no timestamp, so skip them
+		trace_fpgalink_drain(ape->minor, ape->head, ape->pending, ktime_get_ns() - ape->pendingSince);
+	}
+	ape->pending = 0;
+	refillQueue(ape);
+	spin_unlock_irqrestore(&ape->lock, flags);
+	if ( t0 ) {
+		trace_fpgalink_lock(ape->minor, FL_LOCK_DRAIN, ktime_get_ns() - t0);
+	}
+	wake_up_interruptible(&ape->wq);
+}
+
+// Called when coalesced completions have waited for coalesceUsecs
+//
+static enum hrtimer_restart coalesceTimeout(struct hrtimer *timer) {
+	drainQueue(container_of(timer, struct AlteraDevice, coalesceTimer));
+	return HRTIMER_NORESTART;
+}
+
+// Fill in the descriptor for a buffer the FPGA just completed. It's published by the store-release
+// of the head that follows. Must be called with ape->lock held.
+//
+static inline void fillDesc(struct AlteraDevice *ape, u32 n) {
+	struct BufferDesc *const desc = &ape->ring.descs[n & (ape->ring.numBufs - 1)];
+	const int reg = READ_ONCE(timestampReg);
+	u32 flags = (desc->flags & FL_DESC_STALLED) | FL_DESC_VALID;
+	u32 bytes = ape->ring.bufSize;
+	u64 rec;
+	if ( ape->flushUnits ) {
+		// The status record was written before the MSI, so it's already there
+		rec = READ_ONCE(ape->statusRecords[n & (FL_STATUS_RECORDS - 1)]);
+		if ( FL_STATUS_SEQ(rec) == n ) {
+			bytes = FL_STATUS_TLPS(rec) * 128;
+			if ( FL_STATUS_FLUSHED(rec) ) {
+				flags |= FL_DESC_FLUSHED;
+			}
+		} else {
+			printk_once(KERN_DEBUG "fillDesc(): bad status record; does the FPGA support flushing?\n");
+		}
+	}
+	desc->seq = n;
+	desc->bytes = bytes;
+	desc->timestampNs = ktime_get_ns();
+	desc->realtimeNs = ktime_get_real_ns();
+	if ( reg >= 0 && reg < NUM_REGS ) {
+		desc->fpgaTime = ioread32(REG_ADDR((u32 __iomem *)ape->bar[0], reg));
+		flags |= FL_DESC_FPGA_TIME;
+	}
+	desc->flags = flags;
 }
 
-// Interrupt service routine
+// Interrupt service routine. Each interrupt means exactly one more buffer has been filled, or one
+// more TX buffer has been read. The FPGA updates the TX status word before its interrupt, so if
+// that's ahead of our count, the interrupt is (or, if they raced, stands in) for a TX buffer.
 //
 static irqreturn_t serviceInterrupt(int irq, void *devID) {
 	struct AlteraDevice *const ape = (struct AlteraDevice *)devID;
-	u32 submitCount, submitIndex;
+	const u32 threshold = min_t(u32, READ_ONCE(coalesceCount), FL_MAX_INFLIGHT/2);
+	irqreturn_t retVal = IRQ_HANDLED;
 	unsigned long flags;
+	u64 t0 = 0;
 	if ( !ape ) {
 		return IRQ_NONE;
 	}
 	spin_lock_irqsave(&ape->lock, flags);
-	ape->numAvailable++;
-	ape->numSubmitted--;
-	submitCount = NUM_BUFS - ape->numAvailable - ape->numSubmitted;
-	submitIndex = ape->outIndex + ape->numAvailable;
-	submitIndex &= NUM_BUFS - 1;
-	while ( submitCount-- ) {
-		submitDmaReq(ape, ape->bufferArrayBus + submitIndex * sizeof(struct Buffer), BUF_SIZE/128);
-		submitIndex++;
-		submitIndex &= NUM_BUFS - 1;
-		ape->numSubmitted++;
+	if ( trace_fpgalink_lock_enabled() || trace_fpgalink_drain_enabled() || trace_fpgalink_wakeup_enabled() ) {
+		t0 = ktime_get_ns();
+	}
+	WRITE_ONCE(ape->irqNs, t0);
+	if ( (u32)READ_ONCE(*ape->txStatus) != ape->txDone ) {
+		if ( FL_TXSTATUS_FAILED(READ_ONCE(*ape->txStatus)) ) {
+			printk_ratelimited(KERN_WARNING "serviceInterrupt(): the FPGA couldn't read a TX buffer!\n");
+		}
+		ape->txDone++;
+		kickTx(ape);
+		spin_unlock_irqrestore(&ape->lock, flags);
+		wake_up_interruptible(&ape->txWq);
+		return IRQ_HANDLED;
+	}
+	bufferForCpu(ape, ape->head);
+	fillDesc(ape, ape->head);
+	trace_fpgalink_complete(
+		ape->minor, ape->head, ape->head & (ape->ring.numBufs - 1), ape->head + 1 - ape->tail
+	);
+	ape->head++;
+	smp_store_release(&ape->ringHeader->head, ape->head);
+	ape->stats.completed++;
+	if ( ape->head - ape->tail > ape->stats.maxOccupancy ) {
+		ape->stats.maxOccupancy = ape->head - ape->tail;
+	}
+	if ( !ape->pending++ ) {
+		ape->pendingSince = t0;
+	}
+	if ( threshold <= 1 ) {
+		// No coalescing, so do everything here
+		ape->pending = 0;
+		refillQueue(ape);
+		spin_unlock_irqrestore(&ape->lock, flags);
+		if ( t0 && trace_fpgalink_lock_enabled() ) {
+			trace_fpgalink_lock(ape->minor, FL_LOCK_IRQ, ktime_get_ns() - t0);
+		}
+		wake_up_interruptible(&ape->wq);
+		return IRQ_HANDLED;
+	}
+	if ( ape->pending >= threshold || ape->submitted == ape->head ) {
+		// Enough completions, or the FPGA has run out of buffers
+		retVal = IRQ_WAKE_THREAD;
+	} else if ( ape->pending == 1 ) {
+		hrtimer_start(
+			&ape->coalesceTimer, ns_to_ktime(1000ULL * READ_ONCE(coalesceUsecs)), HRTIMER_MODE_REL
+		);
 	}
 	spin_unlock_irqrestore(&ape->lock, flags);
-	wake_up_interruptible(&ape->wq);
+	if ( t0 && trace_fpgalink_lock_enabled() ) {
+		trace_fpgalink_lock(ape->minor, FL_LOCK_IRQ, ktime_get_ns() - t0);
+	}
+	return retVal;
+}
+
+// Interrupt thread, woken by serviceInterrupt() once enough completions have been coalesced
+//
+static irqreturn_t serviceInterruptThread(int irq, void *devID) {
+	drainQueue((struct AlteraDevice *)devID);
 	return IRQ_HANDLED;
 }
 
@@ -258,6 +763,244 @@ static int __devinit scanBars(struct AlteraDevice *ape, struct pci_dev *dev) {
 	return 0;
 }
 
+// Take a snapshot of the queue's statistics, including any starvation that's still going on
+//
+static void getStats(struct AlteraDevice *ape, struct RingStats *stats) {
+	unsigned long flags;
+	spin_lock_irqsave(&ape->lock, flags);
+	*stats = ape->stats;
+	if ( ape->starvedSince ) {
+		stats->starvedNs += ktime_get_ns() - ape->starvedSince;
+	}
+	stats->occupancy = ape->head - ape->tail;
+	spin_unlock_irqrestore(&ape->lock, flags);
+}
+
+// Publish each of the statistics in /sys/class/fpgalink/fpgaN/stats
+//
+#define STAT_ATTR(name, field) \
+	static ssize_t name##Show(struct device *dev, struct device_attribute *attr, char *buf) { \
+		struct RingStats stats; \
+		getStats(dev_get_drvdata(dev), &stats); \
+		return sprintf(buf, "%llu\n", (unsigned long long)stats.field); \
+	} \
+	static struct device_attribute name##Attr = __ATTR(field, S_IRUGO, name##Show, NULL)
+
+STAT_ATTR(completed, completed);
+STAT_ATTR(delivered, delivered);
+STAT_ATTR(ringFull, ringFull);
+STAT_ATTR(starvedNs, starvedNs);
+STAT_ATTR(maxOccupancy, maxOccupancy);
+STAT_ATTR(occupancy, occupancy);
+
+static struct attribute *flStatsAttrs[] = {
+	&completedAttr.attr,
+	&deliveredAttr.attr,
+	&ringFullAttr.attr,
+	&starvedNsAttr.attr,
+	&maxOccupancyAttr.attr,
+	&occupancyAttr.attr,
+	NULL
+};
+static const struct attribute_group flStatsGroup = {
+	.name = "stats",
+	.attrs = flStatsAttrs
+};
+
+// Report the NUMA node the card is attached to, so capture threads can be pinned near the memory
+// its ring is allocated from.
+//
+static ssize_t numaNodeShow(struct device *dev, struct device_attribute *attr, char *buf) {
+	const struct AlteraDevice *const ape = dev_get_drvdata(dev);
+	return sprintf(buf, "%d\n", dev_to_node(&ape->pciDevice->dev));
+}
+static struct device_attribute numaNodeAttr = __ATTR(numa_node, S_IRUGO, numaNodeShow, NULL);
+
+static struct attribute *flAttrs[] = {
+	&numaNodeAttr.attr,
+	NULL
+};
+static const struct attribute_group flAttrGroup = {
+	.attrs = flAttrs
+};
+static const struct attribute_group *flAttrGroups[] = {
+	&flAttrGroup,
+	&flStatsGroup,
+	NULL
+};
+
+// Check the geometry of a circular queue. It's indexed by masking free-running counts of buffers, so
+// the number of buffers must be a power of two. Each buffer must be aligned to a 128-byte (TLP)
+// boundary, otherwise you get weird kernel hangs.
+//
+static int checkRingConfig(u32 mode, u32 numBufs, u32 bufSize) {
+	if ( mode != FL_RING_CONTIGUOUS && mode != FL_RING_SCATTER ) {
+		printk(KERN_DEBUG "Ring mode %u is neither contiguous nor scatter!\n", mode);
+		return -EINVAL;
+	}
+	if ( !numBufs || numBufs > MAX_NUM_BUFS || (numBufs & (numBufs - 1)) ) {
+		printk(KERN_DEBUG "Buffer count %u is not a power of two between 1 and " STR(MAX_NUM_BUFS) "!\n", numBufs);
+		return -EINVAL;
+	}
+	if ( !bufSize || bufSize > MAX_BUF_SIZE || bufSize % 128 ) {
+		printk(KERN_DEBUG "Buffer length is %u, which will not align to a 128-byte boundary, or is too big!\n", bufSize);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+// Free a circular queue's DMA buffers
+//
+static void freeRing(struct device *dev, struct Ring *ring) {
+	u32 i;
+	if ( ring->pages ) {
+		for ( i = 0; i < ring->numBufs; i++ ) {
+			if ( ring->pages[i] ) {
+				dma_unmap_page(dev, ring->bus[i], ring->bufSize, DMA_FROM_DEVICE);
+				__free_pages(ring->pages[i], get_order(ring->bufSize));
+			}
+		}
+		vfree(ring->pages);
+	}
+	if ( ring->blockVirt ) {
+		dma_free_coherent(dev, (size_t)ring->numBufs * ring->bufSize, ring->blockVirt, ring->blockBus);
+	}
+	vfree(ring->virt);
+	vfree(ring->bus);
+	vfree(ring->descs);
+	memset(ring, 0, sizeof(struct Ring));
+}
+
+// Allocate the DMA buffers for a circular queue. In FL_RING_CONTIGUOUS mode this is one block of
+// coherently-cached memory (see Documentation/PCI/PCI-DMA-mapping.txt, near line 318), so it's
+// limited by how much physically-contiguous memory the kernel can find. In FL_RING_SCATTER mode
+// each buffer is allocated and mapped separately. Either way, the memory comes from the card's own
+// NUMA node (dma_alloc_coherent() allocates on dev_to_node() too).
+//
+static int allocRing(struct device *dev, struct Ring *ring, u32 mode, u32 numBufs, u32 bufSize) {
+	const int order = get_order(bufSize);
+	const int node = dev_to_node(dev);
+	struct page *page;
+	u32 i;
+	memset(ring, 0, sizeof(struct Ring));
+	ring->mode = mode;
+	ring->numBufs = numBufs;
+	ring->bufSize = bufSize;
+	ring->virt = vzalloc_node(numBufs * sizeof(u8 *), node);
+	ring->bus = vzalloc_node(numBufs * sizeof(dma_addr_t), node);
+	ring->descs = vmalloc_user(numBufs * sizeof(struct BufferDesc));
+	if ( !ring->virt || !ring->bus || !ring->descs ) {
+		goto fail;
+	}
+	if ( mode == FL_RING_CONTIGUOUS ) {
+		ring->bufStride = bufSize;
+		ring->blockVirt = dma_alloc_coherent(
+			dev, (size_t)numBufs * bufSize, &ring->blockBus, GFP_KERNEL
+		);
+		if ( !ring->blockVirt ) {
+			goto fail;
+		}
+		for ( i = 0; i < numBufs; i++ ) {
+			ring->virt[i] = ring->blockVirt + i * bufSize;
+			ring->bus[i] = ring->blockBus + i * bufSize;
+		}
+		printk(
+			KERN_DEBUG "Allocated cache-coherent DMA buffer (virt: %p; bus: 0x%016llX; %u*%u bytes).\n",
+			ring->blockVirt, (u64)ring->blockBus, numBufs, bufSize
+		);
+	} else {
+		// The DMA controller only generates 32-bit addresses, so use pages below 4GiB rather than
+		// have them bounced.
+		ring->bufStride = PAGE_ALIGN(bufSize);
+		ring->pages = vzalloc_node(numBufs * sizeof(struct page *), node);
+		if ( !ring->pages ) {
+			goto fail;
+		}
+		for ( i = 0; i < numBufs; i++ ) {
+			page = alloc_pages_node(node, GFP_KERNEL | GFP_DMA32 | __GFP_COMP | __GFP_ZERO, order);
+			if ( !page ) {
+				goto fail;
+			}
+			ring->bus[i] = dma_map_page(dev, page, 0, bufSize, DMA_FROM_DEVICE);
+			if ( dma_mapping_error(dev, ring->bus[i]) ) {
+				__free_pages(page, order);
+				goto fail;
+			}
+			ring->pages[i] = page;
+			ring->virt[i] = page_address(page);
+		}
+		printk(KERN_DEBUG "Allocated scatter DMA buffers (%u*%u bytes).\n", numBufs, bufSize);
+	}
+	return 0;
+fail:
+	printk(KERN_DEBUG "Could not allocate DMA buffers for %u*%u bytes!\n", numBufs, bufSize);
+	freeRing(dev, ring);
+	return -ENOMEM;
+}
+
+// Replace the circular queue with a new one. There must be no DMA requests in flight, and the
+// caller must hold the ringMutex (unless the device is not yet visible to userspace).
+//
+static int replaceRing(struct AlteraDevice *ape, u32 mode, u32 numBufs, u32 bufSize) {
+	struct Ring ring;
+	unsigned long flags;
+	int rc = allocRing(&ape->pciDevice->dev, &ring, mode, numBufs, bufSize);
+	if ( rc ) {
+		return rc;
+	}
+	spin_lock_irqsave(&ape->lock, flags);
+	swap(ape->ring, ring);
+	ape->head = ape->acquired = ape->tail = ape->submitted = 0;
+	ape->running = 0;
+	WRITE_ONCE(ape->ringHeader->head, 0);
+	WRITE_ONCE(ape->ringHeader->tail, 0);
+	WRITE_ONCE(ape->ringHeader->numBufs, numBufs);
+	WRITE_ONCE(ape->ringHeader->bufSize, bufSize);
+	WRITE_ONCE(ape->ringHeader->bufStride, ape->ring.bufStride);
+	spin_unlock_irqrestore(&ape->lock, flags);
+	freeRing(&ape->pciDevice->dev, &ring);
+	return 0;
+}
+
+// Change the geometry of the circular queue, on behalf of FPGALINK_SETUP. Zero fields are left as
+// they are, and the geometry actually in use is returned.
+//
+static int setupRing(struct AlteraDevice *ape, struct RingConfig *cfg) {
+	int rc = 0;
+	mutex_lock(&ape->ringMutex);
+	if ( !cfg->mode ) {
+		cfg->mode = ape->ring.mode;
+	}
+	if ( !cfg->numBufs ) {
+		cfg->numBufs = ape->ring.numBufs;
+	}
+	if ( !cfg->bufSize ) {
+		cfg->bufSize = ape->ring.bufSize;
+	}
+	if (
+		cfg->mode != ape->ring.mode ||
+		cfg->numBufs != ape->ring.numBufs ||
+		cfg->bufSize != ape->ring.bufSize )
+	{
+		rc = checkRingConfig(cfg->mode, cfg->numBufs, cfg->bufSize);
+		if ( rc ) {
+			goto exit;
+		}
+		if ( ape->submitted != ape->head || atomic_read(&ape->bufferMaps) ) {
+			// The FPGA or userspace still has its hands on the existing buffers
+			rc = -EBUSY; goto exit;
+		}
+		rc = replaceRing(ape, cfg->mode, cfg->numBufs, cfg->bufSize);
+	}
+exit:
+	cfg->mode = ape->ring.mode;
+	cfg->numBufs = ape->ring.numBufs;
+	cfg->bufSize = ape->ring.bufSize;
+	cfg->bufStride = ape->ring.bufStride;
+	mutex_unlock(&ape->ringMutex);
+	return rc;
+}
+
 // Called when the PCI subsystem thinks we can control the given device. Inspect
 // if we can support the device and if so take control of it.
 //
@@ -271,27 +1014,38 @@ static int __devinit scanBars(struct AlteraDevice *ape, struct pci_dev *dev) {
 // - obtain and request irq
 // - map regions into kernel address space
 // - allocate DMA buffer
-// - allocate char driver major/minor
+// - allocate char driver minor and create the sysfs node
 //
 static int __devinit pcieProbe(struct pci_dev *dev, const struct pci_device_id *id) {
-	int rc, devno, alreadyInUse = 0;
+	int rc, alreadyInUse = 0;
 	struct AlteraDevice *ape = NULL;
-	dev_t charDevice;
+	struct page *hdrPage;
+	dev_t devno;
 	printk(KERN_DEBUG "pcieProbe(dev = 0x%p, pciid = 0x%p)\n", dev, id);
 
-	// Check alignment of Buffer struct. Ideally this check should be done at compile-time.
-	if ( sizeof(struct Buffer) % 128 ) {
-		printk(KERN_DEBUG "Buffer length is %zu, which will not align to a 128-byte boundary!\n", sizeof(struct Buffer));
-		rc = -ENODEV; goto err_align;
+	// Check the geometry requested when the module was loaded
+	rc = checkRingConfig(defaultRingMode, defaultNumBufs, defaultBufSize);
+	if ( rc ) {
+		goto err_align;
+	}
+	rc = checkRingConfig(FL_RING_CONTIGUOUS, txNumBufs, txBufSize);
+	if ( rc ) {
+		goto err_align;
 	}
 
-	// Allocate memory for per-board bookkeeping
-	ape = kzalloc(sizeof(struct AlteraDevice), GFP_KERNEL);
+	// Allocate memory for per-board bookkeeping, on the NUMA node the card is attached to
+	ape = kzalloc_node(sizeof(struct AlteraDevice), GFP_KERNEL, dev_to_node(&dev->dev));
 	if ( !ape ) {
-		printk(KERN_DEBUG "kzalloc() of struct AlteraDevice failed!\n");
+		printk(KERN_DEBUG "kzalloc_node() of struct AlteraDevice failed!\n");
 		rc = -ENOMEM; goto err_ape;
 	}
 	ape->pciDevice = dev;
+	spin_lock_init(&ape->lock);
+	mutex_init(&ape->ringMutex);
+	mutex_init(&ape->txMutex);
+	atomic_set(&ape->bufferMaps, 0);
+	hrtimer_init(&ape->coalesceTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ape->coalesceTimer.function = coalesceTimeout;
 	dev_set_drvdata(&dev->dev, ape);
 	printk(KERN_DEBUG "pcieProbe() ape = 0x%p\n", ape);
 
@@ -322,25 +1076,16 @@ static int __devinit pcieProbe(struct pci_dev *dev, const struct pci_device_id *
 		goto err_regions;
 	}
 
-	// Set appropriate DMA mask
-	if ( !pci_set_dma_mask(dev, DMA_BIT_MASK(64)) ) {
-		pci_set_consistent_dma_mask(dev, DMA_BIT_MASK(64));
-		printk(KERN_DEBUG "Using a 64-bit DMA mask.\n");
-	} else if ( !pci_set_dma_mask(dev, DMA_BIT_MASK(32)) ) {
+	// Set appropriate DMA mask. The FPGA writes using 3DW memory-write headers, so it can only reach
+	// the bottom 4GiB of the bus address space.
+	if ( !pci_set_dma_mask(dev, DMA_BIT_MASK(32)) ) {
 		pci_set_consistent_dma_mask(dev, DMA_BIT_MASK(32));
 		printk(KERN_DEBUG "Using a 32-bit DMA mask.\n");
 	} else {
-		printk(KERN_DEBUG "pci_set_dma_mask() fails for both 32-bit and 64-bit DMA!\n");
+		printk(KERN_DEBUG "pci_set_dma_mask() fails for 32-bit DMA!\n");
 		rc = -ENODEV; goto err_mask;
 	}
 
-	// Request an IRQ (see LDD3 page 259)
-	rc = request_irq(dev->irq, serviceInterrupt, IRQF_SHARED, DRV_NAME, (void*)ape);
-	if ( rc ) {
-		printk(KERN_DEBUG "request_irq(%d, ...) failed (rc=%d)!\n", dev->irq, rc);
-		goto err_irq;
-	}
-
 	// Show BARs in syslog
 	scanBars(ape, dev);
 
@@ -350,30 +1095,68 @@ static int __devinit pcieProbe(struct pci_dev *dev, const struct pci_device_id *
 		goto err_map;
 	}
 
-	// Allocate and map coherently-cached memory for a DMA-able buffer (see
-	// Documentation/PCI/PCI-DMA-mapping.txt, near line 318)
-	//
-	ape->bufferArrayBus = 0;
-	ape->bufferArrayVirt = (struct Buffer *)pci_alloc_consistent(
-		dev, NUM_BUFS*sizeof(struct Buffer), &ape->bufferArrayBus
+	// Allocate the page the FPGA writes its status records to, followed by the TX status word
+	ape->statusRecords = dma_alloc_coherent(
+		&dev->dev, FL_STATUS_SIZE + sizeof(u64), &ape->statusBus, GFP_KERNEL
 	);
-	if ( !ape->bufferArrayVirt ) {
-		printk(KERN_DEBUG "Could not allocate coherent DMA buffer!\n");
-		rc = -ENOMEM; goto err_buf_alloc;
+	if ( !ape->statusRecords ) {
+		printk(KERN_DEBUG "Could not allocate status record page!\n");
+		rc = -ENOMEM; goto err_status_alloc;
+	}
+	ape->txStatus = ape->statusRecords + FL_STATUS_RECORDS;
+	*ape->txStatus = 0;
+
+	// Allocate the page shared with userspace
+	hdrPage = alloc_pages_node(dev_to_node(&dev->dev), GFP_KERNEL | __GFP_ZERO, 0);
+	if ( !hdrPage ) {
+		printk(KERN_DEBUG "Could not allocate ring header page!\n");
+		rc = -ENOMEM; goto err_hdr_alloc;
+	}
+	ape->ringHeader = (struct RingHeader *)page_address(hdrPage);
+
+	// Allocate the circular queue
+	rc = replaceRing(ape, defaultRingMode, defaultNumBufs, defaultBufSize);
+	if ( rc ) {
+		goto err_buf_alloc;
 	}
-	printk(
-		KERN_DEBUG "Allocated cache-coherent DMA buffer (virt: %p; bus: 0x%016llX).\n",
-		ape->bufferArrayVirt, (u64)ape->bufferArrayBus
+
+	// Allocate the TX queue, and tell the FPGA where to report its progress. Each transfer is
+	// fetched with 512-byte reads, so make sure we're allowed to ask for that much.
+	rc = allocRing(&dev->dev, &ape->txRing, FL_RING_CONTIGUOUS, txNumBufs, txBufSize);
+	if ( rc ) {
+		goto err_tx_alloc;
+	}
+	if ( pcie_get_readrq(dev) < 512 ) {
+		pcie_set_readrq(dev, 512);
+	}
+	iowrite32(
+		(u32)(ape->statusBus + FL_STATUS_SIZE) | FL_DMABASE_TXSTATUS,
+		DMABASE((u32 __iomem *)ape->bar[0])
 	);
 
-	// Allocate char driver major/minor
-	rc = alloc_chrdev_region(&charDevice, 0, 1, "fpga0");
+	// Wait queues
+	init_waitqueue_head(&ape->wq);
+	init_waitqueue_head(&ape->txWq);
+
+	// Request an IRQ (see LDD3 page 259), with a thread to handle coalesced completions. This must
+	// come after everything the handler touches has been set up, because an MSI left over from
+	// before (a previous load, say) may arrive straight away.
+	rc = request_threaded_irq(
+		dev->irq, serviceInterrupt, serviceInterruptThread, IRQF_SHARED, DRV_NAME, (void*)ape
+	);
 	if ( rc ) {
-		printk(KERN_ERR "alloc_chrdev_region() failed (rc=%d)\n", rc);
+		printk(KERN_DEBUG "request_threaded_irq(%d, ...) failed (rc=%d)!\n", dev->irq, rc);
+		goto err_irq;
+	}
+
+	// Allocate a minor number from the region shared by all cards
+	rc = ida_simple_get(&flMinors, 0, FL_MAX_DEVICES, GFP_KERNEL);
+	if ( rc < 0 ) {
+		printk(KERN_ERR "Could not allocate a minor number (rc=%d); too many cards?\n", rc);
 		goto err_cdev_alloc;
 	}
-	ape->major = MAJOR(charDevice);
-	devno = MKDEV(ape->major, 0);
+	ape->minor = rc;
+	devno = MKDEV(MAJOR(flDevBase), ape->minor);
 
 	// Initialise char device
 	cdev_init(&ape->charDevice, &cdevFileOps);
@@ -387,21 +1170,37 @@ static int __devinit pcieProbe(struct pci_dev *dev, const struct pci_device_id *
 		goto err_cdev_add;
 	}
 
-	// Wait queue
-	init_waitqueue_head(&ape->wq);
+	// Create /sys/class/fpgalink/fpgaN, so udev creates /dev/fpgaN
+	ape->classDevice = device_create_with_groups(
+		flClass, &dev->dev, devno, ape, flAttrGroups, "fpga%d", ape->minor
+	);
+	if ( IS_ERR(ape->classDevice) ) {
+		rc = PTR_ERR(ape->classDevice);
+		printk(KERN_ERR "device_create_with_groups() failed (rc=%d)\n", rc);
+		goto err_dev_create;
+	}
 
 	// Successfully took the device
-	printk(KERN_DEBUG "pcieProbe() successful.\n");
+	printk(KERN_DEBUG "pcieProbe() successful: fpga%d on NUMA node %d.\n", ape->minor, dev_to_node(&dev->dev));
 	return 0;
+err_dev_create:
+	cdev_del(&ape->charDevice);
 err_cdev_add:
-	unregister_chrdev_region(devno, 1);
+	ida_simple_remove(&flMinors, ape->minor);
 err_cdev_alloc:
-	pci_free_consistent(dev, NUM_BUFS*sizeof(struct Buffer), (u8*)ape->bufferArrayVirt, ape->bufferArrayBus);
+	free_irq(dev->irq, (void*)ape);
+	hrtimer_cancel(&ape->coalesceTimer);
+err_irq:
+	freeRing(&dev->dev, &ape->txRing);
+err_tx_alloc:
+	freeRing(&dev->dev, &ape->ring);
 err_buf_alloc:
+	free_page((unsigned long)ape->ringHeader);
+err_hdr_alloc:
+	dma_free_coherent(&dev->dev, FL_STATUS_SIZE + sizeof(u64), ape->statusRecords, ape->statusBus);
+err_status_alloc:
 	unmapBars(ape, dev);
 err_map:
-	free_irq(dev->irq, (void*)ape);
-err_irq:
 err_mask:
 	pci_release_regions(dev);
 err_regions:
@@ -421,25 +1220,31 @@ err_ape:
 //
 static void __devexit pcieRemove(struct pci_dev *dev) {
 	struct AlteraDevice *const ape = dev_get_drvdata(&dev->dev);
-	const dev_t devno = MKDEV(ape->major, 0);
+	const dev_t devno = MKDEV(MAJOR(flDevBase), ape->minor);
 
 	printk(KERN_DEBUG "pcieRemove(dev = 0x%p) where ape = 0x%p\n", dev, ape);
 
-	// Remove the char device node
+	// Free the IRQ first, then stop the coalescing timer it may have started, so neither can run
+	// once the things they touch are gone
+	free_irq(dev->irq, (void*)ape);
+	hrtimer_cancel(&ape->coalesceTimer);
+
+	// Remove the sysfs node and the char device
+	device_destroy(flClass, devno);
 	cdev_del(&ape->charDevice);
 
-	// Unregister char device
-	unregister_chrdev_region(devno, 1);	
+	// Give back the minor number
+	ida_simple_remove(&flMinors, ape->minor);
 
-	// Free DMA buffer
-	pci_free_consistent(dev, NUM_BUFS*sizeof(struct Buffer), (u8 *)ape->bufferArrayVirt, ape->bufferArrayBus);
+	// Free DMA buffers, ring header and status records
+	freeRing(&dev->dev, &ape->ring);
+	freeRing(&dev->dev, &ape->txRing);
+	free_page((unsigned long)ape->ringHeader);
+	dma_free_coherent(&dev->dev, FL_STATUS_SIZE + sizeof(u64), ape->statusRecords, ape->statusBus);
 
 	// Unmap the BARs
 	unmapBars(ape, dev);
 
-	// Free IRQ
-	free_irq(dev->irq, (void*)ape);
-
 	// Release BAR mappings
 	pci_release_regions(dev);
 
@@ -455,54 +1260,825 @@ static void __devexit pcieRemove(struct pci_dev *dev) {
 
 // Userspace is opening the device
 //
+// Opening the device doesn't touch the circular queue, so a monitoring tool can access the
+// registers while someone else is streaming.
+//
 static int cdevOpen(struct inode *inode, struct file *filp) {
 	struct AlteraDevice *const ape = container_of(inode->i_cdev, struct AlteraDevice, charDevice);
-	filp->private_data = ape;	
+	struct FileState *const fs = kzalloc(sizeof(struct FileState), GFP_KERNEL);
 	printk(KERN_DEBUG "cdevOpen()\n");
-	ape->numAvailable = ape->outIndex = ape->numSubmitted = 0;
+	if ( !fs ) {
+		return -ENOMEM;
+	}
+	fs->ape = ape;
+	spin_lock_init(&fs->asyncLock);
+	INIT_LIST_HEAD(&fs->asyncQueued);
+	INIT_LIST_HEAD(&fs->asyncDone);
+	INIT_WORK(&fs->asyncWork, asyncWorker);
+	init_waitqueue_head(&fs->asyncWq);
+	filp->private_data = fs;
 	return 0;
 }
 
-// Userspace is closing the device
+// Claim the streaming session for this open file, on its first streaming operation. It's held
+// until the file is closed, and nobody else can stream in the meantime.
+//
+static int claimStream(struct FileState *fs) {
+	struct AlteraDevice *const ape = fs->ape;
+	unsigned long flags;
+	int rc = 0;
+	if ( fs->streaming ) {
+		return 0;
+	}
+	spin_lock_irqsave(&ape->lock, flags);
+	if ( ape->streamOwner ) {
+		rc = -EBUSY;
+	} else {
+		ape->streamOwner = fs;
+		fs->streaming = 1;
+	}
+	spin_unlock_irqrestore(&ape->lock, flags);
+	if ( rc ) {
+		printk(KERN_DEBUG "Another process is already streaming from this device!\n");
+	}
+	return rc;
+}
+
+// Userspace is closing the device. If it owned the streaming session, the buffers it still held are
+// given back, and the queue is stopped: the FPGA finishes with the buffers it already has in its
+// own time, and the next OP_SD waits for it to do so before starting afresh. TX buffers it acquired
+// but never submitted are given back too, unsent.
 //
 static int cdevRelease(struct inode *inode, struct file *filp) {
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	struct AsyncJob *job, *next;
+	unsigned long flags;
 	printk(KERN_DEBUG "cdevRelease()\n");
+
+	// Abandon any asynchronous batches which haven't been run yet, and results nobody reaped
+	cancel_work_sync(&fs->asyncWork);
+	list_for_each_entry_safe(job, next, &fs->asyncQueued, list) {
+		kfree(job);
+	}
+	list_for_each_entry_safe(job, next, &fs->asyncDone, list) {
+		kfree(job);
+	}
+	if ( fs->asyncEventFd ) {
+		eventfd_ctx_put(fs->asyncEventFd);
+	}
+
+	mutex_lock(&ape->txMutex);
+	if ( ape->txOwner == fs ) {
+		ape->txAcquired = ape->txHead;
+		ape->txOwner = NULL;
+		wake_up_interruptible(&ape->txWq);
+	}
+	mutex_unlock(&ape->txMutex);
+
+	if ( fs->streaming ) {
+		spin_lock_irqsave(&ape->lock, flags);
+		syncTail(ape);
+		advanceTail(ape, ape->acquired);
+		ape->running = 0;
+		ape->streamOwner = NULL;
+		spin_unlock_irqrestore(&ape->lock, flags);
+	}
+	kfree(fs);
 	return 0;
 }
 
-// Userspace is asking for data
+// Wait for the FPGA to fill a buffer that hasn't been acquired yet. Returns -EAGAIN rather than
+// waiting for a non-blocking file, and -ERESTARTSYS if the wait is interrupted by a signal.
 //
-static ssize_t cdevRead(struct file *filp, char __user *buf, size_t count, loff_t *filePos) {
-	struct AlteraDevice *ape = filp->private_data;
-	unsigned long rc, flags;
-	if ( count < BUF_SIZE ) {
-		printk(KERN_DEBUG "cdevRead(): can't read into a buffer smaller than " STR(BUF_SIZE) " bytes!\n");
-		return -EINVAL;
+static int waitForBuffer(struct AlteraDevice *ape, struct file *filp) {
+	if ( READ_ONCE(ape->head) != READ_ONCE(ape->acquired) ) {
+		return 0;
 	}
-	wait_event_interruptible(ape->wq, ape->numAvailable > 0);
-	rc = copy_to_user(buf, ape->bufferArrayVirt[ape->outIndex].data, BUF_SIZE);
-	spin_lock_irqsave(&ape->lock, flags);
-	submitDmaReq(ape, ape->bufferArrayBus + ape->outIndex * sizeof(struct Buffer), BUF_SIZE/128);
-	ape->numSubmitted++;
-	ape->outIndex++;
-	ape->outIndex &= NUM_BUFS - 1;
-	ape->numAvailable--;
-	spin_unlock_irqrestore(&ape->lock, flags);
-	return BUF_SIZE;
-	(void)filePos;
-	(void)rc;
+	if ( filp->f_flags & O_NONBLOCK ) {
+		return -EAGAIN;
+	}
+	if ( wait_event_interruptible(ape->wq, READ_ONCE(ape->head) != READ_ONCE(ape->acquired)) ) {
+		return -ERESTARTSYS;
+	}
+	if ( trace_fpgalink_wakeup_enabled() ) {
+		const u64 irqNs = READ_ONCE(ape->irqNs);
+		if ( irqNs ) {
+			trace_fpgalink_wakeup(ape->minor, READ_ONCE(ape->head), ktime_get_ns() - irqNs);
+		}
+	}
+	return 0;
 }
 
-// The ioctl() implementation
+// Userspace is asking for data. As many whole filled buffers as will fit are copied out (waiting
+// for at least one), and given straight back to the FPGA. This is also what splice() uses, so data
+// can be moved from the queue into a pipe without passing through userspace.
 //
-static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
-	struct AlteraDevice *const ape = filp->private_data;
-	u32 __iomem *const regSpace = (u32 __iomem *)ape->bar[0];
-	struct CmdList kl;
-	struct Cmd kc;
-	struct Cmd __user *ucp;
-	u32 numCmds, reg;
-	int err = 0;
+static ssize_t cdevReadIter(struct kiocb *iocb, struct iov_iter *to) {
+	struct file *const filp = iocb->ki_filp;
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	u32 first, numBufs, i;
+	size_t bufSize, copied = 0;
+	unsigned long flags;
+	u64 t0 = 0;
+	ssize_t retVal = claimStream(fs);
+	if ( retVal ) {
+		return retVal;
+	}
+	mutex_lock(&ape->ringMutex);
+	for ( ; ; ) {
+		// The ring may have been replaced while we waited, so check its geometry every time round
+		bufSize = ape->ring.bufSize;
+		if ( iov_iter_count(to) < bufSize ) {
+			printk(KERN_DEBUG "cdevReadIter(): can't read into a buffer smaller than %zu bytes!\n", bufSize);
+			retVal = -EINVAL; goto exit;
+		}
+
+		// Reserve as many filled buffers as will fit
+		spin_lock_irqsave(&ape->lock, flags);
+		if ( ape->acquired != ape->tail ) {
+			// Buffers must be released in order, so the ones we'd copy cannot be released until
+			// userspace releases the buffers it already acquired.
+			spin_unlock_irqrestore(&ape->lock, flags);
+			retVal = -EBUSY; goto exit;
+		}
+		first = ape->acquired;
+		numBufs = min_t(size_t, ape->head - first, iov_iter_count(to) / bufSize);
+		ape->acquired += numBufs;
+		spin_unlock_irqrestore(&ape->lock, flags);
+		if ( numBufs ) {
+			break;
+		}
+
+		// Don't hold up FPGALINK_SETUP and the rest while we wait
+		mutex_unlock(&ape->ringMutex);
+		retVal = waitForBuffer(ape, filp);
+		if ( retVal ) {
+			return retVal;
+		}
+		mutex_lock(&ape->ringMutex);
+	}
+
+	// Copy them out, stopping early if userspace gave us a bad address
+	if ( trace_fpgalink_copy_enabled() ) {
+		t0 = ktime_get_ns();
+	}
+	for ( i = 0; i < numBufs; i++ ) {
+		const size_t bytes = ape->ring.descs[(first + i) & (ape->ring.numBufs - 1)].bytes;
+		if ( copy_to_iter(bufferVirt(ape, first + i), bytes, to) != bytes ) {
+			break;
+		}
+		copied += bytes;
+	}
+	if ( t0 ) {
+		trace_fpgalink_copy(ape->minor, first, i, copied, ktime_get_ns() - t0);
+	}
+
+	// Give back everything we reserved, but only count the ones which were delivered in full
+	spin_lock_irqsave(&ape->lock, flags);
+	t0 = trace_fpgalink_lock_enabled() ? ktime_get_ns() : 0;
+	ape->acquired = first + i;
+	advanceTail(ape, ape->acquired);
+	refillQueue(ape);
+	spin_unlock_irqrestore(&ape->lock, flags);
+	if ( t0 ) {
+		trace_fpgalink_lock(ape->minor, FL_LOCK_READ, ktime_get_ns() - t0);
+	}
+	retVal = copied ? (ssize_t)copied : -EFAULT;
+exit:
+	mutex_unlock(&ape->ringMutex);
+	return retVal;
+}
+
+// Userspace is mapping the circular queue. It is mapped read-only, and it's up to userspace to
+// use FPGALINK_ACQUIRE and FPGALINK_RELEASE (or the ring header) to find out which buffers it's
+// allowed to look at.
+//
+// The buffer mappings are counted, so the geometry cannot be changed while they exist.
+//
+static void bufferVmOpen(struct vm_area_struct *vma) {
+	struct AlteraDevice *const ape = vma->vm_private_data;
+	atomic_inc(&ape->bufferMaps);
+}
+
+static void bufferVmClose(struct vm_area_struct *vma) {
+	struct AlteraDevice *const ape = vma->vm_private_data;
+	atomic_dec(&ape->bufferMaps);
+}
+
+static const struct vm_operations_struct bufferVmOps = {
+	.open  = bufferVmOpen,
+	.close = bufferVmClose
+};
+
+// Map each page of the scatter buffers individually. They're real pages, so get_user_pages() works
+// on the mapping, and userspace can do things like O_DIRECT writes straight from it.
+//
+static int mapScatterBuffers(struct Ring *ring, struct vm_area_struct *vma) {
+	unsigned long addr = vma->vm_start;
+	u32 i, offset;
+	int rc;
+	for ( i = 0; i < ring->numBufs && addr < vma->vm_end; i++ ) {
+		for ( offset = 0; offset < ring->bufStride && addr < vma->vm_end; offset += PAGE_SIZE ) {
+			rc = vm_insert_page(vma, addr, ring->pages[i] + offset / PAGE_SIZE);
+			if ( rc ) {
+				return rc;
+			}
+			addr += PAGE_SIZE;
+		}
+	}
+	return 0;
+}
+
+static int mapBuffers(struct AlteraDevice *ape, struct vm_area_struct *vma) {
+	const unsigned long length = vma->vm_end - vma->vm_start;
+	size_t ringSize;
+	int rc;
+	if ( vma->vm_flags & VM_WRITE ) {
+		printk(KERN_DEBUG "cdevMMap(): the DMA buffers can only be mapped read-only!\n");
+		return -EPERM;
+	}
+	mutex_lock(&ape->ringMutex);
+	ringSize = (size_t)ape->ring.numBufs * ape->ring.bufStride;
+	if ( length > PAGE_ALIGN(ringSize) ) {
+		printk(KERN_DEBUG "cdevMMap(): can only map up to %u buffers!\n", ape->ring.numBufs);
+		rc = -EINVAL; goto exit;
+	}
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_pgoff = 0;
+	if ( ape->ring.mode == FL_RING_SCATTER ) {
+		rc = mapScatterBuffers(&ape->ring, vma);
+	} else {
+		rc = dma_mmap_coherent(
+			&ape->pciDevice->dev, vma, ape->ring.blockVirt, ape->ring.blockBus, ringSize
+		);
+	}
+	if ( !rc ) {
+		vma->vm_private_data = ape;
+		vma->vm_ops = &bufferVmOps;
+		bufferVmOpen(vma);
+	}
+exit:
+	mutex_unlock(&ape->ringMutex);
+	return rc;
+}
+
+// Userspace is mapping the buffer descriptors. Like the buffers themselves, they're read-only, and
+// the mapping stops the geometry being changed.
+//
+static int mapDescs(struct AlteraDevice *ape, struct vm_area_struct *vma) {
+	const unsigned long length = vma->vm_end - vma->vm_start;
+	int rc;
+	if ( vma->vm_flags & VM_WRITE ) {
+		printk(KERN_DEBUG "cdevMMap(): the buffer descriptors can only be mapped read-only!\n");
+		return -EPERM;
+	}
+	mutex_lock(&ape->ringMutex);
+	if ( length > PAGE_ALIGN(ape->ring.numBufs * sizeof(struct BufferDesc)) ) {
+		printk(KERN_DEBUG "cdevMMap(): can only map %u buffer descriptors!\n", ape->ring.numBufs);
+		rc = -EINVAL; goto exit;
+	}
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_pgoff = 0;
+	rc = remap_vmalloc_range(vma, ape->ring.descs, 0);
+	if ( !rc ) {
+		vma->vm_private_data = ape;
+		vma->vm_ops = &bufferVmOps;
+		bufferVmOpen(vma);
+	}
+exit:
+	mutex_unlock(&ape->ringMutex);
+	return rc;
+}
+
+// Userspace is mapping the TX queue, so it can fill buffers in-place. It's never reallocated, so
+// unlike the receive queue, the mappings don't need counting.
+//
+static int mapTxBuffers(struct AlteraDevice *ape, struct vm_area_struct *vma) {
+	const size_t ringSize = (size_t)ape->txRing.numBufs * ape->txRing.bufStride;
+	if ( vma->vm_end - vma->vm_start > PAGE_ALIGN(ringSize) ) {
+		printk(KERN_DEBUG "cdevMMap(): can only map up to %u TX buffers!\n", ape->txRing.numBufs);
+		return -EINVAL;
+	}
+	vma->vm_pgoff = 0;
+	return dma_mmap_coherent(
+		&ape->pciDevice->dev, vma, ape->txRing.blockVirt, ape->txRing.blockBus, ringSize
+	);
+}
+
+// Userspace is mapping the ring header page. It needs write access, to update the tail.
+//
+static int mapHeader(struct AlteraDevice *ape, struct vm_area_struct *vma) {
+	if ( vma->vm_end - vma->vm_start != PAGE_SIZE ) {
+		printk(KERN_DEBUG "cdevMMap(): the ring header is exactly one page!\n");
+		return -EINVAL;
+	}
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(ape->ringHeader));
+}
+
+// Userspace is mapping the FPGA registers, so it can access them without a syscall. Only the part
+// of BAR0 the driver itself uses may be mapped, and only whole pages can be, so BAR0 must start on
+// a page boundary and cover them: nothing else sharing the page may be exposed.
+//
+static int mapRegs(struct AlteraDevice *ape, struct vm_area_struct *vma) {
+	const unsigned long length = vma->vm_end - vma->vm_start;
+	const resource_size_t start = pci_resource_start(ape->pciDevice, 0);
+	if ( length > PAGE_ALIGN(barMinLen[0]) ) {
+		printk(KERN_DEBUG "cdevMMap(): can only map %lu bytes of registers!\n", PAGE_ALIGN(barMinLen[0]));
+		return -EINVAL;
+	}
+	if ( offset_in_page(start) || pci_resource_len(ape->pciDevice, 0) < PAGE_ALIGN(length) ) {
+		printk(KERN_DEBUG "cdevMMap(): BAR0 doesn't cover whole pages, so it can't be mapped!\n");
+		return -ENODEV;
+	}
+	vma->vm_pgoff = 0;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	return vm_iomap_memory(vma, start, length);
+}
+
+// Userspace is mapping one of the regions described in ioctl_defs.h
+//
+static int cdevMMap(struct file *filp, struct vm_area_struct *vma) {
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	int rc;
+	switch ( vma->vm_pgoff ) {
+	case FL_MMAP_BUFFERS >> PAGE_SHIFT:
+		return mapBuffers(ape, vma);
+	case FL_MMAP_REGS >> PAGE_SHIFT:
+		// The mapping reaches the DMA registers too, so whoever has it could submit buffers behind
+		// the driver's back, which only the stream owner may do
+		rc = claimStream(fs);
+		return rc ? rc : mapRegs(ape, vma);
+	case FL_MMAP_DESCS >> PAGE_SHIFT:
+		return mapDescs(ape, vma);
+	case FL_MMAP_TX >> PAGE_SHIFT:
+		return mapTxBuffers(ape, vma);
+	case FL_MMAP_HEADER >> PAGE_SHIFT:
+		// Whoever maps the header can release buffers by writing the tail, so it's a streaming op
+		rc = claimStream(fs);
+		return rc ? rc : mapHeader(ape, vma);
+	}
+	printk(KERN_DEBUG "cdevMMap(): no region at offset 0x%08lX!\n", vma->vm_pgoff << PAGE_SHIFT);
+	return -EINVAL;
+}
+
+// Wait for the FPGA to fill the next buffer, and hand its index to userspace. The buffer remains
+// owned by userspace until it is given back with releaseBuffer().
+//
+static int acquireBuffer(struct AlteraDevice *ape, struct file *filp, u32 *index) {
+	unsigned long flags;
+	int rc;
+	for ( ; ; ) {
+		rc = waitForBuffer(ape, filp);
+		if ( rc ) {
+			return rc;
+		}
+		spin_lock_irqsave(&ape->lock, flags);
+		if ( ape->head != ape->acquired ) {
+			break;
+		}
+		spin_unlock_irqrestore(&ape->lock, flags);  // another thread got there first
+	}
+	*index = ape->acquired & (ape->ring.numBufs - 1);
+	ape->acquired++;
+	spin_unlock_irqrestore(&ape->lock, flags);
+	return 0;
+}
+
+// Userspace wants to know if there's a buffer ready, so the device can be driven from an event
+// loop. It's readable while any filled buffer has not yet been acquired (or read). Any tail
+// advanced through the ring header is picked up first, just as FPGALINK_SYNC would. It also
+// reports POLLPRI while there are finished asynchronous batches waiting to be reaped.
+//
+static unsigned int cdevPoll(struct file *filp, poll_table *wait) {
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	unsigned int mask = 0;
+	unsigned long flags;
+	poll_wait(filp, &ape->wq, wait);
+	poll_wait(filp, &ape->txWq, wait);
+	poll_wait(filp, &fs->asyncWq, wait);
+	if ( !list_empty_careful(&fs->asyncDone) ) {
+		mask |= POLLPRI;
+	}
+	spin_lock_irqsave(&ape->lock, flags);
+	if ( fs->streaming ) {
+		refillQueue(ape);
+	}
+	if ( ape->head != ape->acquired ) {
+		mask |= POLLIN | POLLRDNORM;
+	}
+	if ( txBufferFree(ape) ) {
+		mask |= POLLOUT | POLLWRNORM;
+	}
+	spin_unlock_irqrestore(&ape->lock, flags);
+	return mask;
+}
+
+// Give a previously-acquired buffer back to the FPGA. Buffers must be released in the same order
+// they were acquired, so the FPGA continues to fill the circular queue in order.
+//
+static int releaseBuffer(struct AlteraDevice *ape, u32 index) {
+	unsigned long flags;
+	int rc = 0;
+	spin_lock_irqsave(&ape->lock, flags);
+	if ( ape->acquired != ape->tail && index == (ape->tail & (ape->ring.numBufs - 1)) ) {
+		advanceTail(ape, ape->tail + 1);
+		refillQueue(ape);
+	} else {
+		rc = -EINVAL;
+	}
+	spin_unlock_irqrestore(&ape->lock, flags);
+	return rc;
+}
+
+// Wait for a TX buffer to be free. Like waitForBuffer(), returns -EAGAIN rather than waiting for a
+// non-blocking file, and -ERESTARTSYS if the wait is interrupted by a signal. Must be called with
+// the txMutex held.
+//
+static int waitForTxBuffer(struct AlteraDevice *ape, struct file *filp) {
+	if ( txBufferFree(ape) ) {
+		return 0;
+	}
+	if ( filp->f_flags & O_NONBLOCK ) {
+		return -EAGAIN;
+	}
+	if ( wait_event_interruptible(ape->txWq, txBufferFree(ape)) ) {
+		return -ERESTARTSYS;
+	}
+	return 0;
+}
+
+// Pass the next acquired TX buffer to the FPGA. Must be called with the txMutex held.
+//
+static void submitTxBuffer(struct AlteraDevice *ape, u32 bytes) {
+	unsigned long flags;
+	ape->txRing.descs[ape->txHead & (ape->txRing.numBufs - 1)].bytes = bytes;
+	spin_lock_irqsave(&ape->lock, flags);
+	ape->txHead++;
+	kickTx(ape);
+	spin_unlock_irqrestore(&ape->lock, flags);
+}
+
+// Userspace is sending data. It's copied into as many TX buffers as it takes (waiting for them to
+// come free, unless some data has already been copied), and each is sent as soon as it's full.
+//
+static ssize_t cdevWriteIter(struct kiocb *iocb, struct iov_iter *from) {
+	struct file *const filp = iocb->ki_filp;
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	size_t bytes, copied = 0;
+	ssize_t retVal = 0;
+	if ( iov_iter_count(from) % 128 ) {
+		printk(KERN_DEBUG "cdevWriteIter(): can only write multiples of 128 bytes!\n");
+		return -EINVAL;
+	}
+	mutex_lock(&ape->txMutex);
+	if ( ape->txAcquired != ape->txHead ) {
+		// Buffers are sent in order, so the buffers being filled in-place must be submitted first
+		retVal = -EBUSY; goto exit;
+	}
+	while ( iov_iter_count(from) ) {
+		if ( copied && !txBufferFree(ape) ) {
+			break;
+		}
+		retVal = waitForTxBuffer(ape, filp);
+		if ( retVal ) {
+			break;
+		}
+		bytes = min_t(size_t, iov_iter_count(from), ape->txRing.bufSize);
+		if ( copy_from_iter(ape->txRing.virt[ape->txHead & (ape->txRing.numBufs - 1)], bytes, from) != bytes ) {
+			retVal = -EFAULT;
+			break;
+		}
+		ape->txAcquired++;
+		submitTxBuffer(ape, (u32)bytes);
+		copied += bytes;
+	}
+exit:
+	mutex_unlock(&ape->txMutex);
+	return copied ? (ssize_t)copied : retVal;
+}
+
+// Wait for everything written so far to be read by the FPGA. Returns -ETIMEDOUT if it doesn't
+// finish with another TX buffer for FL_TX_TIMEOUT_MSECS (if hostData_out is blocked, say), and
+// -ERESTARTSYS if the wait is interrupted by a signal.
+//
+static int cdevFsync(struct file *filp, loff_t start, loff_t end, int datasync) {
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	const u32 head = READ_ONCE(ape->txHead);
+	u32 done;
+	long rc;
+	do {
+		done = READ_ONCE(ape->txDone);
+		rc = wait_event_interruptible_timeout(
+			ape->txWq, READ_ONCE(ape->txDone) - head < 0x80000000U,
+			msecs_to_jiffies(FL_TX_TIMEOUT_MSECS)
+		);
+		if ( rc < 0 ) {
+			return rc;
+		}
+	} while ( !rc && READ_ONCE(ape->txDone) != done );
+	return rc ? 0 : -ETIMEDOUT;
+}
+
+// Wait for a free TX buffer, for userspace to fill in-place. Returns -EBUSY if another file is
+// still filling the buffers it acquired, because they must be submitted first.
+//
+static int acquireTxBuffer(struct AlteraDevice *ape, struct file *filp, u32 *index) {
+	struct FileState *const fs = filp->private_data;
+	int rc;
+	mutex_lock(&ape->txMutex);
+	if ( ape->txAcquired != ape->txHead && ape->txOwner != fs ) {
+		rc = -EBUSY; goto exit;
+	}
+	rc = waitForTxBuffer(ape, filp);
+	if ( !rc ) {
+		*index = ape->txAcquired & (ape->txRing.numBufs - 1);
+		ape->txAcquired++;
+		ape->txOwner = fs;
+	}
+exit:
+	mutex_unlock(&ape->txMutex);
+	return rc;
+}
+
+// Send a TX buffer userspace has filled in-place. It must be the oldest one this file acquired.
+//
+static int releaseTxBuffer(struct FileState *fs, const struct TxBuffer *tb) {
+	struct AlteraDevice *const ape = fs->ape;
+	int rc = 0;
+	mutex_lock(&ape->txMutex);
+	if (
+		ape->txAcquired == ape->txHead || ape->txOwner != fs ||
+		tb->index != (ape->txHead & (ape->txRing.numBufs - 1)) ||
+		!tb->bytes || tb->bytes % 128 || tb->bytes > ape->txRing.bufSize )
+	{
+		rc = -EINVAL;
+	} else {
+		submitTxBuffer(ape, tb->bytes);
+		if ( ape->txAcquired == ape->txHead ) {
+			ape->txOwner = NULL;
+		}
+	}
+	mutex_unlock(&ape->txMutex);
+	return rc;
+}
+
+// How many words the given batch command occupies, or zero if it's not a valid command
+//
+static u32 batchCmdLength(u32 cmd) {
+	const u32 op = FL_BATCH_OP(cmd), count = FL_BATCH_COUNT(cmd), reg = FL_BATCH_REG(cmd);
+	switch ( op ) {
+	case FL_BATCH_RD:
+	case FL_BATCH_WR:
+		return (count && reg + count <= NUM_REGS) ? 1 + count : 0;
+	case FL_BATCH_POLL:
+		return (reg < NUM_REGS) ? 5 : 0;
+	case FL_BATCH_SD:
+		return 1;
+	}
+	return 0;
+}
+
+// Run a single batch command, whose header word is w[0], and whose data words follow it
+//
+static int runBatchCmd(struct FileState *fs, u32 *w) {
+	struct AlteraDevice *const ape = fs->ape;
+	u32 __iomem *const regSpace = (u32 __iomem *)ape->bar[0];
+	const u32 reg = FL_BATCH_REG(w[0]), count = FL_BATCH_COUNT(w[0]);
+	u32 i, val;
+	int rc = 0;
+	switch ( FL_BATCH_OP(w[0]) ) {
+	case FL_BATCH_RD:
+		for ( i = 0; i < count; i++ ) {
+			w[1 + i] = ioread32(REG_ADDR(regSpace, reg + i));
+		}
+		break;
+	case FL_BATCH_WR:
+		for ( i = 0; i < count; i++ ) {
+			iowrite32(w[1 + i], REG_ADDR(regSpace, reg + i));
+		}
+		break;
+	case FL_BATCH_POLL:
+		// Data words are mask, match, timeout and result
+		if ( w[3] > FL_BATCH_MAX_POLL_US ) {
+			printk(KERN_DEBUG "runBatchCmd(): poll timeout %u is too long!\n", w[3]);
+			return -EINVAL;
+		}
+		rc = readx_poll_timeout(
+			ioread32, REG_ADDR(regSpace, reg), val, (val & w[1]) == w[2], 1, w[3]
+		);
+		w[4] = val;
+		break;
+	case FL_BATCH_SD:
+		rc = claimStream(fs);
+		if ( !rc ) {
+			rc = startQueue(ape);
+		}
+		break;
+	}
+	return rc;
+}
+
+// Run the batch commands in words[0..len-1], stopping at the first failure, or at a command which
+// straddles the end. The number of words done is returned in numDone, and resultLen is set to the
+// number of words which need to be copied back to userspace, if any of them have been read.
+//
+static int runBatchWords(struct FileState *fs, u32 *words, u32 len, u32 *numDone, u32 *resultLen) {
+	u32 i, cmdLen, op;
+	int rc = 0;
+	*resultLen = 0;
+	for ( i = 0; i < len; i += cmdLen ) {
+		cmdLen = batchCmdLength(words[i]);
+		if ( !cmdLen || i + cmdLen > len ) {
+			// A command which straddles the end is left for the caller to deal with, unless there's
+			// no way it could be valid.
+			if ( !cmdLen || !i ) {
+				rc = -EINVAL;
+			}
+			break;
+		}
+		op = FL_BATCH_OP(words[i]);
+		rc = runBatchCmd(fs, words + i);
+		if ( op == FL_BATCH_RD || op == FL_BATCH_POLL ) {
+			*resultLen = i + cmdLen;  // even a failed poll has a result
+		}
+		if ( rc ) {
+			break;
+		}
+	}
+	*numDone = i;
+	return rc;
+}
+
+// Run a batch of commands for FPGALINK_CMDBATCH. Rather than copying each command separately, the
+// batch is copied into a kernel buffer a chunk at a time, and copied back out only if something in
+// the chunk was read. A command straddling the end of one chunk is done in the next one.
+//
+static int runBatch(struct FileState *fs, struct CmdBatch *kb) {
+	u32 __user *const uwords = (u32 __user *)kb->words;
+	u32 *const words = kmalloc(FL_BATCH_CHUNK * sizeof(u32), GFP_KERNEL);
+	u32 chunkLen, numDone, resultLen;
+	int rc = 0;
+	if ( !words ) {
+		return -ENOMEM;
+	}
+	kb->numDone = 0;
+	while ( !rc && kb->numDone < kb->numWords ) {
+		chunkLen = min_t(u32, kb->numWords - kb->numDone, FL_BATCH_CHUNK);
+		if ( copy_from_user(words, uwords + kb->numDone, chunkLen * sizeof(u32)) ) {
+			rc = -EFAULT; break;
+		}
+		rc = runBatchWords(fs, words, chunkLen, &numDone, &resultLen);
+		if ( copy_to_user(uwords + kb->numDone, words, resultLen * sizeof(u32)) ) {
+			rc = -EFAULT;
+		}
+		kb->numDone += numDone;
+	}
+	kfree(words);
+	return rc;
+}
+
+// Run the batches submitted asynchronously by this file, in the order they were submitted
+//
+static void asyncWorker(struct work_struct *work) {
+	struct FileState *const fs = container_of(work, struct FileState, asyncWork);
+	struct AsyncJob *job;
+	u32 resultLen;
+	for ( ; ; ) {
+		spin_lock(&fs->asyncLock);
+		job = list_first_entry_or_null(&fs->asyncQueued, struct AsyncJob, list);
+		if ( job ) {
+			list_del(&job->list);
+		}
+		spin_unlock(&fs->asyncLock);
+		if ( !job ) {
+			break;
+		}
+		job->req.status = runBatchWords(
+			fs, job->words, job->req.numWords, &job->req.numDone, &resultLen
+		);
+		if ( !job->req.status && job->req.numDone != job->req.numWords ) {
+			job->req.status = -EINVAL;  // the last command is truncated
+		}
+		spin_lock(&fs->asyncLock);
+		list_add_tail(&job->list, &fs->asyncDone);
+		if ( fs->asyncEventFd ) {
+			eventfd_signal(fs->asyncEventFd, 1);
+		}
+		spin_unlock(&fs->asyncLock);
+		wake_up_interruptible(&fs->asyncWq);
+	}
+}
+
+// Queue a batch of commands to be run in the background, on behalf of FPGALINK_SUBMIT
+//
+static int submitBatch(struct FileState *fs, const struct CmdAsync *req) {
+	struct AsyncJob *job;
+	int rc = 0;
+	if ( !req->numWords || req->numWords > FL_BATCH_CHUNK ) {
+		return -EINVAL;
+	}
+	job = kmalloc(sizeof(struct AsyncJob) + req->numWords * sizeof(u32), GFP_KERNEL);
+	if ( !job ) {
+		return -ENOMEM;
+	}
+	job->req = *req;
+	job->req.numDone = 0;
+	job->req.status = 0;
+	if ( copy_from_user(job->words, (u32 __user *)req->words, req->numWords * sizeof(u32)) ) {
+		kfree(job);
+		return -EFAULT;
+	}
+	spin_lock(&fs->asyncLock);
+	if ( fs->asyncCount < FL_ASYNC_MAX_JOBS ) {
+		fs->asyncCount++;
+		list_add_tail(&job->list, &fs->asyncQueued);
+	} else {
+		rc = -EAGAIN;  // too many jobs not yet reaped
+	}
+	spin_unlock(&fs->asyncLock);
+	if ( rc ) {
+		kfree(job);
+		return rc;
+	}
+	queue_work(flAsyncWq, &fs->asyncWork);
+	return 0;
+}
+
+// Hand the oldest finished batch back to userspace, on behalf of FPGALINK_REAP. Its results are
+// copied back into the words it was submitted from.
+//
+static int reapBatch(struct FileState *fs, struct file *filp, struct CmdAsync *req) {
+	struct AsyncJob *job;
+	int rc = 0;
+	for ( ; ; ) {
+		spin_lock(&fs->asyncLock);
+		job = list_first_entry_or_null(&fs->asyncDone, struct AsyncJob, list);
+		if ( job ) {
+			list_del(&job->list);
+			fs->asyncCount--;
+		}
+		spin_unlock(&fs->asyncLock);
+		if ( job ) {
+			break;
+		}
+		if ( filp->f_flags & O_NONBLOCK ) {
+			return -EAGAIN;
+		}
+		if ( wait_event_interruptible(fs->asyncWq, !list_empty_careful(&fs->asyncDone)) ) {
+			return -ERESTARTSYS;
+		}
+	}
+	*req = job->req;
+	if ( copy_to_user((u32 __user *)req->words, job->words, req->numWords * sizeof(u32)) ) {
+		rc = -EFAULT;
+	}
+	kfree(job);
+	return rc;
+}
+
+// Choose the eventfd (if any) to signal when asynchronous batches finish
+//
+static int setAsyncEventFd(struct FileState *fs, int fd) {
+	struct eventfd_ctx *ctx = NULL, *old;
+	if ( fd >= 0 ) {
+		ctx = eventfd_ctx_fdget(fd);
+		if ( IS_ERR(ctx) ) {
+			return PTR_ERR(ctx);
+		}
+	}
+	spin_lock(&fs->asyncLock);
+	old = fs->asyncEventFd;
+	fs->asyncEventFd = ctx;
+	spin_unlock(&fs->asyncLock);
+	if ( old ) {
+		eventfd_ctx_put(old);
+	}
+	return 0;
+}
+
+// The ioctl() implementation
+//
+static long handleIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct FileState *const fs = filp->private_data;
+	struct AlteraDevice *const ape = fs->ape;
+	u32 __iomem *const regSpace = (u32 __iomem *)ape->bar[0];
+	struct CmdList kl;
+	struct CmdBatch kb;
+	struct CmdAsync ka;
+	struct TxBuffer tb;
+	struct Cmd kc;
+	struct RingConfig cfg;
+	struct RingStats stats;
+	struct Cmd __user *ucp;
+	u32 numCmds, reg, index;
+	unsigned long flags;
+	int err = 0;
 
 	// Extract the type and number bitfields, and don't decode
 	// wrong cmds: return ENOTTY (inappropriate ioctl) before access_ok()
@@ -542,6 +2118,9 @@ static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
 			if ( err ) {
 				return -EFAULT;
 			}
+			if ( kc.op != OP_SD && kc.reg >= NUM_REGS ) {
+				return -EINVAL;
+			}
 			reg = 1 + kc.reg * 2;
 			if ( kc.op == OP_RD ) {
 				// Read the specified register and copy the result over to userspace
@@ -554,9 +2133,14 @@ static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
 				iowrite32(kc.val, regSpace + reg);
 			} else if ( kc.op == OP_SD ) {
 				// Start DMA
-				ape->numAvailable = ape->outIndex = 0;
-				ape->numSubmitted = 1;
-				submitDmaReq(ape, ape->bufferArrayBus, BUF_SIZE/128);
+				err = claimStream(fs);
+				if ( err ) {
+					return err;
+				}
+				err = startQueue(ape);
+				if ( err ) {
+					return err;
+				}
 			} else {
 				// Unrecognised operation
 				return -EFAULT;
@@ -565,22 +2149,177 @@ static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
 			numCmds--;
 		}
 		break;
+
+	case FPGALINK_CMDBATCH:
+		err = copy_from_user(&kb, (struct CmdBatch __user *)arg, sizeof(struct CmdBatch));
+		if ( err ) {
+			return -EFAULT;
+		}
+		err = runBatch(fs, &kb);
+		if ( put_user(kb.numDone, &((struct CmdBatch __user *)arg)->numDone) ) {
+			return -EFAULT;
+		}
+		return err;
+
+	case FPGALINK_SUBMIT:
+		err = copy_from_user(&ka, (struct CmdAsync __user *)arg, sizeof(struct CmdAsync));
+		if ( err ) {
+			return -EFAULT;
+		}
+		return submitBatch(fs, &ka);
+
+	case FPGALINK_REAP:
+		err = reapBatch(fs, filp, &ka);
+		if ( err && err != -EFAULT ) {
+			return err;
+		}
+		if ( copy_to_user((struct CmdAsync __user *)arg, &ka, sizeof(struct CmdAsync)) ) {
+			return -EFAULT;
+		}
+		return err;
+
+	case FPGALINK_EVENTFD:
+		return setAsyncEventFd(fs, (int)arg);
+
+	case FPGALINK_TXACQUIRE:
+		err = acquireTxBuffer(ape, filp, &index);
+		if ( err ) {
+			return err;
+		}
+		return put_user(index, (unsigned int __user *)arg) ? -EFAULT : 0;
+
+	case FPGALINK_TXSUBMIT:
+		if ( copy_from_user(&tb, (struct TxBuffer __user *)arg, sizeof(struct TxBuffer)) ) {
+			return -EFAULT;
+		}
+		return releaseTxBuffer(fs, &tb);
+
+	case FPGALINK_TXRING:
+		cfg.numBufs = ape->txRing.numBufs;
+		cfg.bufSize = ape->txRing.bufSize;
+		cfg.mode = ape->txRing.mode;
+		cfg.bufStride = ape->txRing.bufStride;
+		if ( copy_to_user((struct RingConfig __user *)arg, &cfg, sizeof(struct RingConfig)) ) {
+			return -EFAULT;
+		}
+		break;
+
+	case FPGALINK_ACQUIRE:
+		err = claimStream(fs);
+		if ( err ) {
+			return err;
+		}
+		err = acquireBuffer(ape, filp, &index);
+		if ( err ) {
+			return err;
+		}
+		err = put_user(index, (unsigned int __user *)arg);
+		if ( err ) {
+			return -EFAULT;
+		}
+		break;
+
+	case FPGALINK_RELEASE:
+		err = get_user(index, (unsigned int __user *)arg);
+		if ( err ) {
+			return -EFAULT;
+		}
+		err = claimStream(fs);
+		return err ? err : releaseBuffer(ape, index);
+
+	case FPGALINK_SETUP:
+		err = copy_from_user(&cfg, (struct RingConfig __user *)arg, sizeof(struct RingConfig));
+		if ( err ) {
+			return -EFAULT;
+		}
+		if ( cfg.mode || cfg.numBufs || cfg.bufSize ) {
+			// Just asking for the geometry is fine, but changing it is a streaming op
+			err = claimStream(fs);
+			if ( err ) {
+				return err;
+			}
+		}
+		err = setupRing(ape, &cfg);
+		if ( copy_to_user((struct RingConfig __user *)arg, &cfg, sizeof(struct RingConfig)) ) {
+			return -EFAULT;
+		}
+		return err;
+
+	case FPGALINK_STATS:
+		getStats(ape, &stats);
+		if ( copy_to_user((struct RingStats __user *)arg, &stats, sizeof(struct RingStats)) ) {
+			return -EFAULT;
+		}
+		break;
+
+	case FPGALINK_SYNC:
+		// Userspace advanced the shared tail while the queue was idle
+		err = claimStream(fs);
+		if ( err ) {
+			return err;
+		}
+		spin_lock_irqsave(&ape->lock, flags);
+		refillQueue(ape);
+		spin_unlock_irqrestore(&ape->lock, flags);
+		break;
 	}
 	return 0;
 }
 
+// The ioctl() entry point: handleIOCtl() with a tracepoint recording how long each call took
+//
+static long cdevIOCtl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct FileState *const fs = filp->private_data;
+	const u64 t0 = trace_fpgalink_ioctl_enabled() ? ktime_get_ns() : 0;
+	const long retVal = handleIOCtl(filp, cmd, arg);
+	if ( t0 ) {
+		trace_fpgalink_ioctl(fs->ape->minor, _IOC_NR(cmd), retVal, ktime_get_ns() - t0);
+	}
+	return retVal;
+}
+
 // Module initialization, registers devices.
 //
 static int __init flInit(void) {
 	int rc;
 	printk(KERN_DEBUG DRV_NAME " flInit(), built at " __DATE__ " " __TIME__ "\n");
 
+	// Allocate the char device region shared by all cards
+	rc = alloc_chrdev_region(&flDevBase, 0, FL_MAX_DEVICES, DRV_NAME);
+	if ( rc ) {
+		printk(KERN_ERR "alloc_chrdev_region() failed (rc=%d)\n", rc);
+		goto err_chrdev;
+	}
+
+	// Create /sys/class/fpgalink
+	flClass = class_create(THIS_MODULE, DRV_NAME);
+	if ( IS_ERR(flClass) ) {
+		rc = PTR_ERR(flClass);
+		printk(KERN_ERR "class_create() failed (rc=%d)\n", rc);
+		goto err_class;
+	}
+
+	// Create the workqueue for asynchronous command batches
+	flAsyncWq = alloc_workqueue(DRV_NAME "_async", WQ_UNBOUND, 0);
+	if ( !flAsyncWq ) {
+		printk(KERN_ERR "alloc_workqueue() failed\n");
+		rc = -ENOMEM; goto err_wq;
+	}
+
 	// register this driver with the PCI bus driver
 	rc = pci_register_driver(&pciDriver);
 	if ( rc < 0 ) {
-		return rc;
+		goto err_register;
 	}
 	return 0;
+err_register:
+	destroy_workqueue(flAsyncWq);
+err_wq:
+	class_destroy(flClass);
+err_class:
+	unregister_chrdev_region(flDevBase, FL_MAX_DEVICES);
+err_chrdev:
+	return rc;
 }
 
 // Module cleanup, unregisters devices.
@@ -590,6 +2329,12 @@ static void __exit flExit(void) {
 
 	// Unregister PCIe driver
 	pci_unregister_driver(&pciDriver);
+
+	// Release the resources shared by all cards
+	destroy_workqueue(flAsyncWq);
+	class_destroy(flClass);
+	unregister_chrdev_region(flDevBase, FL_MAX_DEVICES);
+	ida_destroy(&flMinors);
 }
 
 MODULE_LICENSE("GPL");
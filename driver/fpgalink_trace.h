@@ -0,0 +1,205 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program. If
+// not, see <http://www.gnu.org/licenses/>.
+//
+// Tracepoints on the driver's hot paths. They cost a patched-out branch when disabled; enable them
+// with e.g. "perf record -e 'fpgalink:*'", or through /sys/kernel/debug/tracing/events/fpgalink.
+// Buffers are identified by their free-running sequence number, so the submit and complete events
+// for a buffer can be paired up to see how long the FPGA took to fill it.
+//
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fpgalink
+
+#if !defined(FPGALINK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define FPGALINK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Where a spinlock hold time was measured
+#define FL_LOCK_IRQ   0
+#define FL_LOCK_DRAIN 1
+#define FL_LOCK_READ  2
+
+// A buffer was given to the FPGA to fill
+//
+TRACE_EVENT(fpgalink_submit,
+	TP_PROTO(int minor, u32 seq, u32 slot, dma_addr_t bus, u32 numTLPs),
+	TP_ARGS(minor, seq, slot, bus, numTLPs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, seq)
+		__field(u32, slot)
+		__field(u64, bus)
+		__field(u32, numTLPs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->seq = seq;
+		__entry->slot = slot;
+		__entry->bus = (u64)bus;
+		__entry->numTLPs = numTLPs;
+	),
+	TP_printk(
+		"fpga%d seq=%u slot=%u bus=0x%llx tlps=%u",
+		__entry->minor, __entry->seq, __entry->slot, __entry->bus, __entry->numTLPs
+	)
+);
+
+// The FPGA finished filling a buffer; occupancy is how many are now waiting for userspace
+//
+TRACE_EVENT(fpgalink_complete,
+	TP_PROTO(int minor, u32 seq, u32 slot, u32 occupancy),
+	TP_ARGS(minor, seq, slot, occupancy),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, seq)
+		__field(u32, slot)
+		__field(u32, occupancy)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->seq = seq;
+		__entry->slot = slot;
+		__entry->occupancy = occupancy;
+	),
+	TP_printk(
+		"fpga%d seq=%u slot=%u occupancy=%u",
+		__entry->minor, __entry->seq, __entry->slot, __entry->occupancy
+	)
+);
+
+// Coalesced completions were handled, delayNs after the first of them was interrupted
+//
+TRACE_EVENT(fpgalink_drain,
+	TP_PROTO(int minor, u32 head, u32 numDrained, u64 delayNs),
+	TP_ARGS(minor, head, numDrained, delayNs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, head)
+		__field(u32, numDrained)
+		__field(u64, delayNs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->head = head;
+		__entry->numDrained = numDrained;
+		__entry->delayNs = delayNs;
+	),
+	TP_printk(
+		"fpga%d head=%u drained=%u delay=%lluns",
+		__entry->minor, __entry->head, __entry->numDrained, __entry->delayNs
+	)
+);
+
+// A process waiting for a buffer got to run again, latencyNs after the most recent interrupt
+//
+TRACE_EVENT(fpgalink_wakeup,
+	TP_PROTO(int minor, u32 head, u64 latencyNs),
+	TP_ARGS(minor, head, latencyNs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, head)
+		__field(u64, latencyNs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->head = head;
+		__entry->latencyNs = latencyNs;
+	),
+	TP_printk(
+		"fpga%d head=%u latency=%lluns",
+		__entry->minor, __entry->head, __entry->latencyNs
+	)
+);
+
+// How long the queue's spinlock was held, and where
+//
+TRACE_EVENT(fpgalink_lock,
+	TP_PROTO(int minor, int site, u64 holdNs),
+	TP_ARGS(minor, site, holdNs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(int, site)
+		__field(u64, holdNs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->site = site;
+		__entry->holdNs = holdNs;
+	),
+	TP_printk(
+		"fpga%d site=%s hold=%lluns",
+		__entry->minor,
+		__print_symbolic(__entry->site,
+			{FL_LOCK_IRQ, "irq"}, {FL_LOCK_DRAIN, "drain"}, {FL_LOCK_READ, "read"}),
+		__entry->holdNs
+	)
+);
+
+// read() (or splice()) copied numBufs buffers starting at seq out to userspace
+//
+TRACE_EVENT(fpgalink_copy,
+	TP_PROTO(int minor, u32 seq, u32 numBufs, size_t bytes, u64 durationNs),
+	TP_ARGS(minor, seq, numBufs, bytes, durationNs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, seq)
+		__field(u32, numBufs)
+		__field(size_t, bytes)
+		__field(u64, durationNs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->seq = seq;
+		__entry->numBufs = numBufs;
+		__entry->bytes = bytes;
+		__entry->durationNs = durationNs;
+	),
+	TP_printk(
+		"fpga%d seq=%u bufs=%u bytes=%zu duration=%lluns",
+		__entry->minor, __entry->seq, __entry->numBufs, __entry->bytes, __entry->durationNs
+	)
+);
+
+// An ioctl() returned
+//
+TRACE_EVENT(fpgalink_ioctl,
+	TP_PROTO(int minor, unsigned int nr, long ret, u64 durationNs),
+	TP_ARGS(minor, nr, ret, durationNs),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned int, nr)
+		__field(long, ret)
+		__field(u64, durationNs)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->nr = nr;
+		__entry->ret = ret;
+		__entry->durationNs = durationNs;
+	),
+	TP_printk(
+		"fpga%d nr=%u ret=%ld duration=%lluns",
+		__entry->minor, __entry->nr, __entry->ret, __entry->durationNs
+	)
+);
+
+#endif
+
+// This header isn't in include/trace/events, so tell define_trace.h where to find it. The Makefile
+// adds this directory to the include path.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fpgalink_trace
+#include <trace/define_trace.h>
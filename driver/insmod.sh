@@ -14,7 +14,6 @@
 # not, see <http://www.gnu.org/licenses/>.
 #
 MODULE="fpgalink"
-DEVICE="fpga0"
 MODE="664"
 GROUP="users"
 
@@ -24,11 +23,13 @@ cd $(dirname $0)
 # Invoke insmod with all arguments we got
 /sbin/insmod ./${MODULE}.ko $* || exit 1
 
-# Retrieve major number
-MAJOR=$(awk "\$2==\"${DEVICE}\" {print \$1}" /proc/devices)
-
-# Remove stale nodes and replace them, then give gid and perms
-rm -f /dev/${DEVICE}
-mknod /dev/${DEVICE} c ${MAJOR} 0
-chgrp ${GROUP} /dev/${DEVICE}
-chmod ${MODE}  /dev/${DEVICE}
+# Each card appears as /sys/class/fpgalink/fpgaN; udev may already have made the nodes, but remove
+# them and replace them anyway, then give gid and perms
+for SYSDEV in /sys/class/${MODULE}/fpga*; do
+  [ -e ${SYSDEV}/dev ] || continue
+  DEVICE=$(basename ${SYSDEV})
+  rm -f /dev/${DEVICE}
+  mknod /dev/${DEVICE} c $(cut -d: -f1 ${SYSDEV}/dev) $(cut -d: -f2 ${SYSDEV}/dev)
+  chgrp ${GROUP} /dev/${DEVICE}
+  chmod ${MODE}  /dev/${DEVICE}
+done
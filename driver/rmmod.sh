@@ -14,10 +14,9 @@
 # not, see <http://www.gnu.org/licenses/>.
 #
 MODULE="fpgalink"
-DEVICE="fpga0"
 
 # Invoke rmmod with all arguments we got
 /sbin/rmmod ${MODULE} $* || exit 1
 
 # Remove stale nodes
-rm -f /dev/${DEVICE}
+rm -f /dev/fpga[0-9]*
@@ -22,6 +22,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "ioctl_defs.h"
 
 // Macros for declaring individual commands
@@ -38,6 +40,41 @@ static inline int flCmdListImpl(int dev, struct Cmd *cmds, uint32_t numCmds) {
 	return ioctl(dev, FPGALINK_CMDLIST, &cmdList);
 }
 
+// Run a batch of commands encoded with FL_BATCH_CMD() (see ioctl_defs.h). Results of reads and
+// polls are written back into the words array. If numDone is not NULL, it's set to the number of
+// words successfully processed.
+//
+static inline int flCmdBatch(int dev, uint32_t *words, uint32_t numWords, uint32_t *numDone) {
+	struct CmdBatch batch = {numWords, 0, words};
+	const int retVal = ioctl(dev, FPGALINK_CMDBATCH, &batch);
+	if ( numDone ) {
+		*numDone = batch.numDone;
+	}
+	return retVal;
+}
+
+// Queue a batch of commands to be run in the background (see struct CmdAsync in ioctl_defs.h). The
+// words array must remain valid until the batch is reaped, because the results are written back
+// into it then.
+//
+static inline int flSubmitBatch(int dev, uint32_t *words, uint32_t numWords, uint64_t tag) {
+	const struct CmdAsync req = {tag, numWords, 0, 0, words};
+	return ioctl(dev, FPGALINK_SUBMIT, &req);
+}
+
+// Get the oldest finished background batch, waiting for one unless the device was opened with
+// O_NONBLOCK
+//
+static inline int flReapBatch(int dev, struct CmdAsync *req) {
+	return ioctl(dev, FPGALINK_REAP, req);
+}
+
+// Have the driver signal the given eventfd whenever a background batch finishes; -1 to stop
+//
+static inline int flSetEventFd(int dev, int fd) {
+	return ioctl(dev, FPGALINK_EVENTFD, fd);
+}
+
 // Write a 32-bit value to the specified FPGA register
 //
 static inline void flWriteRegister(int dev, uint32_t reg, uint32_t value) {
@@ -53,6 +90,36 @@ static inline uint32_t flReadRegister(int dev, uint32_t reg) {
 	return cmd.val;
 }
 
+// Map the FPGA registers into this process, for use with flPeek() and flPoke(). This claims the
+// streaming session, so it fails (returning NULL, with errno EBUSY) if another process owns it.
+//
+static inline volatile uint32_t *flMapRegs(int dev) {
+	void *const p = mmap(
+		NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, dev, FL_MMAP_REGS
+	);
+	return (p == MAP_FAILED) ? NULL : (volatile uint32_t *)p;
+}
+
+// Unmap the registers previously mapped with flMapRegs()
+//
+static inline void flUnmapRegs(volatile uint32_t *regs) {
+	munmap((void *)regs, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+// Read a 32-bit value from the specified FPGA register, directly through the mapping returned by
+// flMapRegs(). Unlike flReadRegister(), this doesn't involve the driver at all.
+//
+static inline uint32_t flPeek(volatile const uint32_t *regs, uint32_t reg) {
+	return regs[1 + reg*2];
+}
+
+// Write a 32-bit value to the specified FPGA register, directly through the mapping returned by
+// flMapRegs()
+//
+static inline void flPoke(volatile uint32_t *regs, uint32_t reg, uint32_t value) {
+	regs[1 + reg*2] = value;
+}
+
 // Tell the driver to begin DMA'ing data into its circular queue
 //
 static inline void flStartDMA(int dev) {
@@ -60,4 +127,157 @@ static inline void flStartDMA(int dev) {
 	flCmdListImpl(dev, &cmd, 1);
 }
 
+// Change the geometry of the driver's circular queue; this must be done before DMA is started. Zero
+// arguments leave that part of the geometry unchanged, and the geometry in use is returned in cfg.
+// The mode is FL_RING_CONTIGUOUS or FL_RING_SCATTER.
+//
+static inline int flSetupRing(
+	int dev, uint32_t numBufs, uint32_t bufSize, uint32_t mode, struct RingConfig *cfg)
+{
+	cfg->numBufs = numBufs;
+	cfg->bufSize = bufSize;
+	cfg->mode = mode;
+	cfg->bufStride = 0;
+	return ioctl(dev, FPGALINK_SETUP, cfg);
+}
+
+// Get the geometry of the driver's circular queue
+//
+static inline int flGetRing(int dev, struct RingConfig *cfg) {
+	return flSetupRing(dev, 0, 0, 0, cfg);
+}
+
+// Get the circular queue's statistics
+//
+static inline int flGetStats(int dev, struct RingStats *stats) {
+	return ioctl(dev, FPGALINK_STATS, stats);
+}
+
+// Map the driver's circular queue read-only into this process. Buffer i starts at offset
+// i*cfg->bufStride. Returns NULL on failure.
+//
+static inline const uint8_t *flMapBuffers(int dev, const struct RingConfig *cfg) {
+	void *const p = mmap(
+		NULL, (size_t)cfg->numBufs*cfg->bufStride, PROT_READ, MAP_SHARED, dev, FL_MMAP_BUFFERS
+	);
+	return (p == MAP_FAILED) ? NULL : (const uint8_t *)p;
+}
+
+// Unmap the circular queue previously mapped with flMapBuffers()
+//
+static inline void flUnmapBuffers(const uint8_t *buffers, const struct RingConfig *cfg) {
+	munmap((void *)buffers, (size_t)cfg->numBufs*cfg->bufStride);
+}
+
+// Map the per-slot buffer descriptors read-only into this process. The descriptor for buffer N is
+// at index (N & (cfg->numBufs-1)). Returns NULL on failure.
+//
+static inline const struct BufferDesc *flMapDescs(int dev, const struct RingConfig *cfg) {
+	void *const p = mmap(
+		NULL, (size_t)cfg->numBufs*sizeof(struct BufferDesc), PROT_READ, MAP_SHARED, dev, FL_MMAP_DESCS
+	);
+	return (p == MAP_FAILED) ? NULL : (const struct BufferDesc *)p;
+}
+
+// Unmap the descriptors previously mapped with flMapDescs()
+//
+static inline void flUnmapDescs(const struct BufferDesc *descs, const struct RingConfig *cfg) {
+	munmap((void *)descs, (size_t)cfg->numBufs*sizeof(struct BufferDesc));
+}
+
+// Wait for the FPGA to fill the next buffer, and return its index (or -1 on error). The buffer
+// may be read in-place through the mapping returned by flMapBuffers(), until it's released.
+//
+static inline int flAcquireBuffer(int dev) {
+	unsigned int index;
+	return ioctl(dev, FPGALINK_ACQUIRE, &index) ? -1 : (int)index;
+}
+
+// Give an acquired buffer back to the driver, so the FPGA can refill it. Buffers must be released
+// in the order they were acquired.
+//
+static inline int flReleaseBuffer(int dev, int index) {
+	unsigned int i = (unsigned int)index;
+	return ioctl(dev, FPGALINK_RELEASE, &i);
+}
+
+// Map the ring header shared with the driver, for consuming buffers without any syscalls. Returns
+// NULL on failure.
+//
+static inline struct RingHeader *flMapHeader(int dev) {
+	void *const p = mmap(
+		NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, dev, FL_MMAP_HEADER
+	);
+	return (p == MAP_FAILED) ? NULL : (struct RingHeader *)p;
+}
+
+// Unmap the ring header previously mapped with flMapHeader()
+//
+static inline void flUnmapHeader(struct RingHeader *hdr) {
+	munmap(hdr, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+// Return the free-running count of buffers the FPGA has filled. Buffers before this count may be
+// read in-place, until they're given back with flRingRelease().
+//
+static inline uint32_t flRingHead(const struct RingHeader *hdr) {
+	return __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+}
+
+// Give back to the driver all buffers before the given free-running count. If the driver has no DMA
+// requests in flight, it has to be told about the new tail explicitly.
+//
+static inline int flRingRelease(int dev, struct RingHeader *hdr, uint32_t tail) {
+	__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(&hdr->idle, __ATOMIC_RELAXED) ) {
+		return ioctl(dev, FPGALINK_SYNC);
+	}
+	return 0;
+}
+
+// Get the geometry of the driver's host-to-FPGA (TX) queue
+//
+static inline int flGetTxRing(int dev, struct RingConfig *cfg) {
+	return ioctl(dev, FPGALINK_TXRING, cfg);
+}
+
+// Map the TX queue read-write into this process, so buffers can be filled in-place. TX buffer i
+// starts at offset i*cfg->bufStride. Returns NULL on failure.
+//
+static inline uint8_t *flMapTxBuffers(int dev, const struct RingConfig *cfg) {
+	void *const p = mmap(
+		NULL, (size_t)cfg->numBufs*cfg->bufStride, PROT_READ|PROT_WRITE, MAP_SHARED, dev, FL_MMAP_TX
+	);
+	return (p == MAP_FAILED) ? NULL : (uint8_t *)p;
+}
+
+// Unmap the TX queue previously mapped with flMapTxBuffers()
+//
+static inline void flUnmapTxBuffers(uint8_t *buffers, const struct RingConfig *cfg) {
+	munmap(buffers, (size_t)cfg->numBufs*cfg->bufStride);
+}
+
+// Wait for a free TX buffer, and return its index (or -1 on error)
+//
+static inline int flTxAcquire(int dev) {
+	unsigned int index;
+	return ioctl(dev, FPGALINK_TXACQUIRE, &index) ? -1 : (int)index;
+}
+
+// Send the first numBytes (a multiple of 128) of an acquired TX buffer to the FPGA. Buffers must be
+// submitted in the order they were acquired.
+//
+static inline int flTxSubmit(int dev, int index, uint32_t numBytes) {
+	const struct TxBuffer tb = {(unsigned int)index, numBytes};
+	return ioctl(dev, FPGALINK_TXSUBMIT, &tb);
+}
+
+// Wait until the FPGA has read everything sent to it so far, whether by write() or flTxSubmit().
+// Fails with ETIMEDOUT if the FPGA stops reading it for a second.
+//
+static inline int flTxFlush(int dev) {
+	return fsync(dev);
+}
+
 #endif
@@ -0,0 +1,245 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Header-only C++11 layer on top of fpgalink.h. A Device owns an open file on the driver, with its
+// circular queue, buffer descriptors and ring header mapped; each BufferView borrows one filled
+// buffer in-place, and gives it back to the FPGA when it's destroyed. Because a Device maps the
+// ring header, it owns the driver's streaming session for as long as it's open; use the C API for
+// register-only access alongside someone else's stream. Failures are reported by throwing
+// std::system_error. Neither class is thread-safe.
+//
+#ifndef FPGALINK_HPP
+#define FPGALINK_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include "fpgalink.h"
+
+namespace fl {
+
+	// Build individual commands, like the RD(), WR() and SD macros in fpgalink.h
+	constexpr Cmd rd(uint32_t reg) { return Cmd{OP_RD, reg, 0}; }
+	constexpr Cmd wr(uint32_t reg, uint32_t val) { return Cmd{OP_WR, reg, val}; }
+	constexpr Cmd sd() { return Cmd{OP_SD, 0, 0}; }
+
+	// Build a command list whose length is known at compile-time, e.g:
+	//
+	//   auto cmds = fl::cmdList(fl::wr(2, 0x1234), fl::rd(2));
+	//   dev.run(cmds);
+	//   printf("%08X\n", cmds[1].val);
+	//
+	template<typename... Cmds>
+	std::array<Cmd, sizeof...(Cmds)> cmdList(Cmds... cmds) {
+		static_assert(sizeof...(Cmds) > 0, "A command list must contain at least one command");
+		return std::array<Cmd, sizeof...(Cmds)>{{cmds...}};
+	}
+
+	[[noreturn]] inline void throwErrno(const char *what) {
+		throw std::system_error(errno, std::generic_category(), what);
+	}
+
+	class Device;
+
+	// A filled buffer, borrowed zero-copy from the circular queue. It can be moved but not copied,
+	// and the buffer is given back to the FPGA when it's destroyed (or release()'d). Views may be
+	// destroyed in any order; the Device gives buffers back in order as they become free.
+	//
+	class BufferView {
+		Device *dev_;
+		const uint8_t *data_;
+		size_t size_;
+		uint32_t seq_;
+		const BufferDesc *desc_;
+		BufferView(Device *dev, const uint8_t *data, size_t size, uint32_t seq, const BufferDesc *desc)
+			: dev_(dev), data_(data), size_(size), seq_(seq), desc_(desc) { }
+		friend class Device;
+	public:
+		BufferView() : dev_(nullptr), data_(nullptr), size_(0), seq_(0), desc_(nullptr) { }
+		BufferView(BufferView &&other) noexcept
+			: dev_(other.dev_), data_(other.data_), size_(other.size_), seq_(other.seq_),
+			  desc_(other.desc_)
+		{
+			other.dev_ = nullptr;
+		}
+		BufferView &operator=(BufferView &&other) noexcept {
+			if ( this != &other ) {
+				release();
+				dev_ = other.dev_; data_ = other.data_; size_ = other.size_; seq_ = other.seq_;
+				desc_ = other.desc_;
+				other.dev_ = nullptr;
+			}
+			return *this;
+		}
+		BufferView(const BufferView &) = delete;
+		BufferView &operator=(const BufferView &) = delete;
+		~BufferView() { release(); }
+
+		inline void release() noexcept;
+		explicit operator bool() const { return dev_ != nullptr; }
+		const uint8_t *data() const { return data_; }
+		size_t size() const { return size_; }
+		const uint8_t *begin() const { return data_; }
+		const uint8_t *end() const { return data_ + size_; }
+
+		// The free-running sequence number of this buffer since DMA was started
+		uint32_t sequence() const { return seq_; }
+
+		// The driver's descriptor for this buffer, with its completion timestamps
+		const BufferDesc &descriptor() const { return *desc_; }
+	};
+
+	// An open file on the driver. The circular queue is mapped when it's opened, so it must already
+	// have the geometry you want; and it can't be moved, because BufferViews refer back to it.
+	//
+	class Device {
+		int fd_;
+		RingConfig cfg_;
+		const uint8_t *buffers_;
+		const BufferDesc *descs_;
+		RingHeader *hdr_;
+		uint32_t next_;              // count of buffers acquired
+		uint32_t tail_;              // count of buffers given back to the driver
+		std::vector<uint8_t> done_;  // per-slot flag: view destroyed, but not yet given back
+		friend class BufferView;
+
+		void giveBack(uint32_t seq) noexcept {
+			const uint32_t mask = cfg_.numBufs - 1;
+			done_[seq & mask] = 1;
+			if ( seq != tail_ ) {
+				return;  // an older buffer is still in use
+			}
+			while ( tail_ != next_ && done_[tail_ & mask] ) {
+				done_[tail_ & mask] = 0;
+				tail_++;
+			}
+			flRingRelease(fd_, hdr_, tail_);
+		}
+
+		void close() noexcept {
+			if ( hdr_ ) {
+				flUnmapHeader(hdr_);
+			}
+			if ( descs_ ) {
+				flUnmapDescs(descs_, &cfg_);
+			}
+			if ( buffers_ ) {
+				flUnmapBuffers(buffers_, &cfg_);
+			}
+			if ( fd_ >= 0 ) {
+				::close(fd_);
+			}
+		}
+
+	public:
+		explicit Device(const char *path = "/dev/fpga0", int flags = O_RDWR)
+			: fd_(-1), cfg_(), buffers_(nullptr), descs_(nullptr), hdr_(nullptr), next_(0), tail_(0)
+		{
+			fd_ = ::open(path, flags);
+			if ( fd_ < 0 ) {
+				throwErrno(path);
+			}
+			if ( flGetRing(fd_, &cfg_) ) {
+				const int e = errno; close(); errno = e;
+				throwErrno("FPGALINK_SETUP");
+			}
+			buffers_ = flMapBuffers(fd_, &cfg_);
+			descs_ = flMapDescs(fd_, &cfg_);
+			hdr_ = flMapHeader(fd_);
+			if ( !buffers_ || !descs_ || !hdr_ ) {
+				const int e = errno; close(); errno = e;
+				throwErrno("mmap()");
+			}
+			next_ = tail_ = hdr_->tail;
+			done_.assign(cfg_.numBufs, 0);
+		}
+		Device(const Device &) = delete;
+		Device &operator=(const Device &) = delete;
+		~Device() { close(); }
+
+		int fd() const { return fd_; }
+		const RingConfig &ring() const { return cfg_; }
+
+		// Run a command list whose length is known at compile-time: either a std::array (see
+		// cmdList()), or a plain array
+		template<size_t N> void run(std::array<Cmd, N> &cmds) { run(cmds.data(), N); }
+		template<size_t N> void run(Cmd (&cmds)[N]) { run(cmds, N); }
+
+		// Run a command list whose length is only known at runtime
+		void run(Cmd *cmds, size_t numCmds) {
+			if ( flCmdListImpl(fd_, cmds, (uint32_t)numCmds) ) {
+				throwErrno("FPGALINK_CMDLIST");
+			}
+		}
+
+		uint32_t readRegister(uint32_t reg) {
+			Cmd cmd = rd(reg);
+			run(&cmd, 1);
+			return cmd.val;
+		}
+
+		void writeRegister(uint32_t reg, uint32_t value) {
+			Cmd cmd = wr(reg, value);
+			run(&cmd, 1);
+		}
+
+		// Start DMA. Any buffers still borrowed from a previous run must be destroyed first.
+		void startDMA() {
+			Cmd cmd = sd();
+			run(&cmd, 1);
+			next_ = tail_ = 0;
+			done_.assign(cfg_.numBufs, 0);
+		}
+
+		RingStats stats() {
+			RingStats s;
+			if ( flGetStats(fd_, &s) ) {
+				throwErrno("FPGALINK_STATS");
+			}
+			return s;
+		}
+
+		// Wait for the next filled buffer, and borrow it. If the device was opened with O_NONBLOCK
+		// and there's none ready, an empty view is returned instead.
+		BufferView acquire() {
+			const int index = flAcquireBuffer(fd_);
+			if ( index < 0 ) {
+				if ( errno == EAGAIN ) {
+					return BufferView();
+				}
+				throwErrno("FPGALINK_ACQUIRE");
+			}
+			return BufferView(
+				this, buffers_ + (size_t)index * cfg_.bufStride, descs_[index].bytes, next_++, descs_ + index
+			);
+		}
+	};
+
+	inline void BufferView::release() noexcept {
+		if ( dev_ ) {
+			dev_->giveBack(seq_);
+			dev_ = nullptr;
+		}
+	}
+}
+
+#endif
@@ -23,8 +23,143 @@
 #ifndef IOCTL_DEFS_H
 #define IOCTL_DEFS_H
 
-// The number of bytes in each DMA buffer
+// The default number of bytes in each DMA buffer. This can be changed when the driver is loaded,
+// or with FPGALINK_SETUP. It must be a multiple of the 128-byte TLP size, and at most MAX_BUF_SIZE
+// because of the width of the TLP count in tlp_core's DMA control register.
 #define BUF_SIZE 65536
+#define MAX_BUF_SIZE (1023*128)
+
+// The default number of DMA buffers in the driver's circular queue. This can also be changed when
+// the driver is loaded, or with FPGALINK_SETUP, but it must always be a power of two. The whole
+// queue can be mmap()'d read-only, giving numBufs*bufStride bytes of buffer data.
+#define NUM_BUFS 32
+#define MAX_NUM_BUFS 65536
+
+// The default number and size of the buffers in the host-to-FPGA (TX) queue. They can be changed
+// when the driver is loaded, subject to the same rules as the receive queue.
+#define TX_NUM_BUFS 8
+#define TX_BUF_SIZE 65536
+
+// The ways the driver can allocate the circular queue: as a single block of coherent memory, or
+// with each buffer allocated separately, which allows much bigger queues, especially on machines
+// whose memory has become fragmented.
+#define FL_RING_CONTIGUOUS 1
+#define FL_RING_SCATTER    2
+
+// The geometry of the circular queue, for FPGALINK_SETUP. Zero fields are left unchanged, and the
+// driver returns the geometry that is actually in use. The bufStride is chosen by the driver: it's
+// the distance between the start of consecutive buffers in the mmap()'d queue.
+struct RingConfig {
+	unsigned int numBufs;
+	unsigned int bufSize;
+	unsigned int mode;
+	unsigned int bufStride;
+};
+
+// Offsets to pass to mmap() for each of the regions the driver can map. The FL_MMAP_REGS region
+// gives uncached access to the FPGA registers, in the first page of BAR0: register N is the 32-bit
+// word at index 1+N*2, just as the driver accesses it. It includes the DMA registers, so mapping it
+// claims the streaming session, and fails with EBUSY if another file owns it. The FL_MMAP_DESCS
+// region is the array of numBufs struct BufferDesc, one per circular-queue slot. The FL_MMAP_TX
+// region is the TX queue, which is mapped read-write.
+#define FL_MMAP_BUFFERS 0x00000000
+#define FL_MMAP_REGS    0x20000000
+#define FL_MMAP_HEADER  0x40000000
+#define FL_MMAP_DESCS   0x60000000
+#define FL_MMAP_TX      0x70000000
+
+// Fields of struct RingHeader written by the driver and by userspace are kept on separate cache
+// lines, so the consumer's updates don't keep stealing the line from the interrupt handler.
+#define FL_CACHE_LINE 64
+
+// A page shared between the driver and userspace, which may be mmap()'d at FL_MMAP_HEADER. The head
+// and tail are free-running counts of buffers, reset by OP_SD; buffer N lives in the circular-queue
+// slot (N & (numBufs-1)), so buffers in [tail, head) are filled and waiting to be consumed. A
+// consumer may busy-poll the head (with acquire semantics), read the buffers in-place, and then
+// advance the tail (with release semantics) past the buffers it's finished with. The driver picks
+// up the new tail on the next DMA completion, but if the idle flag is set there are no DMA requests
+// in flight, so after advancing the tail (and a full barrier), the consumer must check the idle
+// flag and if it's set, issue FPGALINK_SYNC to get DMA going again. The numBufs, bufSize and
+// bufStride fields give the geometry of the circular queue.
+//
+struct RingHeader {
+	// Written by the driver
+	unsigned int head;
+	unsigned int idle;
+	unsigned int numBufs;
+	unsigned int bufSize;
+	unsigned int bufStride;
+	unsigned char reserved0[FL_CACHE_LINE - 5*sizeof(unsigned int)];
+
+	// Written by userspace
+	unsigned int tail;
+	unsigned char reserved1[FL_CACHE_LINE - sizeof(unsigned int)];
+};
+
+// Metadata for the buffer in one circular-queue slot, filled in by the driver when the FPGA
+// completes it, and published along with the head. The seq field is the buffer's free-running
+// sequence number, so a consumer can check that the descriptor belongs to the buffer it's looking
+// at. The timestamps are taken in the interrupt handler, from CLOCK_MONOTONIC and CLOCK_REALTIME.
+// If the driver was loaded with timestampReg set, fpgaTime is that register's value at the same
+// point, and FL_DESC_FPGA_TIME is set. FL_DESC_VALID is cleared when the slot is given back to the
+// FPGA, and FL_DESC_STALLED is set if the FPGA was starved of buffers before this one. If the
+// driver was loaded with flushUsecs set, the FPGA may complete a buffer before filling it, in which
+// case bytes is less than bufSize (but still a multiple of 128), and FL_DESC_FLUSHED is set.
+#define FL_DESC_VALID     0x1
+#define FL_DESC_FPGA_TIME 0x2
+#define FL_DESC_STALLED   0x4
+#define FL_DESC_FLUSHED   0x8
+struct BufferDesc {
+	unsigned int seq;
+	unsigned int bytes;
+	unsigned int flags;
+	unsigned int fpgaTime;
+	unsigned long long timestampNs;
+	unsigned long long realtimeNs;
+};
+
+// A TX buffer to send, for FPGALINK_TXSUBMIT. Data may be sent to the FPGA either with write(),
+// which copies it into the TX queue, or by filling the mapped TX queue in-place: FPGALINK_TXACQUIRE
+// waits for a free buffer and returns its index, and FPGALINK_TXSUBMIT then sends the first bytes
+// of it (a nonzero multiple of 128, up to the TX buffer size). Buffers must be submitted in the
+// order they were acquired, by the file that acquired them; any it hasn't submitted when it's
+// closed are given back unsent. Either way, fsync() waits for everything submitted to reach the
+// FPGA (failing with ETIMEDOUT if the FPGA stops reading it for a second), and the device polls
+// with POLLOUT when there's a free TX buffer. FPGALINK_TXRING returns the TX queue's geometry.
+struct TxBuffer {
+	unsigned int index;
+	unsigned int bytes;
+};
+
+// A batch to be run in the background, for FPGALINK_SUBMIT. The words are in the FPGALINK_CMDBATCH
+// format, but all of them must fit in one chunk. The driver copies them when the batch is
+// submitted, and runs each file's batches in order. When one finishes, the file polls with POLLPRI,
+// and the eventfd given to FPGALINK_EVENTFD (if any) is signalled. FPGALINK_REAP then returns the
+// oldest finished batch: its words are copied back (with the results of any reads), and its tag,
+// numDone and status (zero or a negative errno) say which batch it was and how it went. At most
+// FL_ASYNC_MAX_JOBS batches may be submitted but not yet reaped. FPGALINK_EVENTFD takes the
+// eventfd itself as its argument, or -1 to stop using one.
+#define FL_ASYNC_MAX_JOBS 64
+struct CmdAsync {
+	unsigned long long tag;
+	unsigned int numWords;
+	unsigned int numDone;
+	int status;
+	unsigned int *words;
+};
+
+// Statistics for the circular queue, for FPGALINK_STATS. They're reset when DMA is started with
+// OP_SD. The FPGA is starved when it's been left with no buffers to fill, because userspace is
+// holding all of them; ringFull counts the times that happened, and starvedNs how long it lasted in
+// total. The occupancy is the number of filled buffers not yet released by userspace.
+struct RingStats {
+	unsigned long long completed;
+	unsigned long long delivered;
+	unsigned long long ringFull;
+	unsigned long long starvedNs;
+	unsigned int maxOccupancy;
+	unsigned int occupancy;
+};
 
 // Enum for specifying each command's operation
 typedef enum {OP_RD, OP_WR, OP_SD} Operation;
@@ -41,9 +176,56 @@ struct CmdList {
 	struct Cmd *cmds;
 };
 
+// A more compact encoding of commands, for FPGALINK_CMDBATCH. The batch is an array of 32-bit words;
+// each command is a header word built with FL_BATCH_CMD(), followed by a number of data words:
+//
+//   FL_BATCH_RD:   count words, overwritten with registers reg..reg+count-1
+//   FL_BATCH_WR:   count words, written to registers reg..reg+count-1
+//   FL_BATCH_POLL: four words: mask, match, timeout (in microseconds, at most
+//                  FL_BATCH_MAX_POLL_US, or the batch fails with EINVAL) and result, wait for the
+//                  register to satisfy (reg & mask) == match, and overwrite result with the last
+//                  value read; the ioctl() fails with ETIMEDOUT if it never does
+//   FL_BATCH_SD:   no data words; start DMA (the count and register are ignored), like OP_SD,
+//                  which fails with EBUSY if the FPGA is still holding buffers from an earlier
+//                  session and doesn't finish with them within a second
+//
+// The driver processes the batch in chunks of at most FL_BATCH_CHUNK words, so no single command
+// may be longer than that.
+#define FL_BATCH_RD   0x0
+#define FL_BATCH_WR   0x1
+#define FL_BATCH_POLL 0x2
+#define FL_BATCH_SD   0x3
+#define FL_BATCH_CMD(op, count, reg) (((op) << 28) | ((count) << 16) | (reg))
+#define FL_BATCH_OP(w)    ((w) >> 28)
+#define FL_BATCH_COUNT(w) (((w) >> 16) & 0x0FFF)
+#define FL_BATCH_REG(w)   ((w) & 0xFFFF)
+#define FL_BATCH_MAX_COUNT 0x0FFF
+#define FL_BATCH_CHUNK 4096
+#define FL_BATCH_MAX_POLL_US 1000000
+
+// The batch itself. The driver sets numDone to the number of words it processed, so if it fails
+// part-way through, userspace can tell which command failed.
+struct CmdBatch {
+	unsigned int numWords;
+	unsigned int numDone;
+	unsigned int *words;
+};
+
 // Defines for ioctls: user-space must include sys/ioctl.h before this
 #define FPGALINK_IOC_MAGIC 'F'
 #define FPGALINK_CMDLIST _IOWR(FPGALINK_IOC_MAGIC, 1, struct CmdList)
-#define FPGALINK_IOC_MAXNR 1
+#define FPGALINK_ACQUIRE _IOR(FPGALINK_IOC_MAGIC, 2, unsigned int)
+#define FPGALINK_RELEASE _IOW(FPGALINK_IOC_MAGIC, 3, unsigned int)
+#define FPGALINK_SYNC _IO(FPGALINK_IOC_MAGIC, 4)
+#define FPGALINK_SETUP _IOWR(FPGALINK_IOC_MAGIC, 5, struct RingConfig)
+#define FPGALINK_STATS _IOR(FPGALINK_IOC_MAGIC, 6, struct RingStats)
+#define FPGALINK_CMDBATCH _IOWR(FPGALINK_IOC_MAGIC, 7, struct CmdBatch)
+#define FPGALINK_SUBMIT _IOW(FPGALINK_IOC_MAGIC, 8, struct CmdAsync)
+#define FPGALINK_REAP _IOR(FPGALINK_IOC_MAGIC, 9, struct CmdAsync)
+#define FPGALINK_EVENTFD _IO(FPGALINK_IOC_MAGIC, 10)
+#define FPGALINK_TXACQUIRE _IOR(FPGALINK_IOC_MAGIC, 11, unsigned int)
+#define FPGALINK_TXSUBMIT _IOW(FPGALINK_IOC_MAGIC, 12, struct TxBuffer)
+#define FPGALINK_TXRING _IOR(FPGALINK_IOC_MAGIC, 13, struct RingConfig)
+#define FPGALINK_IOC_MAXNR 13
 
 #endif
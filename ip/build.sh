@@ -27,9 +27,7 @@ echo "Starting RNG generation..."
 cd dvr-rng/gen-rng
 ./build.sh
 cd ..
-gen-rng/write_vhdl 1024 32 5 32 1c48
-gen-rng/write_vhdl 2048 64 3 32 5f81cb
-gen-rng/write_vhdl 3060 96 3 32 0x79e56
+gen-rng/write_vhdl -t 1024,32,5,32,1c48 2048,64,3,32,5f81cb 3060,96,3,32,79e56
 cd ..
 echo
 
@@ -18,15 +18,21 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #
 if [ "$OS" = "Windows_NT" ]; then
-  CPP="cl -EHsc -Fe"
+  CPP="cl -O2 -EHsc -Fe"
 else
-  CPP="g++ -g -std=c++11 -o"
+  CPP="g++ -g -O2 -std=c++11 -pthread -o"
 fi
 
-for i in write_vhdl get_seq32 get_seq64 get_seq96; do
+build() {
   echo "--------------------------------------------------------------------------------"
-  echo "${CPP}${i} ${i}.cpp"
-  ${CPP}${i} ${i}.cpp
+  echo "${CPP}$@"
+  ${CPP}"$@"
   echo
   echo
+}
+
+build write_vhdl write_vhdl.cpp
+build write_hpp write_hpp.cpp
+for w in 32 64 96; do
+  build get_seq${w} -DGET_SEQ_WIDTH=${w} get_seq.cpp
 done
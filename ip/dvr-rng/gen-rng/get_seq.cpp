@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// The get_seq32, get_seq64 and get_seq96 tools. build.sh compiles this once for each, with
+// GET_SEQ_WIDTH set to choose which of the dvr_rng generators in dvr_rng.hpp it models by default.
+// Any other generator can be chosen at runtime with --tuple, either by its index in the list of
+// known tuples (see --list) or as n,r,t,k,s; then it's seeded with --seed, or with all ones.
+//
+// Each output is written as (r+31)/32 little-endian longwords, LSB first, in blocks of many outputs
+// at a time (see get_seq.hpp).
+//
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "dvr_rng.hpp"
+#include "known_tuples.hpp"
+#include "get_seq.hpp"
+
+#ifndef GET_SEQ_WIDTH
+	#define GET_SEQ_WIDTH 64
+#endif
+#define DVR_RNG_PARAMS_(w) DVR_RNG##w
+#define DVR_RNG_PARAMS(w) DVR_RNG_PARAMS_(w)
+
+static void usage(const char *prog) {
+	fprintf(
+		stderr,
+		"Synopsis: %s [--skip <numOutputs>] [-j <numThreads>] [--tuple <index>|<n,r,t,k,s>]\n"
+		"          [--seed <bits>] [--list]\n",
+		prog
+	);
+}
+
+template<const dvr_rng_params &P>
+static int getSeq(int argc, char *argv[]) {
+	static_assert(P.n >= P.r && P.n - P.r <= P.r * P.k, "Not a valid generator");
+	rng_tuple_t tuple = {P.n, P.r, P.t, P.k, P.s};
+	bool custom = false;
+	const char *seedArg = NULL;
+	std::string seed;
+	uint64_t skip = 0;
+	unsigned numThreads = 1;
+	int i;
+
+	for ( i = 1; i < argc; i++ ) {
+		if ( !strcmp(argv[i], "--skip") && i + 1 < argc ) {
+			skip = strtoull(argv[++i], NULL, 0);
+		} else if ( !strcmp(argv[i], "-j") && i + 1 < argc ) {
+			numThreads = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if ( !strcmp(argv[i], "--tuple") && i + 1 < argc ) {
+			if ( !ParseTuple(argv[++i], &tuple) ) {
+				fprintf(stderr, "Invalid tuple: %s\n", argv[i]);
+				return 1;
+			}
+			custom = true;
+		} else if ( !strcmp(argv[i], "--seed") && i + 1 < argc ) {
+			seedArg = argv[++i];
+		} else if ( !strcmp(argv[i], "--list") ) {
+			for ( unsigned j = 0; j < g_cKnownTuples; j++ ) {
+				const rng_tuple_t &k = g_aKnownTuples[j];
+				printf("%2u: %d,%d,%d,%d,%x\n", j, k.n, k.r, k.t, k.k, k.s);
+			}
+			return 0;
+		} else {
+			break;
+		}
+	}
+	if ( i != argc || !numThreads ) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// The seed is given MSB first, like the VHDL's SEED generic
+	if ( seedArg ) {
+		seed = seedArg;
+	} else if ( custom ) {
+		seed.assign(tuple.n, '1');
+	} else {
+		seed = P.seed;
+	}
+	if ( seed.size() != (size_t)tuple.n || seed.find_first_not_of("01") != std::string::npos ) {
+		fprintf(stderr, "The seed must be %d bits, given as 0s and 1s\n", tuple.n);
+		return 1;
+	}
+
+	try {
+		// Seed RNG, using the reference model
+		const rng g(tuple.n, tuple.r, tuple.t, tuple.k, tuple.s);
+		rng_fast f(g);
+		f.Load(SeedState(g, seed.c_str()));
+		const rng_jump jump(g);
+		if ( skip ) {
+			jump.Skip(f, skip);
+		}
+
+		// Get an endless stream of pseudorandom longwords, with the output packing specialised on
+		// the width this tool was built for, unless --tuple chose another
+		if ( tuple.r == P.r ) {
+			seq_writer<P.r> w(g, numThreads, stdout);
+			return w.Run(f, jump) ? 2 : 0;
+		}
+		seq_writer<> w(g, numThreads, stdout);
+		return w.Run(f, jump) ? 2 : 0;
+	}
+	catch ( const std::runtime_error &e ) {
+		fprintf(stderr, "%s\n", e.what());
+		return 3;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	return getSeq<DVR_RNG_PARAMS(GET_SEQ_WIDTH)>(argc, argv);
+}
@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// The output stage shared by the get_seq tools. The stream is cut into fixed-size chunks, which a
+// number of threads generate round-robin: each thread starts by jumping ahead to its first chunk,
+// and after generating a chunk and waiting its turn to write it, jumps over the chunks the other
+// threads are doing. So the bytes written are the same whatever the number of threads.
+//
+// R is passed on to rng_fast::Generate(): if nonzero, it must be the generator's r.
+//
+#ifndef GET_SEQ_HPP
+#define GET_SEQ_HPP
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "rng_jump.hpp"
+
+template<int R = 0>
+class seq_writer {
+	static const size_t CHUNK = 1 << 18;  // outputs per chunk
+
+	const size_t longs_;       // 32-bit longwords per output
+	const unsigned numThreads_;
+	FILE *const out_;
+	std::mutex lock_;
+	std::condition_variable turn_;
+	uint64_t nextChunk_;       // the chunk whose turn it is to be written
+	bool failed_;
+
+	void worker(rng_fast f, uint64_t first, const std::vector<uint64_t> *gap) {
+		std::vector<uint32_t> buf(CHUNK * longs_);
+		for ( uint64_t k = first; ; k += numThreads_ ) {
+			f.template Generate<R>(buf.data(), CHUNK);
+			{
+				std::unique_lock<std::mutex> l(lock_);
+				turn_.wait(l, [&]{ return failed_ || nextChunk_ == k; });
+				if ( failed_ ) {
+					return;
+				}
+			}
+
+			// Nobody else writes until nextChunk_ moves on
+			const bool ok = fwrite(buf.data(), 4 * longs_, CHUNK, out_) == CHUNK;
+			{
+				std::lock_guard<std::mutex> l(lock_);
+				nextChunk_++;
+				failed_ = failed_ || !ok;
+			}
+			turn_.notify_all();
+			if ( !ok ) {
+				return;
+			}
+			if ( gap ) {
+				f.Apply(*gap);
+			}
+		}
+	}
+
+public:
+	seq_writer(const rng &g, unsigned numThreads, FILE *out)
+		: longs_((g.r + 31) / 32), numThreads_(numThreads), out_(out), nextChunk_(0), failed_(false)
+	{ }
+
+	// Write the outputs of an engine, from its current state on, until writing fails. Returns
+	// nonzero when it does.
+	int Run(const rng_fast &start, const rng_jump &jump) {
+		if ( numThreads_ < 2 ) {
+			worker(start, 0, NULL);
+		} else {
+			const std::vector<uint64_t> gap = jump.Power((uint64_t)(numThreads_ - 1) * CHUNK);
+			std::vector<std::thread> threads;
+			for ( unsigned i = 0; i < numThreads_; i++ ) {
+				rng_fast f(start);
+				jump.Skip(f, (uint64_t)i * CHUNK);
+				threads.emplace_back(&seq_writer::worker, this, f, (uint64_t)i, &gap);
+			}
+			for ( std::thread &t : threads ) {
+				t.join();
+			}
+		}
+		return failed_ ? -1 : 0;
+	}
+};
+
+#endif
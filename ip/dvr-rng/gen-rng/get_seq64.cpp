@@ -1,69 +0,0 @@
-//
-// Copyright (C) 2014, 2017 Chris McClelland
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
-// and associated documentation files (the "Software"), to deal in the Software without
-// restriction, including without limitation the rights to use, copy, modify, merge, publish,
-// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
-// Software is furnished to do so, subject to the following conditions:
-//
-// The above copyright  notice and this permission notice  shall be included in all copies or
-// substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
-// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
-// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
-// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
-//
-#include <cstdlib>
-#include <cstdio>
-#include <vector>
-#include "rng.hpp"
-
-using namespace std;
-
-#define EXPLICIT_SEED
-
-int main(int argc, char *argv[]) {
-	#ifdef EXPLICIT_SEED
-		const char *seed = "11111001100110001001100001101110011000101001101010110011001110101110110000111110000000001101101100010101100100000100110000000111100100000010000000001100011110000011001110000100100111111001001100001111010001011001001000011010111000000101011000000011100110010110110110001110000011111011110000100011110011010110010100111010110100010101110001111001110101101011010001100111011110101010011111101111101100011001110000110101000001001101001011111011000010100100001010001010000001010011000011001110101100000111000111101011010111100110010101111011011000010101001000110101000000000111011110101111101111100101011110010111001001100001110111010000011101000010011111100100100001011010101011010011101100010110000001110110100111110111001111010111000001010100000101111010100111101001111001010101011111101101101011100001111011011011100001111011110101010000111011110011010011101001100001010000110101100011001110110111001001001001101100111101010111000100010111010101100011110111101011110110111100010100000100111000101000011111110010010101110110010110110000010010111101011010111010011010000010100011100111110100110001001111011101001101101010011000011010000010010110010100111001101101101001100010111010111011100010110011111010011100110000111010010000010011111101011111100001011001000010001001010100110001001000110001001001101101011101100110111111000011010011011111101000101011100110100101000101010111011011100001110111100011100010000011000110000111111011111000011100111110011110010010110101111101110111110010000001101101101000100011110101001000000000010010000110101111100100110001011001111001111101101101011101101001111000001000100011010010011111011000100100011101000000100010000010011011110100100111001001110000100010110000001010000001011011011111011010001100010101100000000010011101111001011110011000001000001000001001110100001100100111000100110010101010011100000001110010110011111010110110011111010000010100011110101010100011101001101011011111111110101110010001011100011000010000101100000101001010101110101011100010010101001011110101110001111000110100000110101100111101";
-	#endif
-	const int n = 2048, r = 64, t = 3, maxt = 32;
-	const uint32_t s = 0x5f81cb;
-	rng g(n, r, t, maxt, s);
-	vector<int> state(g.n, 1);
-	pair<vector<int>, int> out;
-	int i, j;
-	uint32_t lw[2];
-
-	// Seed RNG
-	i = g.n - 1;
-	while ( i >= 0 ) {
-		#ifdef EXPLICIT_SEED
-			out = g.Step(state, 1, seed[i] - '0');
-		#else
-			out = g.Step(state, 1, rand() % 2);
-		#endif
-		i--;
-	}
-
-	// Get an endless stream of pseudorandom longwords
-	for ( ; ; ) {
-		for ( j = 0; j < 2; j++ ) {
-			lw[j] = 0;
-			i = 31;
-			while ( i >= 0 ) {
-				lw[j] <<= 1;
-				if ( out.first[j*32+i] == 1 ) {
-					lw[j] |= 1;
-				}
-				i--;
-			}
-		}
-		fwrite(lw, 8, 1, stdout);
-		//printf("%08X%08X\n", lw[1], lw[0]);
-		out = g.Step(state, 0, 0);
-	}
-	return 0;
-}
@@ -1,69 +0,0 @@
-//
-// Copyright (C) 2014, 2017 Chris McClelland
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
-// and associated documentation files (the "Software"), to deal in the Software without
-// restriction, including without limitation the rights to use, copy, modify, merge, publish,
-// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
-// Software is furnished to do so, subject to the following conditions:
-//
-// The above copyright  notice and this permission notice  shall be included in all copies or
-// substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
-// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
-// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
-// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
-//
-#include <cstdlib>
-#include <cstdio>
-#include <vector>
-#include "rng.hpp"
-
-using namespace std;
-
-#define EXPLICIT_SEED
-
-int main(int argc, char *argv[]) {
-	#ifdef EXPLICIT_SEED
-		const char *seed = "001011101111110100101011011011010011000000101001011000000011000101100011100101001100110101110100111000100111010110101100011001100010011111110011100110101010001000110100111111001001100101100101001101100001000001000101100010000001110110100010110100101100000011101001001010100010100011001011010001001001010011101101001001111000011101111111000010011111001101011001000000001001000011000011000000011000100001101101001100000010101110110100001000110110000011111100000000000101000010101111111111100010010000101101101001000001110000011010000000010100100001110001100111001101001000011111001110000111101010000101011001111111111100011110110101100011000100001010100100001100011101100011101010000010100011110010111011000101001010001111010010000000010111011000111001100000100001010101001111110000110000010000111010010100110011011011001111110000011001010110001001101000111001100001101011000001010111110010010111011011001111111100010010010010011101011000011111001010000001011010001100010000101101100111001101110101000010100100100111111001100110001001100001101110011000101001101010110011001110101110110000111110000000001101101100010101100100000100110000000111100100000010000000001100011110000011001110000100100111111001001100001111010001011001001000011010111000000101011000000011100110010110110110001110000011111011110000100011110011010110010100111010110100010101110001111001110101101011010001100111011110101010011111101111101100011001110000110101000001001101001011111011000010100100001010001010000001010011000011001110101100000111000111101011010111100110010101111011011000010101001000110101000000000111011110101111101111100101011110010111001001100001110111010000011101000010011111100100100001011010101011010011101100010110000001110110100111110111001111010111000001010100000101111010100111101001111001010101011111101101101011100001111011011011100001111011110101010000111011110011010011101001100001010000110101100011001110110111001001001001101100111101010111000100010111010101100011110111101011110110111100010100000100111000101000011111110010010101110110010110110000010010111101011010111010011010000010100011100111110100110001001111011101001101101010011000011010000010010110010100111001101101101001100010111010111011100010110011111010011100110000111010010000010011111101011111100001011001000010001001010100110001001000110001001001101101011101100110111111000011010011011111101000101011100110100101000101010111011011100001110111100011100010000011000110000111111011111000011100111110011110010010110101111101110111110010000001101101101000100011110101001000000000010010000110101111100100110001011001111001111101101101011101101001111000001000100011010010011111011000100100011101000000100010000010011011110100100111001001110000100010110000001010000001011011011111011010001100010101100000000010011101111001011110011000001000001000001001110100001100100111000100110010101010011100000001110010110011111010110110011111010000010100011110101010100011101001101011011111111110101110010001011100011000010000101100000101001010101110101011100010010101001011110101110001111000110100000110101100111101";
-	#endif
-	const int n = 3060, r = 96, t = 3, maxt = 32;
-	const uint32_t s = 0x79e56;
-	rng g(n, r, t, maxt, s);
-	vector<int> state(g.n, 1);
-	pair<vector<int>, int> out;
-	int i, j;
-	uint32_t lw[3];
-
-	// Seed RNG
-	i = g.n - 1;
-	while ( i >= 0 ) {
-		#ifdef EXPLICIT_SEED
-			out = g.Step(state, 1, seed[i] - '0');
-		#else
-			out = g.Step(state, 1, rand() % 2);
-		#endif
-		i--;
-	}
-
-	// Get an endless stream of pseudorandom longwords
-	for ( ; ; ) {
-		for ( j = 0; j < 3; j++ ) {
-			lw[j] = 0;
-			i = 31;
-			while ( i >= 0 ) {
-				lw[j] <<= 1;
-				if ( out.first[j*32+i] == 1 ) {
-					lw[j] |= 1;
-				}
-				i--;
-			}
-		}
-		fwrite(lw, 12, 1, stdout);
-		//printf("%08X%08X%08X\n", lw[2], lw[1], lw[0]);
-		out = g.Step(state, 0, 0);
-	}
-	return 0;
-}
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// The (n,r,t,k,s) tuples of the known-good generators. write_vhdl generates all of them by default,
+// and the get_seq tools can be asked for any of them with --tuple.
+//
+#ifndef KNOWN_TUPLES_HPP
+#define KNOWN_TUPLES_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct rng_tuple_t
+{
+	int n,r,t,k;
+	uint32_t s;
+};
+
+static const rng_tuple_t g_aKnownTuples[]={
+	{1024 , 32 , 3 , 32 ,  0x1a5eb},
+	{1024 , 32 , 4 , 32 ,  0x1562cd6},
+	{1024 , 32 , 5 , 32 ,  0x1c48},
+	{1024 , 32 , 6 , 32 ,  0x2999b26},
+	{1280 , 40 , 3 , 32 ,  0xc51b5},
+	{1280 , 40 , 4 , 32 ,  0x4ffa6a},
+	{1280 , 40 , 5 , 32 ,  0x3453f},
+	{1280 , 40 , 6 , 32 ,  0x171013},
+	{1536 , 48 , 3 , 32 ,  0x76010},
+	{1536 , 48 , 4 , 32 ,  0xc2dc4a},
+	{1536 , 48 , 5 , 32 ,  0x4b2be0},
+	{1536 , 48 , 6 , 32 ,  0x811a15},
+	{1788 , 56 , 3 , 32 ,  0xa2aae},
+	{1788 , 56 , 4 , 32 ,  0x23f5fd},
+	{1788 , 56 , 5 , 32 ,  0x1dde4b},
+	{1788 , 56 , 6 , 32 ,  0x129b8},
+	{2048 , 64 , 3 , 32 ,  0x5f81cb},
+	{2048 , 64 , 4 , 32 ,  0x456881},
+	{2048 , 64 , 5 , 32 ,  0xbfbaac},
+	{2048 , 64 , 6 , 32 ,  0x21955e},
+	{2556 , 80 , 3 , 32 ,  0x276868},
+	{2556 , 80 , 4 , 32 ,  0x2695b0},
+	{2556 , 80 , 5 , 32 ,  0x2d51a0},
+	{2556 , 80 , 6 , 32 ,  0x4450c5},
+	{3060 , 96 , 3 , 32 ,  0x79e56},
+	{3060 , 96 , 4 , 32 ,  0x9a7cd},
+	{3060 , 96 , 5 , 32 ,  0x41a62},
+	{3060 , 96 , 6 , 32 ,  0x1603e},
+	{3540 , 112 , 3 , 32 ,  0x29108e},
+	{3540 , 112 , 4 , 32 ,  0x27ec7c},
+	{3540 , 112 , 5 , 32 ,  0x2e1e55},
+	{3540 , 112 , 6 , 32 ,  0x3dac0a},
+	{3900 , 128 , 3 , 32 ,  0x10023},
+	{3900 , 128 , 4 , 32 ,  0x197bf8},
+	{3900 , 128 , 5 , 32 ,  0xcc71},
+	{3900 , 128 , 6 , 32 ,  0x14959e},
+	{5064 , 160 , 3 , 32 ,  0x1aedee},
+	{5064 , 160 , 4 , 32 ,  0x1a23b0},
+	{5064 , 160 , 5 , 32 ,  0x1aaf88},
+	{5064 , 160 , 6 , 32 ,  0x1f6302},
+	{5064 , 192 , 3 , 32 ,  0x48a92},
+	{5064 , 192 , 4 , 32 ,  0x439d3},
+	{5064 , 192 , 5 , 32 ,  0x4637},
+	{5064 , 192 , 6 , 32 ,  0x577ce},
+	{6120 , 224 , 3 , 32 ,  0x23585f},
+	{6120 , 224 , 4 , 32 ,  0x25e3a1},
+	{6120 , 224 , 5 , 32 ,  0x270f3f},
+	{6120 , 224 , 6 , 32 ,  0x259047},
+	{8033 , 256 , 3 , 32 ,  0x437c26},
+	{8033 , 256 , 4 , 32 ,  0x439995},
+	{8033 , 256 , 5 , 32 ,  0x43664f},
+	{8033 , 256 , 6 , 32 ,  0x427ba2},
+	{11213 , 384 , 3 , 32 ,  0x11d4d},
+	{11213 , 384 , 4 , 32 ,  0x23dd1},
+	{11213 , 384 , 5 , 32 ,  0x257a8},
+	{11213 , 384 , 6 , 32 ,  0x17bd8},
+	{19937 , 624 , 3 , 32 ,  0xda8},
+	{19937 , 624 , 4 , 32 ,  0xb433}
+};
+static const unsigned g_cKnownTuples=sizeof(g_aKnownTuples)/sizeof(g_aKnownTuples[0]);
+
+// Parse a tuple given on the command line: either an index into g_aKnownTuples, or n,r,t,k,s (with
+// s in hex, as write_vhdl has always taken it)
+static bool ParseTuple(const char *arg, rng_tuple_t *tuple) {
+	if ( strchr(arg, ',') ) {
+		if ( sscanf(arg, "%d,%d,%d,%d,%x", &tuple->n, &tuple->r, &tuple->t, &tuple->k, &tuple->s) != 5 ) {
+			return false;
+		}
+	} else {
+		char *end;
+		const unsigned long i = strtoul(arg, &end, 0);
+		if ( *end || i >= g_cKnownTuples ) {
+			return false;
+		}
+		*tuple = g_aKnownTuples[i];
+	}
+
+	// The rng constructor would never finish if the FIFOs couldn't hold the other n-r bits
+	return tuple->r > 0 && tuple->t > 0 && tuple->k > 0 && tuple->n >= tuple->r &&
+		tuple->n - tuple->r <= tuple->r * tuple->k;
+}
+
+#endif
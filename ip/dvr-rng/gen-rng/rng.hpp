@@ -16,6 +16,9 @@
 // DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
+#ifndef RNG_HPP
+#define RNG_HPP
+
 #include <cstdint>
 #include <vector>
 #include <set>
@@ -23,23 +26,25 @@
 
 struct rng{	
 	static int LCG(uint32_t &s) // Simple LCG RNG
-	{ return (s=1664525UL*s+1013904223UL)>>16; }
+	{ return (int)((s=(uint32_t)(1664525UL*s+1013904223UL))>>16); }
 
 	static void Permute(uint32_t &s, std::vector<int> &p)
-	{ for(int j=p.size();j>1;j--) std::swap(p[j-1],p[LCG(s)%j]); }
+	{ for(int j=(int)p.size();j>1;j--) std::swap(p[j-1],p[LCG(s)%j]); }
 	
 	int n, r, t, maxk;			// rng parameters
 	uint32_t s;		// Seed for generator
-	std::vector<std::set<int> > taps;	// connections
+	std::vector<int> tapOff;	// connections of bit i are tapIdx[tapOff[i]..tapOff[i+1]-1]
+	std::vector<int> tapIdx;	// ...in ascending order
 	std::vector<int> cycle;	// cycle through bits
 	std::vector<int> perm;	// output permutation	
 	int seedTap;			// Entry point to cycle
 
 	rng(int _n, int _r, int _t, int _maxk, uint32_t _s)
 		: n(_n), r(_r), t(_t), maxk(_maxk), s(_s)
-		, taps(n), cycle(n), perm(r), seedTap(0)
+		, tapOff(n+1), cycle(n), perm(r), seedTap(0)
 	{  // Construct an rng using (n,r,t,maxk,s) tuple			
 		std::vector<int> outputs(r), len(r,0);    int bit;
+		std::vector<std::set<int> > taps(n);	// connections, while building
 		
 		// 1: Create cycle through bits for seed loading
 		for(int i=0;i<r;i++){ cycle[i]=perm[i]=(i+1)%r; }
@@ -63,7 +68,17 @@ struct rng{
 		}}
 		
 		Permute(_s, perm); // 5: Output permutation
+		
+		for(int i=0;i<n;i++){ // 6: Flatten connections (CSR)
+			tapOff[i]=(int)tapIdx.size();
+			tapIdx.insert(tapIdx.end(), taps[i].begin(), taps[i].end());
+		}
+		tapOff[n]=(int)tapIdx.size();
 	}
+	
+	int TapCount(int i) const { return tapOff[i+1]-tapOff[i]; }
+	const int *TapsBegin(int i) const { return &tapIdx[0]+tapOff[i]; }
+	const int *TapsEnd(int i) const { return &tapIdx[0]+tapOff[i+1]; }
 
 	void PrintConnections() const
 	{  // Dump transition function in "C" format
@@ -73,8 +88,8 @@ struct rng{
 			else printf("ns[%u]=m?cs[%u]:(0",i,cycle[i]);
 			
 			// Create XOR tree for RNG mode
-			std::set<int>::iterator it=taps[i].begin();
-			while(it!=taps[i].end()) printf("^cs[%u]",*it++);
+			for(const int *it=TapsBegin(i);it!=TapsEnd(i);it++)
+				printf("^cs[%u]",*it);
 			printf(");\n");
 		}
 		printf("s_out=cs[%u];\n", cycle[seedTap]);
@@ -90,8 +105,8 @@ struct rng{
 			
 		for(int i=0;i<n;i++){ // Do XOR tree and FIFOs
 			if(m==0){ // RNG mode
-				std::set<int>::iterator it=taps[i].begin();
-				while(it!=taps[i].end()) ns[i] ^= cs[*it++];
+				for(int j=tapOff[i];j<tapOff[i+1];j++)
+					ns[i] ^= cs[tapIdx[j]];
 			}else{ // load mode 
 				ns[i]= (i==seedTap) ? s_in : cs[cycle[i]];		
 		}  }
@@ -104,3 +119,5 @@ struct rng{
 		return std::make_pair(ro,s_out);
 	}
 };
+
+#endif
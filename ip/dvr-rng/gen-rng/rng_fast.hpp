@@ -0,0 +1,249 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Fast RNG-mode engine for an rng, bit-exact with rng::Step(), which remains the reference model.
+//
+// Only the first r bits of the state (the XOR trees) do any real work: each of the other n-r bits
+// is one stage of a shift register fed by one of them. So the engine just keeps a short history of
+// each XOR tree's output, as a ring of bits packed into 64-bit words, and reads a FIFO bit out of
+// it by which tree feeds it and how many cycles ago. The taps and the output permutation are
+// compiled into flat arrays of those locations when the engine is constructed, and nothing is
+// allocated per step.
+//
+// The history is bit-sliced in time, which is where the speed comes from: the shortest path from
+// one XOR tree back to itself is the shortest FIFO plus one, so that many consecutive cycles of
+// every tree can be computed at once with one 64-bit XOR per tap. The outputs are then transposed
+// back into cycle order 64 cycles at a time.
+//
+#ifndef RNG_FAST_HPP
+#define RNG_FAST_HPP
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "rng.hpp"
+
+class rng_fast {
+	struct loc_t {
+		uint32_t tree;  // which XOR tree
+		uint32_t lag;   // how many cycles ago
+	};
+
+	int n_, r_, longs_;              // longs_ is the number of 32-bit longwords in each output
+	uint32_t block_;                 // how many cycles can be computed at once
+	uint32_t maxLag_;                // the longest FIFO
+	uint32_t ringWords_;             // history words per XOR tree (a power of two)
+	uint64_t ringMask_;              // history bits per XOR tree - 1
+	uint64_t now_;                   // the latest cycle computed
+	uint64_t next_;                  // the cycle whose output is next to be returned
+	std::vector<loc_t> where_;       // where each state bit lives in the history
+	std::vector<uint32_t> tapOff_;   // taps of XOR tree i are taps_[tapOff_[i]..tapOff_[i+1]-1]
+	std::vector<loc_t> taps_;
+	std::vector<uint32_t> perm_;     // output permutation: these are all XOR trees
+	std::vector<uint64_t> hist_;     // tree i's history is hist_[i*ringWords_..(i+1)*ringWords_-1]
+
+	static uint64_t lowBits(uint32_t len) { return (len == 64) ? ~0ULL : (1ULL << len) - 1; }
+
+	// Get len <= 64 consecutive cycles of a tree's output, starting at the given cycle
+	uint64_t get(uint32_t tree, uint64_t cycle, uint32_t len) const {
+		const uint64_t *ring = &hist_[(size_t)tree * ringWords_];
+		const uint64_t pos = cycle & ringMask_;
+		const uint32_t w = (uint32_t)(pos / 64), s = (uint32_t)(pos % 64);
+		uint64_t bits = ring[w] >> s;
+		if ( s + len > 64 ) {
+			bits |= ring[(w + 1) & (ringWords_ - 1)] << (64 - s);
+		}
+		return bits & lowBits(len);
+	}
+
+	// Set len <= 64 consecutive cycles of a tree's output, starting at the given cycle
+	void put(uint32_t tree, uint64_t cycle, uint64_t bits, uint32_t len) {
+		uint64_t *ring = &hist_[(size_t)tree * ringWords_];
+		const uint64_t pos = cycle & ringMask_, mask = lowBits(len);
+		const uint32_t w = (uint32_t)(pos / 64), s = (uint32_t)(pos % 64);
+		ring[w] = (ring[w] & ~(mask << s)) | (bits << s);
+		if ( s + len > 64 ) {
+			uint64_t &hi = ring[(w + 1) & (ringWords_ - 1)];
+			hi = (hi & ~(mask >> (64 - s))) | (bits >> (64 - s));
+		}
+	}
+
+	// Compute cycles now_+1..now_+len, for len <= block_
+	void advance(uint32_t len) {
+		for ( int i = 0; i < r_; i++ ) {
+			const loc_t *t = taps_.data() + tapOff_[i];
+			const loc_t *const end = taps_.data() + tapOff_[i + 1];
+			uint64_t bits = 0;
+			while ( t != end ) {
+				bits ^= get(t->tree, now_ - t->lag, len);
+				t++;
+			}
+			put((uint32_t)i, now_ + 1, bits, len);
+		}
+		now_ += len;
+	}
+
+	// Transpose a 64x64 bit matrix, so bit j of a[i] moves to bit i of a[j]
+	static void transpose(uint64_t *a) {
+		uint64_t m = 0x00000000FFFFFFFFULL;
+		for ( uint32_t j = 32; j != 0; j >>= 1, m ^= m << j ) {
+			for ( uint32_t k = 0; k < 64; k = ((k | j) + 1) & ~j ) {
+				const uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+				a[k | j] ^= t;
+				a[k] ^= t << j;
+			}
+		}
+	}
+
+public:
+	explicit rng_fast(const rng &g)
+		: n_(g.n), r_(g.r), longs_((g.r + 31) / 32), block_(64), maxLag_(0), ringWords_(1),
+		  ringMask_(0), now_(0), next_(0), where_(g.n), tapOff_(g.r + 1),
+		  perm_(g.perm.begin(), g.perm.end())
+	{
+		// Each FIFO bit i takes its value from cycle[i], which (because bits are inserted into each
+		// FIFO at its input end) is either an XOR tree or an earlier FIFO bit
+		for ( int i = 0; i < n_; i++ ) {
+			if ( i < r_ ) {
+				where_[i].tree = (uint32_t)i;
+				where_[i].lag = 0;
+			} else {
+				where_[i] = where_[g.cycle[i]];
+				where_[i].lag++;
+				maxLag_ = std::max(maxLag_, where_[i].lag);
+			}
+		}
+
+		// Cycle c of a tree depends on cycle c-lag-1 of each of its taps
+		for ( int i = 0; i < r_; i++ ) {
+			tapOff_[i] = (uint32_t)taps_.size();
+			for ( const int *it = g.TapsBegin(i); it != g.TapsEnd(i); it++ ) {
+				const loc_t &l = where_[*it];
+				taps_.push_back(l);
+				block_ = std::min(block_, l.lag + 1);
+			}
+		}
+		tapOff_[r_] = (uint32_t)taps_.size();
+
+		// The history must reach from the oldest FIFO bit of the next output's state to 64 cycles
+		// past it
+		while ( 64 * ringWords_ < maxLag_ + 128 ) {
+			ringWords_ *= 2;
+		}
+		ringMask_ = 64 * ringWords_ - 1;
+		hist_.assign((size_t)r_ * ringWords_, 0);
+	}
+
+	int n() const { return n_; }
+	int r() const { return r_; }
+
+	// Set the state, given in rng::Step()'s representation
+	void Load(const std::vector<int> &cs) {
+		std::fill(hist_.begin(), hist_.end(), 0);
+		now_ = next_;
+		for ( int i = 0; i < n_; i++ ) {
+			put(where_[i].tree, next_ - where_[i].lag, (uint64_t)(cs[i] & 1), 1);
+		}
+	}
+
+	// Get the state, in rng::Step()'s representation
+	void Save(std::vector<int> &cs) const {
+		cs.resize(n_);
+		for ( int i = 0; i < n_; i++ ) {
+			cs[i] = (int)get(where_[i].tree, next_ - where_[i].lag, 1);
+		}
+	}
+
+	// Replace the state S with c(A)S, where A is one RNG-mode cycle and c is a polynomial over GF(2)
+	// whose coefficient of x^k is bit k of c. That's the XOR of the states k cycles on from now, for
+	// each k whose coefficient is set; since a state bit is just some tree's output some cycles ago,
+	// each new state bit is the parity of c ANDed with a stretch of that tree's history. This is what
+	// jumping ahead is built on (see rng_jump.hpp): it costs about n*c.size() word operations.
+	void Apply(const std::vector<uint64_t> &c) {
+		const size_t cw = c.size(), sw = (64*cw + maxLag_ + 63) / 64 + 1;
+		const uint64_t base = next_ - maxLag_;
+		std::vector<uint64_t> streams((size_t)r_ * sw);
+		std::vector<int> cs(n_);
+
+		// Record each tree's history from the oldest bit of the current state onwards
+		for ( size_t w = 0; w < sw; w++ ) {
+			const uint64_t last = base + 64*w + 63;
+			while ( now_ < last ) {
+				advance((uint32_t)std::min<uint64_t>(block_, last - now_));
+			}
+			for ( int i = 0; i < r_; i++ ) {
+				streams[i*sw + w] = get((uint32_t)i, base + 64*w, 64);
+			}
+		}
+
+		// State bit (tree, lag) k cycles on from now is bit maxLag_-lag+k of that tree's stream
+		for ( int i = 0; i < n_; i++ ) {
+			const uint64_t *st = &streams[where_[i].tree * sw];
+			const uint32_t off = maxLag_ - where_[i].lag, q = off / 64, s = off % 64;
+			uint64_t acc = 0;
+			for ( size_t w = 0; w < cw; w++ ) {
+				uint64_t bits = st[q + w] >> s;
+				if ( s ) {
+					bits |= st[q + w + 1] << (64 - s);
+				}
+				acc ^= bits & c[w];
+			}
+			cs[i] = (int)(std::bitset<64>(acc).count() & 1);
+		}
+		Load(cs);
+	}
+
+	// Get the output ro[0:r-1] of the current state, then advance it one cycle in RNG mode, count
+	// times. Each output is packed LSB-first into (r+31)/32 longwords, the same as the get_seq
+	// tools write it. Note that rng::Step() returns the output of the state *after* the step.
+	//
+	// If R is nonzero, it must be r(): the output width is then a compile-time constant, so the
+	// packing loops have fixed bounds, and the compiler can unroll them and drop the tests for a
+	// partial last word.
+	template<int R = 0>
+	void Generate(uint32_t *ro, size_t count) {
+		const int r = R ? R : r_, longs = R ? (R + 31) / 32 : longs_;
+		uint64_t a[64];
+		while ( count ) {
+			const uint32_t num = (count < 64) ? (uint32_t)count : 64;
+			while ( now_ < next_ + num ) {
+				advance((uint32_t)std::min<uint64_t>(block_, next_ + num - now_));
+			}
+			for ( int g = 0; g < r; g += 64 ) {
+				for ( int j = 0; j < 64; j++ ) {
+					a[j] = (g + j < r) ? get(perm_[g + j], next_, num) : 0;
+				}
+				transpose(a);
+				const int lo = g / 32, hi = lo + 1;
+				for ( uint32_t k = 0; k < num; k++ ) {
+					ro[k * longs + lo] = (uint32_t)a[k];
+					if ( hi < longs ) {
+						ro[k * longs + hi] = (uint32_t)(a[k] >> 32);
+					}
+				}
+			}
+			ro += (size_t)num * longs;
+			next_ += num;
+			count -= num;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,181 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Jump-ahead for an rng. In RNG mode one cycle is a linear map A on the n-bit state over GF(2), so
+// advancing count cycles is multiplying by A^count. Rather than square n*n bit matrices, this finds
+// A's characteristic polynomial P once (with Berlekamp-Massey, from 2n cycles of output), since
+// then A^count = (x^count mod P)(A), and the polynomial is found by repeated squaring in O(log count)
+// multiplications mod P. rng_fast::Apply() then evaluates it on the state.
+//
+// This relies on P being irreducible, which it is for a maximal-length generator, so that any
+// output sequence's minimal polynomial is P itself: the constructor throws if it has degree < n.
+//
+#ifndef RNG_JUMP_HPP
+#define RNG_JUMP_HPP
+
+#include <bitset>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "rng_fast.hpp"
+
+class rng_jump {
+	typedef std::vector<uint64_t> poly_t;  // bit k is the coefficient of x^k
+
+	int n_;
+	poly_t poly_;  // the characteristic polynomial (monic, degree n)
+
+	static int bit(const poly_t &p, size_t k) {
+		return (k / 64 < p.size()) ? (int)(p[k / 64] >> (k % 64)) & 1 : 0;
+	}
+
+	// dst ^= src * x^shift
+	static void xorShifted(poly_t &dst, const poly_t &src, size_t shift) {
+		const size_t q = shift / 64, s = shift % 64;
+		for ( size_t w = 0; w < src.size() && w + q < dst.size(); w++ ) {
+			dst[w + q] ^= src[w] << s;
+			if ( s && w + q + 1 < dst.size() ) {
+				dst[w + q + 1] ^= src[w] >> (64 - s);
+			}
+		}
+	}
+
+	// dst ^= src / x^shift, dropping the bits that fall off the bottom
+	static void xorShiftedDown(poly_t &dst, const poly_t &src, size_t shift) {
+		const size_t q = shift / 64, s = shift % 64;
+		for ( size_t w = 0; w < dst.size() && w + q < src.size(); w++ ) {
+			dst[w] ^= src[w + q] >> s;
+			if ( s && w + q + 1 < src.size() ) {
+				dst[w] ^= src[w + q + 1] << (64 - s);
+			}
+		}
+	}
+
+	// Reduce p (of degree < 2n) mod P, leaving n bits
+	void reduce(poly_t &p) const {
+		for ( size_t k = 2*(size_t)n_; k-- > (size_t)n_; ) {
+			if ( bit(p, k) ) {
+				xorShifted(p, poly_, k - n_);
+			}
+		}
+		p.resize((n_ + 63) / 64);
+		if ( n_ % 64 ) {
+			p.back() &= (1ULL << (n_ % 64)) - 1;
+		}
+	}
+
+	// Find the minimal polynomial of the bit sequence seq[0:2n-1], returning its degree. The
+	// connection polynomial C (seq[i] = sum of C[j]*seq[i-j], for 1 <= j <= L) is kept with C[j] at
+	// bit n-j, so each discrepancy is one AND of it with a window of the sequence.
+	int berlekampMassey(const poly_t &seq, poly_t &p) const {
+		const size_t len = 2*(size_t)n_, words = (n_ + 64) / 64 + 1;
+		poly_t padded(words + (len + 63) / 64 + 1, 0), c(words, 0), b(words, 0), t;
+		int l = 0;
+		size_t m = 1;
+		xorShifted(padded, seq, n_);  // padded bit n+i is seq[i], so seq[i-j] is at i+(n-j)
+		c[n_ / 64] = b[n_ / 64] = 1ULL << (n_ % 64);
+		for ( size_t i = 0; i < len; i++ ) {
+			uint64_t acc = 0;
+			const size_t q = i / 64, s = i % 64;
+			for ( size_t w = 0; w < words; w++ ) {
+				uint64_t win = padded[q + w] >> s;
+				if ( s ) {
+					win |= padded[q + w + 1] << (64 - s);
+				}
+				acc ^= win & c[w];
+			}
+			if ( !(std::bitset<64>(acc).count() & 1) ) {
+				m++;
+				continue;
+			}
+
+			// c -= x^m * b, which in the reversed representation is shifting b down by m bits
+			t = c;
+			xorShiftedDown(c, b, m);
+			if ( 2*(size_t)l <= i ) {
+				l = (int)(i + 1) - l;
+				b = t;
+				m = 1;
+			} else {
+				m++;
+			}
+		}
+
+		// P(x) = x^L * C(1/x), so P[k] = C[L-k], which is at bit n-L+k
+		p.assign((n_ + 64) / 64, 0);
+		for ( int k = 0; k <= l; k++ ) {
+			if ( bit(c, n_ - l + k) ) {
+				p[k / 64] |= 1ULL << (k % 64);
+			}
+		}
+		return l;
+	}
+
+public:
+	// Find the characteristic polynomial, from an arbitrary (nonzero) starting state
+	explicit rng_jump(const rng &g) : n_(g.n) {
+		rng_fast f(g);
+		std::vector<uint32_t> ro((size_t)2 * n_ * ((g.r + 31) / 32));
+		poly_t seq((2*(size_t)n_ + 63) / 64, 0);
+		f.Load(std::vector<int>(g.n, 1));
+		f.Generate(ro.data(), 2 * n_);
+		for ( size_t i = 0; i < 2*(size_t)n_; i++ ) {
+			seq[i / 64] |= (uint64_t)(ro[i * ((g.r + 31) / 32)] & 1) << (i % 64);
+		}
+		if ( berlekampMassey(seq, poly_) != n_ ) {
+			throw std::runtime_error("rng_jump: this generator isn't maximal-length");
+		}
+	}
+
+	// Get x^count mod P: the polynomial which, applied to a state, advances it count cycles
+	poly_t Power(uint64_t count) const {
+		poly_t p((n_ + 63) / 64, 0), sq;
+		int top = 63;
+		p[0] = 1;
+		while ( top >= 0 && !((count >> top) & 1) ) {
+			top--;
+		}
+		for ( ; top >= 0; top-- ) {
+			// Square: over GF(2) that just spreads the bits out
+			sq.assign(2 * p.size(), 0);
+			for ( size_t k = 0; k < (size_t)n_; k++ ) {
+				if ( bit(p, k) ) {
+					sq[2*k / 64] |= 1ULL << (2*k % 64);
+				}
+			}
+			reduce(sq);
+			p.swap(sq);
+
+			// Multiply by x
+			if ( (count >> top) & 1 ) {
+				sq.assign(p.size() + 1, 0);
+				xorShifted(sq, p, 1);
+				reduce(sq);
+				p.swap(sq);
+			}
+		}
+		return p;
+	}
+
+	// Advance an engine count cycles in RNG mode, without generating the outputs in between
+	void Skip(rng_fast &f, uint64_t count) const {
+		f.Apply(Power(count));
+	}
+};
+
+#endif
@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Compile-time models of the rng generators, for software which can't afford the rng constructor
+// at startup, or has no heap to run it in. write_hpp generates a header for each tuple, which
+// specializes rng_static for it, with the tuple's tables as constexpr arrays and its XOR network
+// unrolled into straight-line code. Each specialization has:
+//
+//   enum { n, r, words, longs, seedTap };
+//   static void Step(const uint64_t *cs, uint64_t *ns);           // one cycle in RNG mode
+//   static int Load(const uint64_t *cs, uint64_t *ns, int s_in);  // one in load mode, giving s_out
+//   static void Output(const uint64_t *cs, uint32_t *ro);         // the output of a state
+//
+// A state is the n bits of rng::Step()'s, packed LSB-first into words uint64_ts; an output is the r
+// bits of ro, packed LSB-first into longs uint32_ts, the same as the get_seq tools write it. As with
+// rng::Step(), cs and ns are the states before and after the clock edge, so they mustn't overlap.
+//
+#ifndef RNG_STATIC_HPP
+#define RNG_STATIC_HPP
+
+#include <cstdint>
+
+template<int N, int R, int T, int K, uint32_t S> struct rng_static;
+
+// Load a seed, given in VHDL order like dvr_rng.hpp's (so seed[n-1-i] is bit i), one bit per cycle
+// in load mode, starting with bit 0
+template<typename G> void SeedStatic(uint64_t *state, const char *seed) {
+	uint64_t next[G::words];
+	for ( int i = G::n - 1; i >= 0; i-- ) {
+		G::Load(state, next, seed[i] - '0');
+		for ( int w = 0; w < G::words; w++ ) {
+			state[w] = next[w];
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,189 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Write a C++ header for each of the given generators (see rng_static.hpp), so software can model
+// them with no setup at runtime. The header for rng_n2048_r64_t3_k32_s5f81cb is
+// rng_n2048_r64_t3_k32_s5f81cb.hpp, with the tables in a namespace of the same name.
+//
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "rng.hpp"
+#include "known_tuples.hpp"
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Synopsis: %s [-o <dir>] [<index>|<n,r,t,k,s> ...]\n", prog);
+	fprintf(stderr, "Writes a header for each of the given generators (default all known ones).\n");
+}
+
+// Append an array definition of the given values, sixteen to a line
+static void appendArray(
+	std::string &dst, const char *type, const char *name, const int *values, size_t count)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "\tconstexpr %s %s[%zu] = {", type, name, count);
+	dst += buf;
+	for ( size_t i = 0; i < count; i++ ) {
+		snprintf(buf, sizeof(buf), "%s%d", !i ? "\n\t\t" : (i % 16) ? ", " : ",\n\t\t", values[i]);
+		dst += buf;
+	}
+	dst += "\n\t};\n";
+}
+
+// Append the expression for bit i of a packed state or output
+static void appendBit(std::string &dst, const char *var, int i) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "(%s[%d] >> %d)", var, i / 64, i % 64);
+	dst += buf;
+}
+
+static std::string makeHeader(const std::string &name, const rng_tuple_t &c) {
+	const rng g(c.n, c.r, c.t, c.k, c.s);
+	const int words = (g.n + 63) / 64, longs = (g.r + 31) / 32;
+	const char *const type = (g.n <= 65536) ? "uint16_t" : "uint32_t";
+	std::string guard, dst;
+	char buf[256];
+	for ( size_t i = 0; i < name.size(); i++ ) {
+		guard += (char)toupper(name[i]);
+	}
+
+	snprintf(
+		buf, sizeof(buf),
+		"//\n// Generated by write_hpp for the generator (%d,%d,%d,%d,0x%x): don't edit.\n//\n",
+		c.n, c.r, c.t, c.k, c.s);
+	dst += buf;
+	dst +=
+		"// The tables are the rng constructor's: bit i is the XOR of bits TAPS[TAP_OFF[i]] to\n"
+		"// TAPS[TAP_OFF[i+1]-1] in RNG mode, and takes bit CYCLE[i] in load mode (but SEED_TAP takes\n"
+		"// s_in, and s_out is bit CYCLE[SEED_TAP]). Output i is bit PERM[i]. See rng_static.hpp.\n"
+		"//\n";
+	dst += "#ifndef " + guard + "_HPP\n#define " + guard + "_HPP\n\n";
+	dst += "#include <cstdint>\n#include \"rng_static.hpp\"\n\n";
+
+	// The tables
+	dst += "namespace " + name + " {\n";
+	snprintf(
+		buf, sizeof(buf),
+		"\tconstexpr int N = %d, R = %d, T = %d, K = %d, SEED_TAP = %d;\n\tconstexpr uint32_t S = 0x%x;\n",
+		g.n, g.r, g.t, g.maxk, g.seedTap, g.s);
+	dst += buf;
+	std::vector<int> perm(g.perm.begin(), g.perm.end());
+	appendArray(dst, type, "TAP_OFF", g.tapOff.data(), g.tapOff.size());
+	appendArray(dst, type, "TAPS", g.tapIdx.data(), g.tapIdx.size());
+	appendArray(dst, type, "CYCLE", g.cycle.data(), g.cycle.size());
+	appendArray(dst, type, "PERM", perm.data(), perm.size());
+	dst += "}\n\n";
+
+	// The model, with RNG mode and the output unrolled
+	snprintf(buf, sizeof(buf), "template<> struct rng_static<%d, %d, %d, %d, 0x%x> {\n", c.n, c.r, c.t, c.k, c.s);
+	dst += buf;
+	snprintf(
+		buf, sizeof(buf), "\tenum { n = %d, r = %d, words = %d, longs = %d, seedTap = %d };\n\n",
+		g.n, g.r, words, longs, g.seedTap);
+	dst += buf;
+	dst += "\tstatic void Step(const uint64_t *cs, uint64_t *ns) {\n";
+	for ( int w = 0; w < words; w++ ) {
+		snprintf(buf, sizeof(buf), "\t\tns[%d] =", w);
+		dst += buf;
+		for ( int i = 64*w; i < g.n && i < 64*(w + 1); i++ ) {
+			dst += (i == 64*w) ? "\n\t\t\t((" : " |\n\t\t\t((";
+			for ( const int *it = g.TapsBegin(i); it != g.TapsEnd(i); it++ ) {
+				if ( it != g.TapsBegin(i) ) {
+					dst += " ^ ";
+				}
+				appendBit(dst, "cs", *it);
+			}
+			snprintf(buf, sizeof(buf), ") & 1) << %d", i % 64);
+			dst += buf;
+		}
+		dst += ";\n";
+	}
+	dst += "\t}\n\n";
+
+	dst += "\tstatic int Load(const uint64_t *cs, uint64_t *ns, int s_in) {\n";
+	dst += "\t\tusing namespace " + name + ";\n";
+	dst +=
+		"\t\tfor ( int w = 0; w < words; w++ ) {\n"
+		"\t\t\tns[w] = 0;\n"
+		"\t\t}\n"
+		"\t\tfor ( int i = 0; i < n; i++ ) {\n"
+		"\t\t\tconst uint64_t b = (i == SEED_TAP) ? (uint64_t)(s_in & 1) : (cs[CYCLE[i] / 64] >> (CYCLE[i] % 64)) & 1;\n"
+		"\t\t\tns[i / 64] |= b << (i % 64);\n"
+		"\t\t}\n"
+		"\t\treturn (int)(cs[CYCLE[SEED_TAP] / 64] >> (CYCLE[SEED_TAP] % 64)) & 1;\n"
+		"\t}\n\n";
+
+	dst += "\tstatic void Output(const uint64_t *cs, uint32_t *ro) {\n";
+	for ( int l = 0; l < longs; l++ ) {
+		snprintf(buf, sizeof(buf), "\t\tro[%d] = (uint32_t)(", l);
+		dst += buf;
+		for ( int i = 32*l; i < g.r && i < 32*(l + 1); i++ ) {
+			dst += (i == 32*l) ? "\n\t\t\t(" : " |\n\t\t\t(";
+			appendBit(dst, "cs", g.perm[i]);
+			snprintf(buf, sizeof(buf), " & 1) << %d", i % 32);
+			dst += buf;
+		}
+		dst += ");\n";
+	}
+	dst += "\t}\n};\n\n#endif\n";
+	return dst;
+}
+
+int main(int argc, char *argv[]) {
+	std::string dir;
+	std::vector<rng_tuple_t> tuples;
+	int i;
+	for ( i = 1; i < argc && argv[i][0] == '-'; i++ ) {
+		if ( !strcmp(argv[i], "-o") && i + 1 < argc ) {
+			dir = std::string(argv[++i]) + "/";
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	for ( ; i < argc; i++ ) {
+		rng_tuple_t tuple;
+		if ( !ParseTuple(argv[i], &tuple) ) {
+			fprintf(stderr, "Invalid tuple: %s\n", argv[i]);
+			return 1;
+		}
+		tuples.push_back(tuple);
+	}
+	if ( tuples.empty() ) {
+		tuples.assign(g_aKnownTuples, g_aKnownTuples + g_cKnownTuples);
+	}
+
+	for ( const rng_tuple_t &c : tuples ) {
+		char name[64];
+		snprintf(name, sizeof(name), "rng_n%d_r%d_t%d_k%d_s%x", c.n, c.r, c.t, c.k, c.s);
+		const std::string path = dir + name + ".hpp", code = makeHeader(name, c);
+		fprintf(stderr, "Writing %s\n", path.c_str());
+		FILE *dst = fopen(path.c_str(), "wt");
+		if ( !dst ) {
+			fprintf(stderr, "Couldn't open %s\n", path.c_str());
+			return 2;
+		}
+		const bool ok = fwrite(code.data(), 1, code.size(), dst) == code.size();
+		if ( fclose(dst) || !ok ) {
+			fprintf(stderr, "Couldn't write %s\n", path.c_str());
+			return 2;
+		}
+	}
+	return 0;
+}
@@ -17,86 +17,23 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 #include <stdio.h>
+#include <stdarg.h>
 #include <set>
 #include <vector>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include <string.h>
 #include <stdlib.h>
 
 using namespace std;
 
-#include "rng.hpp"
-
-struct rng_tuple_t
-{
-	int n,r,t,k;
-	uint32_t s;
-};
-
-rng_tuple_t g_aKnownTuples[]={
-	{1024 , 32 , 3 , 32 ,  0x1a5eb},
-	{1024 , 32 , 4 , 32 ,  0x1562cd6},
-	{1024 , 32 , 5 , 32 ,  0x1c48},
-	{1024 , 32 , 6 , 32 ,  0x2999b26},
-	{1280 , 40 , 3 , 32 ,  0xc51b5},
-	{1280 , 40 , 4 , 32 ,  0x4ffa6a},
-	{1280 , 40 , 5 , 32 ,  0x3453f},
-	{1280 , 40 , 6 , 32 ,  0x171013},
-	{1536 , 48 , 3 , 32 ,  0x76010},
-	{1536 , 48 , 4 , 32 ,  0xc2dc4a},
-	{1536 , 48 , 5 , 32 ,  0x4b2be0},
-	{1536 , 48 , 6 , 32 ,  0x811a15},
-	{1788 , 56 , 3 , 32 ,  0xa2aae},
-	{1788 , 56 , 4 , 32 ,  0x23f5fd},
-	{1788 , 56 , 5 , 32 ,  0x1dde4b},
-	{1788 , 56 , 6 , 32 ,  0x129b8},
-	{2048 , 64 , 3 , 32 ,  0x5f81cb},
-	{2048 , 64 , 4 , 32 ,  0x456881},
-	{2048 , 64 , 5 , 32 ,  0xbfbaac},
-	{2048 , 64 , 6 , 32 ,  0x21955e},
-	{2556 , 80 , 3 , 32 ,  0x276868},
-	{2556 , 80 , 4 , 32 ,  0x2695b0},
-	{2556 , 80 , 5 , 32 ,  0x2d51a0},
-	{2556 , 80 , 6 , 32 ,  0x4450c5},
-	{3060 , 96 , 3 , 32 ,  0x79e56},
-	{3060 , 96 , 4 , 32 ,  0x9a7cd},
-	{3060 , 96 , 5 , 32 ,  0x41a62},
-	{3060 , 96 , 6 , 32 ,  0x1603e},
-	{3540 , 112 , 3 , 32 ,  0x29108e},
-	{3540 , 112 , 4 , 32 ,  0x27ec7c},
-	{3540 , 112 , 5 , 32 ,  0x2e1e55},
-	{3540 , 112 , 6 , 32 ,  0x3dac0a},
-	{3900 , 128 , 3 , 32 ,  0x10023},
-	{3900 , 128 , 4 , 32 ,  0x197bf8},
-	{3900 , 128 , 5 , 32 ,  0xcc71},
-	{3900 , 128 , 6 , 32 ,  0x14959e},
-	{5064 , 160 , 3 , 32 ,  0x1aedee},
-	{5064 , 160 , 4 , 32 ,  0x1a23b0},
-	{5064 , 160 , 5 , 32 ,  0x1aaf88},
-	{5064 , 160 , 6 , 32 ,  0x1f6302},
-	{5064 , 192 , 3 , 32 ,  0x48a92},
-	{5064 , 192 , 4 , 32 ,  0x439d3},
-	{5064 , 192 , 5 , 32 ,  0x4637},
-	{5064 , 192 , 6 , 32 ,  0x577ce},
-	{6120 , 224 , 3 , 32 ,  0x23585f},
-	{6120 , 224 , 4 , 32 ,  0x25e3a1},
-	{6120 , 224 , 5 , 32 ,  0x270f3f},
-	{6120 , 224 , 6 , 32 ,  0x259047},
-	{8033 , 256 , 3 , 32 ,  0x437c26},
-	{8033 , 256 , 4 , 32 ,  0x439995},
-	{8033 , 256 , 5 , 32 ,  0x43664f},
-	{8033 , 256 , 6 , 32 ,  0x427ba2},
-	{11213 , 384 , 3 , 32 ,  0x11d4d},
-	{11213 , 384 , 4 , 32 ,  0x23dd1},
-	{11213 , 384 , 5 , 32 ,  0x257a8},
-	{11213 , 384 , 6 , 32 ,  0x17bd8},
-	{19937 , 624 , 3 , 32 ,  0xda8},
-	{19937 , 624 , 4 , 32 ,  0xb433}
-};
-unsigned g_cKnownTuples=sizeof(g_aKnownTuples)/sizeof(g_aKnownTuples[0]);
+#include "dvr_rng.hpp"
+#include "rng_fast.hpp"
+#include "known_tuples.hpp"
 
 const char *fifo_template=
 "library ieee;\n"
@@ -249,7 +186,28 @@ void subst(std::string &txt, const std::string &key, const std::string &data)
 	}
 }
 
-void WriteTestBench(const std::string &name, int rout, const rng &g, FILE *dst)
+// Like sprintf, but onto the end of a string, so each file can be built up in memory and written in
+// one go
+void appendf(std::string &dst, const char *fmt, ...)
+{
+	char buf[256];
+	va_list args, again;
+	va_start(args, fmt);
+	va_copy(again, args);
+	int len=vsnprintf(buf, sizeof(buf), fmt, args);
+	if(len<(int)sizeof(buf)){
+		dst.append(buf, len);
+	}else{
+		size_t pos=dst.size();
+		dst.resize(pos+len+1);
+		vsnprintf(&dst[pos], len+1, fmt, again);
+		dst.resize(pos+len);
+	}
+	va_end(again);
+	va_end(args);
+}
+
+void WriteTestBench(const std::string &name, int rout, const rng &g, std::string &dst)
 {
 	std::string code=rng_testbench_template;
 	
@@ -265,91 +223,89 @@ void WriteTestBench(const std::string &name, int rout, const rng &g, FILE *dst)
 	subst(code, "__R__", acc.str());
 	acc.str("");
 	
-	std::vector<int> state(g.n, 1);
-	std::pair<std::vector<int>,int> out;
-	
+	// The initial state is arbitrary, but it's drawn from the tuple's own seed, so the testbench is
+	// the same every time for the same tuple
+	std::string init(g.n, '0');
+	uint32_t s=g.s;
 	for(int i=0;i<g.n;i++){
-		int x=rand()%2;
-		out = g.Step(state, 1, x);
-		acc<<x;
+		init[i]=(char)('0'+((rng::LCG(s)>>15)&1));
 	}
-	std::string tmp=acc.str();
-	std::reverse(tmp.begin(), tmp.end());
-	subst(code, "__TEST_INIT_STATE__", tmp);
-	acc.str("");
-
+	subst(code, "__TEST_INIT_STATE__", init);
+	
+	// Then 2n outputs in RNG mode, from the fast model
+	rng_fast f(g);
+	const int longs=(g.r+31)/32;
+	std::vector<uint32_t> ro((size_t)2*g.n*longs);
+	std::vector<int> state;
+	f.Load(SeedState(g, init.c_str()));
+	f.Generate(ro.data(), 2*g.n);
+	f.Save(state);
+	
+	// And what's read back from the state they leave it in
+	subst(code, "__TEST_REF_READBACK__", ReadBack(g, state));
+	
+	std::string data;
+	data.reserve((size_t)2*g.n*(rout+5));
 	for(int i=0;i<g.n*2;i++){
-		acc<<"		\"";
+		const uint32_t *out=&ro[(size_t)i*longs];
+		data+="		\"";
 		for(int j=rout-1;j>=0;j--){
-			acc<<out.first[j];	// put out in reverse order to match (R-1 downto 0) vector
+			data+=(char)('0'+((out[j/32]>>(j%32))&1));	// put out in reverse order to match (R-1 downto 0) vector
 		}
-		acc<<"\"";
+		data+="\"";
 		if ( i+1 != g.n*2 ) {
-			acc<<",";
-			acc<<"\n";
+			data+=",";
+			data+="\n";
 		}
-		out = g.Step(state, 0,0);
-	}
-	
-	subst(code, "__TEST_OUT_DATA__", acc.str());
-	acc.str("");
-	
-	for(int i=0;i<g.n;i++){
-		out=g.Step(state, 1, 1);
-		acc<<out.second;
 	}
-	tmp=acc.str();
-	std::reverse(tmp.begin(), tmp.end());
+	subst(code, "__TEST_OUT_DATA__", data);
 	
-	subst(code, "__TEST_REF_READBACK__", tmp);
-	
-	fprintf(dst, code.c_str());
+	dst+=code;
 }
 
-void WriteRng(const std::string &name, int rout, const rng &g, FILE *dst)
+void WriteRng(const std::string &name, int rout, const rng &g, std::string &dst)
 {
-	fprintf(dst, "library ieee;\nuse ieee.std_logic_1164.all;\n\n");
+	appendf(dst, "library ieee;\nuse ieee.std_logic_1164.all;\n\n");
 	
-	fprintf(dst, "entity %s is\n", name.c_str());
-	fprintf(dst, "	port (\n		clk : in std_logic;\n		ce : in std_logic;\n");
-	fprintf(dst, "		mode : in std_logic;\n		s_in : in std_logic;\n		s_out : out std_logic;\n");
-	fprintf(dst, "		rng : out std_logic_vector(%u downto 0)\n	);\n", rout-1);
-	fprintf(dst, "end entity;\n\n");
+	appendf(dst, "entity %s is\n", name.c_str());
+	appendf(dst, "	port (\n		clk : in std_logic;\n		ce : in std_logic;\n");
+	appendf(dst, "		mode : in std_logic;\n		s_in : in std_logic;\n		s_out : out std_logic;\n");
+	appendf(dst, "		rng : out std_logic_vector(%u downto 0)\n	);\n", rout-1);
+	appendf(dst, "end entity;\n\n");
 
-	fprintf(dst, "architecture rtl of %s is\n", name.c_str());
-	fprintf(dst, "	signal state:std_logic_vector(%u downto 0);\n", g.n-1);
-	fprintf(dst, "begin\n");
+	appendf(dst, "architecture rtl of %s is\n", name.c_str());
+	appendf(dst, "	signal state:std_logic_vector(%u downto 0);\n", g.n-1);
+	appendf(dst, "begin\n");
 	for(unsigned i=0;i<rout;i++)
-		fprintf(dst, "	rng(%u) <= state(%u);\n", i, g.perm[i]);
-	fprintf(dst, "	s_out <= state(%u);\n", g.cycle[g.seedTap]);
-	fprintf(dst, "	regs: process(clk)\n	begin\n");
-	fprintf(dst, "		if ( rising_edge(clk) ) then\n");
-	fprintf(dst, "			if ( ce = '1' ) then\n");
+		appendf(dst, "	rng(%u) <= state(%u);\n", i, g.perm[i]);
+	appendf(dst, "	s_out <= state(%u);\n", g.cycle[g.seedTap]);
+	appendf(dst, "	regs: process(clk)\n	begin\n");
+	appendf(dst, "		if ( rising_edge(clk) ) then\n");
+	appendf(dst, "			if ( ce = '1' ) then\n");
 	// Dump the logic bits
 	for(unsigned i=0;i<g.r;i++){
 		// First part of statement deals with cycle
 		if(i==g.seedTap)
-			fprintf(dst, "				state(%u)<=(mode and s_in) or ((not mode) and ('0'", i);
+			appendf(dst, "				state(%u)<=(mode and s_in) or ((not mode) and ('0'", i);
 		else
-			fprintf(dst, "				state(%u)<=(mode and state(%u)) or ((not mode) and ('0'",i,g.cycle[i]);
+			appendf(dst, "				state(%u)<=(mode and state(%u)) or ((not mode) and ('0'",i,g.cycle[i]);
 	
 		// Then the XOR logic
-		set<int>::iterator it=g.taps[i].begin();
-		while(it!=g.taps[i].end())
-			fprintf(dst, " xor state(%u)", *it++);
-		fprintf(dst, "));\n");
+		for(const int *it=g.TapsBegin(i);it!=g.TapsEnd(i);it++)
+			appendf(dst, " xor state(%u)", *it);
+		appendf(dst, "));\n");
 	}
 	
 	// Now the FIFO bits (if any)
 	for(unsigned i=g.r;i<g.n;i++){
-		fprintf(dst, "				state(%u)<=state(%u);\n", i, g.cycle[i]);
+		appendf(dst, "				state(%u)<=state(%u);\n", i, g.cycle[i]);
 	}
 
 	// Now close all the open contexts
-	fprintf(dst, "			end if;\n");
-	fprintf(dst, "		end if;\n");
-	fprintf(dst, "	end process;\n");
-	fprintf(dst, "end architecture;\n");
+	appendf(dst, "			end if;\n");
+	appendf(dst, "		end if;\n");
+	appendf(dst, "	end process;\n");
+	appendf(dst, "end architecture;\n");
 }
 
 struct fifo_t{
@@ -359,7 +315,7 @@ struct fifo_t{
 	int len;
 };
 
-void WriteRngV2(const std::string &name, int rout, const rng &g, FILE *dst)
+void WriteRngV2(const std::string &name, int rout, const rng &g, std::string &dst, std::string &log)
 {	
 	// outIndex -> fifo
 	std::map<int,fifo_t> fifos;
@@ -376,128 +332,323 @@ void WriteRngV2(const std::string &name, int rout, const rng &g, FILE *dst)
 		
 		fifos[fifo.outIndex] = fifo;
 		
-		fprintf(stderr, "  fifo %u: in=%u, out=%u, len=%u\n", fifo.i, fifo.inIndex, fifo.outIndex, fifo.len);
+		appendf(log, "  fifo %u: in=%u, out=%u, len=%u\n", fifo.i, fifo.inIndex, fifo.outIndex, fifo.len);
 	}
 	
 	std::string fifoEntity=fifo_template;
 	subst(fifoEntity, "__NAME__", name);
 	
-	fprintf(dst, "%s\n", fifoEntity.c_str());
+	dst+=fifoEntity;
+	dst+="\n";
 	
-	fprintf(dst, "library ieee;\nuse ieee.std_logic_1164.all;\n\n");
+	appendf(dst, "library ieee;\nuse ieee.std_logic_1164.all;\n\n");
 	
-	fprintf(dst, "entity %s is\n", name.c_str());
-	fprintf(dst, "	port(\n		clk : in std_logic;\n		ce : in std_logic;\n");
-	fprintf(dst, "		mode : in std_logic;\n		s_in : in std_logic;\n		s_out : out std_logic;\n");
-	fprintf(dst, "		rng : out std_logic_vector(%u downto 0)\n	);\n", rout-1);
-	fprintf(dst, "end entity;\n\n");
+	appendf(dst, "entity %s is\n", name.c_str());
+	appendf(dst, "	port(\n		clk : in std_logic;\n		ce : in std_logic;\n");
+	appendf(dst, "		mode : in std_logic;\n		s_in : in std_logic;\n		s_out : out std_logic;\n");
+	appendf(dst, "		rng : out std_logic_vector(%u downto 0)\n	);\n", rout-1);
+	appendf(dst, "end entity;\n\n");
 	
-	fprintf(dst, "architecture rtl of %s is\n", name.c_str());
-	fprintf(dst, "	signal fifo_out, r_out : std_logic_vector(%u downto 0);\n", g.r-1);
-	fprintf(dst, "begin\n");
+	appendf(dst, "architecture rtl of %s is\n", name.c_str());
+	appendf(dst, "	signal fifo_out, r_out : std_logic_vector(%u downto 0);\n", g.r-1);
+	appendf(dst, "begin\n");
 	for(unsigned i=0;i<rout;i++)
-		fprintf(dst, "	rng(%u) <= r_out(%u);\n", i, g.perm[i]);
-	fprintf(dst, "	s_out <= fifo_out(%u);\n", fifos[g.cycle[g.seedTap]].i);
-	fprintf(dst, "	regs: process(clk)\n	begin\n");
-	fprintf(dst, "		if ( rising_edge(clk) ) then\n");
-	fprintf(dst, "			if ( ce = '1' ) then\n");
+		appendf(dst, "	rng(%u) <= r_out(%u);\n", i, g.perm[i]);
+	appendf(dst, "	s_out <= fifo_out(%u);\n", fifos[g.cycle[g.seedTap]].i);
+	appendf(dst, "	regs: process(clk)\n	begin\n");
+	appendf(dst, "		if ( rising_edge(clk) ) then\n");
+	appendf(dst, "			if ( ce = '1' ) then\n");
 	// Dump the logic bits
 	for(unsigned i=0;i<g.r;i++){
 		// First part of statement deals with cycle
 		if(i==g.seedTap)
-			fprintf(dst, "				r_out(%u) <= (mode and s_in) or ((not mode) and ('0'", i);
+			appendf(dst, "				r_out(%u) <= (mode and s_in) or ((not mode) and ('0'", i);
 		else
-			fprintf(dst, "				r_out(%u) <= (mode and fifo_out(%u)) or ((not mode) and ('0'", i, fifos[g.cycle[i]].i);
+			appendf(dst, "				r_out(%u) <= (mode and fifo_out(%u)) or ((not mode) and ('0'", i, fifos[g.cycle[i]].i);
 	
 		// Then the XOR logic
-		set<int>::iterator it=g.taps[i].begin();
-		while(it!=g.taps[i].end())
-			fprintf(dst, " xor fifo_out(%u)", fifos[*it++].i);
-		fprintf(dst, "));\n");
+		for(const int *it=g.TapsBegin(i);it!=g.TapsEnd(i);it++)
+			appendf(dst, " xor fifo_out(%u)", fifos[*it].i);
+		appendf(dst, "));\n");
 	}
-	fprintf(dst, "			end if;\n");
-	fprintf(dst, "		end if;\n");
-	fprintf(dst, "	end process;\n");
+	appendf(dst, "			end if;\n");
+	appendf(dst, "		end if;\n");
+	appendf(dst, "	end process;\n");
 	
 	// Now hook up the FIFOs
 	for(unsigned i=0;i<g.r;i++){
 		fifo_t fifo=fifos[g.cycle[i]];
 		if(fifo.inIndex==fifo.outIndex){
-			fprintf(dst, "	fifo_out(%u) <= r_out(%u);\n", fifo.i, fifo.inIndex);
+			appendf(dst, "	fifo_out(%u) <= r_out(%u);\n", fifo.i, fifo.inIndex);
 		}else{
-			fprintf(dst, "	fifo_%u: entity work.%s_SR\n		generic map (K=>%u)\n", fifo.i, name.c_str(), fifo.len);
-			fprintf(dst, "		port map (clk=>clk, ce=>ce, din=>r_out(%u), dout=>fifo_out(%u));\n", fifo.inIndex, fifo.i);
+			appendf(dst, "	fifo_%u: entity work.%s_SR\n		generic map (K=>%u)\n", fifo.i, name.c_str(), fifo.len);
+			appendf(dst, "		port map (clk=>clk, ce=>ce, din=>r_out(%u), dout=>fifo_out(%u));\n", fifo.inIndex, fifo.i);
 		}
 	}
 	
-	fprintf(dst, "end architecture;\n");
+	appendf(dst, "end architecture;\n");
 }
 
-std::string MakeName(const rng &g)
+std::string MakeName(const rng_tuple_t &c)
 {
 	std::stringstream acc;
-	acc<<"rng_n"<<g.n<<"_r"<<g.r<<"_t"<<g.t<<"_k"<<g.maxk<<"_s"<<std::hex<<g.s;
+	acc<<"rng_n"<<c.n<<"_r"<<c.r<<"_t"<<c.t<<"_k"<<c.k<<"_s"<<std::hex<<c.s;
 	return acc.str();
 }
 
+// The files written are recorded in a cache in the output directory, with the tuple (and rout) each
+// was made from, and its size and a hash of its contents once written. A file skips regeneration if
+// its entry still matches on all three, so only new tuples, or files which have been edited since,
+// are written again. Hashing the contents rather than comparing modification times means an edit
+// can't hide inside the timestamp's resolution. CACHE_VERSION is part of every key: bump it
+// whenever the VHDL generated, or the format of the cache, changes.
+static const char *CACHE_FILE=".write_vhdl.cache";
+static const int CACHE_VERSION=2;
+
+struct cache_entry_t{
+	std::string key;
+	unsigned long long size, hash;
+};
+typedef std::map<std::string,cache_entry_t> cache_t;
+
+std::string CacheKey(const rng_tuple_t &c, int rout)
+{
+	std::stringstream acc;
+	acc<<"v"<<CACHE_VERSION<<":"<<c.n<<","<<c.r<<","<<c.t<<","<<c.k<<","<<std::hex<<c.s<<std::dec<<","<<rout;
+	return acc.str();
+}
+
+// Get the size and 64-bit FNV-1a hash of a file's contents
+bool GetStamp(const std::string &path, cache_entry_t &e)
+{
+	FILE *src=fopen(path.c_str(), "rb");
+	unsigned char buf[65536];
+	size_t num;
+	if(src==NULL)
+		return false;
+	e.size=0;
+	e.hash=0xCBF29CE484222325ULL;
+	while((num=fread(buf, 1, sizeof(buf), src))>0){
+		e.size+=num;
+		for(size_t i=0;i<num;i++)
+			e.hash=(e.hash^buf[i])*0x100000001B3ULL;
+	}
+	const bool ok=!ferror(src);
+	fclose(src);
+	return ok;
+}
+
+void LoadCache(cache_t &cache)
+{
+	FILE *src=fopen(CACHE_FILE, "rt");
+	char path[1024], key[256];
+	cache_entry_t e;
+	if(src==NULL)
+		return;
+	while(fscanf(src, "%1023s %255s %llu %llx", path, key, &e.size, &e.hash)==4){
+		e.key=key;
+		cache[path]=e;
+	}
+	fclose(src);
+}
+
+void SaveCache(const cache_t &cache)
+{
+	FILE *dst=fopen(CACHE_FILE, "wt");
+	if(dst==NULL){
+		fprintf(stderr, "Warning : couldn't write cache file '%s'.\n", CACHE_FILE);
+		return;
+	}
+	for(cache_t::const_iterator it=cache.begin();it!=cache.end();++it)
+		fprintf(dst, "%s %s %llu %016llx\n", it->first.c_str(), it->second.key.c_str(), it->second.size, it->second.hash);
+	fclose(dst);
+}
+
+bool UpToDate(const cache_t &cache, const std::string &path, const std::string &key)
+{
+	cache_t::const_iterator it=cache.find(path);
+	cache_entry_t e;
+	return it!=cache.end() && it->second.key==key && GetStamp(path, e) &&
+		e.size==it->second.size && e.hash==it->second.hash;
+}
+
+// One generator to write: its entity, and optionally its testbench
+struct job_t{
+	rng_tuple_t tuple;
+	std::string name;
+	int rout;
+	bool testBench;
+	std::vector<std::string> files;	// the files it writes
+	std::string log;	// what it has to say, printed once it's done
+	bool ok;
+};
+
+bool WriteFile(const std::string &path, const std::string &data, std::string &log)
+{
+	FILE *dst=fopen(path.c_str(), "wt");
+	if(dst==NULL){
+		log+="Error : couldn't open destination file '"+path+"'.\n";
+		return false;
+	}
+	bool ok=fwrite(data.data(), 1, data.size(), dst)==data.size();
+	ok=(fclose(dst)==0) && ok;
+	if(!ok)
+		log+="Error : couldn't write destination file '"+path+"'.\n";
+	return ok;
+}
+
+void RunJob(job_t &job)
+{
+	const rng_tuple_t &c=job.tuple;
+	rng g(c.n, c.r, c.t, c.k, c.s);
+	std::string code;
+	
+	appendf(job.log, "Writing generator (%u,%u,%u,%u,0x%x)\n", c.n, c.r, c.t, c.k, c.s);
+	WriteRngV2(job.name, job.rout, g, code, job.log);
+	job.ok=WriteFile(job.files[0], code, job.log);
+	if(job.ok && job.testBench){
+		code.clear();
+		WriteTestBench(job.name, job.rout, g, code);
+		job.ok=WriteFile(job.files[1], code, job.log);
+	}
+}
+
+// Write the jobs whose files aren't already up to date, numThreads at a time. Without useCache, the
+// cache is neither read nor written, and every job is run.
+int RunJobs(std::vector<job_t> &jobs, unsigned numThreads, bool force, bool useCache)
+{
+	cache_t cache;
+	std::vector<job_t*> todo;
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	int retVal=0;
+	
+	// Load the cache even with -f, so saving it doesn't forget the generators we're not writing
+	if(useCache)
+		LoadCache(cache);
+	for(size_t i=0;i<jobs.size();i++){
+		job_t &job=jobs[i];
+		const std::string key=CacheKey(job.tuple, job.rout);
+		bool current=useCache && !force;
+		job.files.push_back(job.name+".vhdl");
+		if(job.testBench)
+			job.files.push_back("tb-impl/test_"+job.name+".vhdl");
+		for(size_t j=0;j<job.files.size();j++)
+			current=current && UpToDate(cache, job.files[j], key);
+		if(current)
+			fprintf(stderr, "Skipping generator (%u,%u,%u,%u,0x%x): unchanged\n", job.tuple.n, job.tuple.r, job.tuple.t, job.tuple.k, job.tuple.s);
+		else
+			todo.push_back(&job);
+	}
+	
+	if(numThreads>todo.size())
+		numThreads=(unsigned)todo.size();
+	for(unsigned i=0;i<numThreads;i++){
+		threads.emplace_back([&]{
+			size_t k;
+			while((k=next++)<todo.size())
+				RunJob(*todo[k]);
+		});
+	}
+	for(size_t i=0;i<threads.size();i++)
+		threads[i].join();
+	
+	for(size_t i=0;i<todo.size();i++){
+		job_t &job=*todo[i];
+		fputs(job.log.c_str(), stderr);
+		if(!job.ok){
+			retVal=1;
+			continue;
+		}
+		if(!useCache)
+			continue;
+		for(size_t j=0;j<job.files.size();j++){
+			cache_entry_t &e=cache[job.files[j]];
+			e.key=CacheKey(job.tuple, job.rout);
+			if(!GetStamp(job.files[j], e))
+				cache.erase(job.files[j]);
+		}
+	}
+	if(useCache && !todo.empty())
+		SaveCache(cache);
+	return retVal;
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr, "Synopsis: %s <n> <r> <t> <k> <s> [<name> [<rout>]]\n", prog);
+	fprintf(stderr, "      or: %s [-j <numThreads>] [-t] [-f] [<index>|<n,r,t,k,s> ...]\n", prog);
+	fprintf(stderr, "The first writes one generator and its testbench. The second writes the given generators\n");
+	fprintf(stderr, "(default all known ones) in parallel, with their testbenches if -t is given; -f writes\n");
+	fprintf(stderr, "them even if they're unchanged since last time.\n");
+}
+
 int main(int argc, char *argv[])
 {
-	if(argc>1){
-		int n=atoi(argv[1]), r=atoi(argv[2]), t=atoi(argv[3] ), maxk=atoi(argv[4]);
-		uint32_t s=strtoul(argv[5],0,16);
-		
-		rng g(n, r, t, maxk, s);
+	std::vector<job_t> jobs;
+	unsigned numThreads=std::thread::hardware_concurrency();
+	bool force=false, testBench=false, batch=true;
+	
+	if(argc>5 && argv[1][0]!='-' && !strchr(argv[1], ',')){
+		job_t job;
+		job.tuple.n=atoi(argv[1]);
+		job.tuple.r=atoi(argv[2]);
+		job.tuple.t=atoi(argv[3]);
+		job.tuple.k=atoi(argv[4]);
+		job.tuple.s=strtoul(argv[5],0,16);
 		
-		std::string name;
 		if((argc>6) ? !strcmp("_",argv[6]) : false){
-			name=argv[6];
+			job.name=argv[6];
 		}else{
-			name=MakeName(g);
+			job.name=MakeName(job.tuple);
 		}
 		
-		int rout=r;
+		job.rout=job.tuple.r;
 		if(argc>7){
-			rout=atoi(argv[7]);
-			if(rout>r){
+			job.rout=atoi(argv[7]);
+			if(job.rout>job.tuple.r){
 				fprintf(stderr, "Error : can't have rout>r.\n");
 				exit(1);
 			}
 		}
-		
-		FILE *dst=fopen((name+".vhdl").c_str(), "wt");
-		if(dst==NULL){
-			fprintf(stderr, "Error : couldn't open destination file '%s.vhdl'.", name.c_str());
-			exit(1);
-		}
-		WriteRngV2(name, rout, g, dst);
-		fclose(dst);
-		
-		dst=fopen((std::string("tb-impl/test_")+name+".vhdl").c_str(), "wt");
-		if(dst==NULL){
-			fprintf(stderr, "Error : couldn't open destination file 'tb-impl/test_%s.vhdl'.", name.c_str());
-			exit(1);
-		}
-		WriteTestBench(name, rout, g, dst);
-		fclose(dst);
+		job.testBench=true;
+		jobs.push_back(job);
+		batch=false;
 	}else{
-		for(unsigned i=0;i<g_cKnownTuples;i++){
-			rng_tuple_t curr=g_aKnownTuples[i];
-			
-			rng g(curr.n, curr.r, curr.t, curr.k, curr.s);
-			
-			std::string name=MakeName(g);
-			
-			fprintf(stderr, "Writing generator (%u,%u,%u,%u,0x%x)\n", curr.n, curr.r, curr.t, curr.k, curr.s);
-			
-			FILE *dst=fopen((name+".vhdl").c_str(), "wt");
-			if(dst==NULL){
-				fprintf(stderr, "Error : couldn't open destination file '%s.vhdl'.", name.c_str());
+		int i;
+		for(i=1;i<argc && argv[i][0]=='-';i++){
+			if(!strcmp(argv[i], "-j") && i+1<argc){
+				numThreads=(unsigned)strtoul(argv[++i], 0, 0);
+			}else if(!strcmp(argv[i], "-t")){
+				testBench=true;
+			}else if(!strcmp(argv[i], "-f")){
+				force=true;
+			}else{
+				usage(argv[0]);
+				exit(1);
+			}
+		}
+		for(;i<argc;i++){
+			job_t job;
+			if(!ParseTuple(argv[i], &job.tuple)){
+				fprintf(stderr, "Error : invalid tuple '%s'.\n", argv[i]);
 				exit(1);
 			}
-			WriteRngV2(name, g.r, g, dst);
-			fclose(dst);
+			jobs.push_back(job);
+		}
+		if(jobs.empty()){
+			for(unsigned j=0;j<g_cKnownTuples;j++){
+				job_t job;
+				job.tuple=g_aKnownTuples[j];
+				jobs.push_back(job);
+			}
+		}
+		for(size_t j=0;j<jobs.size();j++){
+			jobs[j].name=MakeName(jobs[j].tuple);
+			jobs[j].rout=jobs[j].tuple.r;
+			jobs[j].testBench=testBench;
 		}
 	}
 	
-	return 0;
+	return RunJobs(jobs, numThreads ? numThreads : 1, force, batch);
 }
@@ -0,0 +1,646 @@
+//
+// Copyright (C) 2014, 2017 Chris McClelland
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright  notice and this permission notice  shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+// BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// Stimulus generator for tlp_core_tb. The driver's side of the DMA protocol (see tlp_core.vhdl) is
+// just register writes: submitDmaReq() gives the FPGA a buffer by writing its bus address to
+// DMA_ADDR_REG and its size in TLPs to DMA_CTRL_REG, the core raises an MSI when it's been filled,
+// and the ISR resubmits it. The core takes one buffer at a time, so the rest of the queue waits in
+// its receive and descriptor FIFOs, and when each write gets there depends on the simulation. So
+// rather than being a fixed sequence of cycles, the stimulus can wait for the testbench to see the
+// next MSI, and then carry on after however long the ISR takes.
+//
+// The stimulus either comes from a model of the driver (a queue of -n buffers of -b bytes,
+// resubmitted every -C completions after -l cycles, with the application's register reads and
+// writes scattered in between), or is replayed from a trace (-r): ftrace output of the
+// fpgalink_submit and fpgalink_complete events, lines of stimulus.txt, or the commands listed in
+// usage(). The patterns the testbench cycles txReady and dmaValid through, one bit per clock, model
+// backpressure from the PCIe IP and gaps in the DMA source.
+//
+// The output is either text, in the format of stimulus.txt plus the directives @idle <cycles>,
+// @msi, @txready <pattern> and @dmavalid <pattern>, or (with -B) a compact binary format which the
+// testbench reads much faster. That's the magic "TLPSTIM1", then records, each starting with an op:
+//
+//   0x00-0x07         one cycle: bit 0 is rxValid, bit 1 rxSOP and bit 2 rxEOP; if rxValid is set,
+//                     the eight bytes of rxData follow, MSB first
+//   0x80 hi lo        idle for hi*256+lo cycles
+//   0xC0              wait for the next MSI
+//   0xC1 hi lo ...    set the txReady pattern to the following hi*256+lo bits, one byte each
+//   0xC2 hi lo ...    likewise for the dmaValid pattern
+//
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+static const uint64_t REQ_ID = 0xF00D;          // as in stimulus.txt
+static const uint32_t BAR_BASE = 0xA0000000;
+static const uint32_t RING_BUS = 0x10000000;    // where the modelled circular queue lives...
+static const uint32_t STATUS_BUS = 0x0FFFF000;  // ...and its page of status records
+static const uint32_t FL_DMABASE_STATUS = 0x1;  // as in fpgalink.c
+static const uint64_t FL_MAX_INFLIGHT = 28;     // likewise: desc_fifo only holds 32
+static const int DMA_ADDR_REG = 0;
+static const int DMA_CTRL_REG = 1;
+static const int NUM_REGS = 8;                  // the testbench's REG_ABITS is 3
+static const size_t MAX_PATTERN = 1024;         // must match the testbench
+static const uint64_t MAX_RUN = 0xFFFF;         // cycles in one idle record
+static const double CLOCK_HZ = 125e6;
+
+// Writes stimulus, in either format
+//
+class stim_writer {
+	FILE *const out_;
+	const bool binary_;
+	std::string buf_;
+	bool ok_;
+
+	void flush() {
+		if ( ok_ && !buf_.empty() ) {
+			ok_ = fwrite(buf_.data(), 1, buf_.size(), out_) == buf_.size();
+		}
+		buf_.clear();
+	}
+
+	void put(unsigned b) {
+		buf_ += (char)(b & 0xFF);
+	}
+
+	void put16(unsigned v) {
+		put(v >> 8);
+		put(v);
+	}
+
+	void text(const char *s) {
+		buf_ += s;
+	}
+
+	void record() {
+		if ( buf_.size() >= (1 << 20) ) {
+			flush();
+		}
+	}
+
+public:
+	uint64_t cycles, tlps, msis;
+
+	stim_writer(FILE *out, bool binary)
+		: out_(out), binary_(binary), ok_(true), cycles(0), tlps(0), msis(0)
+	{
+		if ( binary_ ) {
+			text("TLPSTIM1");
+		}
+	}
+
+	// One cycle with rxValid set
+	void Beat(uint64_t data, bool sop, bool eop) {
+		if ( binary_ ) {
+			put(1U | (sop ? 2U : 0U) | (eop ? 4U : 0U));
+			for ( int i = 56; i >= 0; i -= 8 ) {
+				put((unsigned)(data >> i));
+			}
+		} else {
+			char line[32];
+			snprintf(line, sizeof(line), "%016llX 1 %d %d\n", (unsigned long long)data, sop, eop);
+			text(line);
+		}
+		cycles++;
+		tlps += sop;
+		record();
+	}
+
+	// Some cycles with rxValid clear
+	void Idle(uint64_t count) {
+		cycles += count;
+		if ( count < 4 ) {
+			for ( ; count; count-- ) {
+				if ( binary_ ) {
+					put(0x00);
+				} else {
+					text("XXXXXXXXXXXXXXXX 0 0 0\n");
+				}
+			}
+		}
+		while ( count ) {
+			const uint64_t num = (count < MAX_RUN) ? count : MAX_RUN;
+			if ( binary_ ) {
+				put(0x80);
+				put16((unsigned)num);
+			} else {
+				char line[32];
+				snprintf(line, sizeof(line), "@idle %u\n", (unsigned)num);
+				text(line);
+			}
+			count -= num;
+		}
+		record();
+	}
+
+	// Wait for the next MSI
+	void WaitMsi() {
+		if ( binary_ ) {
+			put(0xC0);
+		} else {
+			text("@msi\n");
+		}
+		msis++;
+		record();
+	}
+
+	// Set the txReady or dmaValid pattern
+	void Pattern(bool dma, const std::string &bits) {
+		if ( binary_ ) {
+			put(dma ? 0xC2 : 0xC1);
+			put16((unsigned)bits.size());
+			for ( char c : bits ) {
+				put(c == '1');
+			}
+		} else {
+			text(dma ? "@dmavalid " : "@txready ");
+			text(bits.c_str());
+			text("\n");
+		}
+		record();
+	}
+
+	// Write out what's left. Returns false if anything couldn't be written.
+	bool Finish() {
+		flush();
+		return fflush(out_) == 0 && ok_;
+	}
+};
+
+// The host's side of the TLP interface: one-dword memory writes and reads of the FPGA's registers,
+// as in stimulus.txt. Register N is at byte offset (2N+1)*4 in the BAR.
+//
+class host {
+	stim_writer &w_;
+	uint8_t tag_;
+
+	uint64_t header(uint32_t fmtType) {
+		return (REQ_ID << 48) | ((uint64_t)tag_++ << 40) | (0x0FULL << 32) | fmtType;
+	}
+
+	static uint32_t regAddr(int reg) {
+		return BAR_BASE | (uint32_t)(2*reg + 1) * 4;
+	}
+
+public:
+	explicit host(stim_writer &w) : w_(w), tag_(0) { }
+
+	void Write(int reg, uint32_t val) {
+		w_.Beat(header(0x40000001), true, false);
+		w_.Beat(((uint64_t)val << 32) | regAddr(reg), false, true);
+	}
+
+	void Read(int reg) {
+		w_.Beat(header(0x00000001), true, false);
+		w_.Beat(regAddr(reg), false, true);
+	}
+
+	// What submitDmaReq() does
+	void Submit(uint32_t bus, uint32_t numTLPs, uint32_t flushUnits) {
+		Write(DMA_ADDR_REG, bus);
+		Write(DMA_CTRL_REG, numTLPs | (flushUnits << 16));
+	}
+};
+
+// Parse a pattern, given as 0s and 1s, optionally in runs: "1110" and "1*100,0*20" are both fine.
+// It must have at least one 1 in it, since nothing would ever happen otherwise.
+//
+static bool parsePattern(const char *arg, std::string &bits) {
+	const char *p = arg;
+	bits.clear();
+	while ( *p ) {
+		const char *q = p;
+		unsigned long count = 1;
+		while ( *q == '0' || *q == '1' ) {
+			q++;
+		}
+		const std::string run(p, q);
+		if ( run.empty() ) {
+			return false;
+		}
+		if ( *q == '*' ) {
+			char *end;
+			count = strtoul(q + 1, &end, 0);
+			q = end;
+		}
+		if ( !count || count > MAX_PATTERN ) {
+			return false;
+		}
+		for ( ; count; count-- ) {
+			bits += run;
+			if ( bits.size() > MAX_PATTERN ) {
+				return false;
+			}
+		}
+		if ( *q == ',' ) {
+			q++;
+		} else if ( *q ) {
+			return false;
+		}
+		p = q;
+	}
+	return bits.find('1') != std::string::npos;
+}
+
+static uint64_t nextRandom(uint64_t &s) {
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+struct model_t {
+	uint32_t bufSize;     // bytes in each buffer (a multiple of 128)
+	uint32_t numBufs;     // buffers in the circular queue
+	uint64_t count;       // buffers to fill in all
+	uint32_t coalesce;    // completions the ISR waits for before resubmitting
+	uint32_t latMin;      // the ISR's latency, from MSI to resubmission, in cycles
+	uint32_t latMax;
+	uint32_t flushUnits;  // the flush timeout, in units of 128 cycles
+	uint32_t reads;       // application register reads per hundred buffers
+	uint32_t writes;      // application register writes per hundred buffers
+	uint64_t seed;
+};
+
+// Model the driver: give the FPGA the whole queue, or FL_MAX_INFLIGHT buffers of it if that's
+// fewer, then after every coalesce completions (or fewer, if that's all that are in flight), wait
+// for the ISR and submit as many again. The application's register accesses come at random points
+// while the ISR is running.
+//
+static void runModel(const model_t &m, host &h, stim_writer &w) {
+	const uint32_t numTLPs = m.bufSize / 128;
+	const uint64_t maxInFlight = (m.numBufs < FL_MAX_INFLIGHT) ? m.numBufs : FL_MAX_INFLIGHT;
+	uint64_t rnd = m.seed ? m.seed : 1;
+	uint64_t submitted = 0, completed = 0;
+	uint64_t readAcc = 0, writeAcc = 0;
+	for ( ; submitted < maxInFlight && submitted < m.count; submitted++ ) {
+		h.Submit(RING_BUS + (uint32_t)(submitted % m.numBufs) * m.bufSize, numTLPs, m.flushUnits);
+	}
+	while ( completed < m.count ) {
+		const uint64_t inFlight = submitted - completed;
+		const uint64_t batch = (inFlight < m.coalesce) ? inFlight : m.coalesce;
+		for ( uint64_t i = 0; i < batch; i++ ) {
+			w.WaitMsi();
+		}
+		completed += batch;
+
+		uint64_t left = m.latMin;
+		if ( m.latMax > m.latMin ) {
+			left += nextRandom(rnd) % (m.latMax - m.latMin + 1);
+		}
+		readAcc += m.reads * batch;
+		writeAcc += m.writes * batch;
+		while ( readAcc >= 100 || writeAcc >= 100 ) {
+			const uint64_t wait = nextRandom(rnd) % (left + 1);
+			const int reg = 2 + (int)(nextRandom(rnd) % (NUM_REGS - 2));
+			w.Idle(wait);
+			left -= wait;
+			if ( readAcc >= 100 ) {
+				h.Read(reg);
+				readAcc -= 100;
+			} else {
+				h.Write(reg, (uint32_t)nextRandom(rnd));
+				writeAcc -= 100;
+			}
+		}
+		w.Idle(left);
+		for ( ; submitted - completed < maxInFlight && submitted < m.count; submitted++ ) {
+			h.Submit(RING_BUS + (uint32_t)(submitted % m.numBufs) * m.bufSize, numTLPs, m.flushUnits);
+		}
+	}
+}
+
+struct replay_t {
+	int minor;            // which device's events to replay
+	uint32_t flushUnits;  // the trace doesn't record it
+	uint64_t maxGap;      // the longest idle between traced events, in cycles
+};
+
+// Apply a command (see usage()), or a line of stimulus.txt. Returns false if it isn't one.
+//
+static bool doCommand(const char *line, host &h, stim_writer &w) {
+	char cmd[16], arg[MAX_PATTERN + 1];
+	unsigned long long a, b, c = 0;
+	size_t len = 0;
+	while ( len < 16 && (isxdigit((unsigned char)line[len]) || line[len] == 'X') ) {
+		len++;
+	}
+	if ( len == 16 && line[16] == ' ' ) {
+		// Each cycle of stimulus.txt is the data, then valid, SOP and EOP
+		int v, s, e;
+		if ( sscanf(line + 16, "%d %d %d", &v, &s, &e) != 3 ) {
+			return false;
+		}
+		if ( v ) {
+			const std::string data(line, 16);
+			if ( data.find('X') != std::string::npos ) {
+				return false;
+			}
+			w.Beat(strtoull(data.c_str(), NULL, 16), s != 0, e != 0);
+		} else {
+			w.Idle(1);
+		}
+		return true;
+	}
+	if ( *line == '@' ) {
+		line++;
+	}
+	if ( sscanf(line, "%15s", cmd) != 1 ) {
+		return false;
+	}
+	if ( !strcmp(cmd, "msi") ) {
+		w.WaitMsi();
+	} else if ( !strcmp(cmd, "idle") && sscanf(line, "%*s %llu", &a) == 1 ) {
+		w.Idle(a);
+	} else if (
+		(!strcmp(cmd, "txready") || !strcmp(cmd, "dmavalid")) && sscanf(line, "%*s %1024s", arg) == 1
+	) {
+		std::string bits;
+		if ( !parsePattern(arg, bits) ) {
+			return false;
+		}
+		w.Pattern(cmd[0] == 'd', bits);
+	} else if ( !strcmp(cmd, "wr") && sscanf(line, "%*s %llu %lli", &a, &b) == 2 && a < NUM_REGS ) {
+		h.Write((int)a, (uint32_t)b);
+	} else if ( !strcmp(cmd, "rd") && sscanf(line, "%*s %llu", &a) == 1 && a < NUM_REGS ) {
+		h.Read((int)a);
+	} else if ( !strcmp(cmd, "submit") && sscanf(line, "%*s %lli %llu %llu", &a, &b, &c) >= 2 ) {
+		h.Submit((uint32_t)a, (uint32_t)b, (uint32_t)c);
+	} else if ( !strcmp(cmd, "status") && sscanf(line, "%*s %lli", &a) == 1 ) {
+		h.Write(DMA_ADDR_REG, (uint32_t)a | FL_DMABASE_STATUS);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Replay a trace. Each traced submit that follows a completion waits for the MSI of every buffer
+// completed since the last one, and then for as long as it came after the last of those; the
+// others just come as long after the submit before. Completions of buffers submitted before the
+// trace started are ignored. The driver never has more than FL_MAX_INFLIGHT buffers in flight, but
+// a trace that's lost events might, so a submit that would go over waits for an MSI first, and the
+// completion it stands for is then taken as already waited for. Returns nonzero on error.
+//
+static int replay(FILE *in, const char *name, const replay_t &r, host &h, stim_writer &w) {
+	char line[4096];
+	unsigned lineNum = 0;
+	uint64_t inFlight = 0, pending = 0, early = 0;
+	double lastTime = -1.0, completeTime = -1.0;
+	while ( fgets(line, sizeof(line), in) ) {
+		const char *p;
+		lineNum++;
+		line[strcspn(line, "\r\n")] = '\0';
+		p = strstr(line, ": fpgalink_");
+		if ( p ) {
+			// The timestamp, in seconds, is the field just before the event name
+			const char *t = p;
+			while ( t > line && !isspace((unsigned char)t[-1]) ) {
+				t--;
+			}
+			const double ts = strtod(t, NULL);
+			unsigned long long bus;
+			unsigned seq, slot, numTLPs;
+			int minor;
+			if (
+				sscanf(p, ": fpgalink_submit: fpga%d seq=%u slot=%u bus=0x%llx tlps=%u",
+					&minor, &seq, &slot, &bus, &numTLPs) == 5 && minor == r.minor
+			) {
+				double ref = lastTime;
+				if ( pending ) {
+					for ( ; pending; pending-- ) {
+						w.WaitMsi();
+					}
+					ref = completeTime;
+				}
+				for ( ; inFlight - early >= FL_MAX_INFLIGHT; early++ ) {
+					w.WaitMsi();
+				}
+				if ( ref >= 0.0 && ts > ref ) {
+					const uint64_t gap = (uint64_t)((ts - ref) * CLOCK_HZ + 0.5);
+					w.Idle((gap < r.maxGap) ? gap : r.maxGap);
+				}
+				h.Submit((uint32_t)bus, numTLPs, r.flushUnits);
+				inFlight++;
+				lastTime = ts;
+			} else if (
+				sscanf(p, ": fpgalink_complete: fpga%d", &minor) == 1 && minor == r.minor && inFlight
+			) {
+				inFlight--;
+				if ( early ) {
+					early--;
+				} else {
+					pending++;
+				}
+				completeTime = ts;
+			}
+			continue;  // some other event
+		}
+		p = line;
+		while ( isspace((unsigned char)*p) ) {
+			p++;
+		}
+		if ( !*p || *p == '#' ) {
+			continue;
+		}
+		if ( !doCommand(p, h, w) ) {
+			fprintf(stderr, "%s:%u: can't make sense of \"%s\"\n", name, lineNum, p);
+			return -1;
+		}
+	}
+	if ( ferror(in) ) {
+		fprintf(stderr, "%s: read error\n", name);
+		return -1;
+	}
+
+	// Finish with the buffers still in flight
+	for ( ; pending; pending-- ) {
+		w.WaitMsi();
+	}
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(
+		stderr,
+		"Synopsis: %s [-o <file>] [-B] [-s] [-f <flushUnits>] [-t <txReady>] [-d <dmaValid>]\n"
+		"          [-b <bufSize>] [-n <numBufs>] [-c <count>] [-C <coalesceCount>]\n"
+		"          [-l <minCycles>[,<maxCycles>]] [-i <reads>,<writes>] [-x <seed>]\n"
+		"          [-r <trace> [-m <minor>] [-g <maxGapCycles>]]\n"
+		"  -B               write the binary format, rather than text\n"
+		"  -s               give the FPGA a page for status records first, as the driver does\n"
+		"  -t, -d           patterns for txReady and dmaValid, like 1110 or 1*100,0*20\n"
+		"  -b, -n           the circular queue's geometry (default 65536 bytes, 32 buffers);\n"
+		"                   as in the driver, at most 28 of them are in flight at once\n"
+		"  -c               how many buffers to fill (default 32)\n"
+		"  -l               cycles from each MSI to the ISR resubmitting (default 500)\n"
+		"  -i               application register accesses per hundred buffers (default none)\n"
+		"  -r               replay a trace instead, of these, one per line:\n"
+		"                     ftrace output of the fpgalink_submit and fpgalink_complete events\n"
+		"                     lines of stimulus.txt\n"
+		"                     [@]wr <reg> <val>, [@]rd <reg>, [@]submit <bus> <numTLPs> [<flushUnits>],\n"
+		"                     [@]status <bus>, [@]idle <cycles>, [@]msi, [@]txready <pattern>,\n"
+		"                     [@]dmavalid <pattern>\n",
+		prog
+	);
+}
+
+int main(int argc, char *argv[]) {
+	model_t m = {65536, 32, 32, 1, 500, 500, 0, 0, 0, 1};
+	replay_t r = {0, 0, 125000};
+	const char *outFile = NULL, *traceFile = NULL;
+	std::string txReady("1"), dmaValid("1");
+	bool binary = false, status = false, txReadySet = false, dmaValidSet = false;
+	FILE *out = stdout, *trace = NULL;
+	int retVal = 0, opt;
+	char *end;
+
+	while ( (opt = getopt(argc, argv, "o:Bsf:t:d:b:n:c:C:l:i:x:r:m:g:")) != -1 ) {
+		switch ( opt ) {
+		case 'o':
+			outFile = optarg;
+			break;
+		case 'B':
+			binary = true;
+			break;
+		case 's':
+			status = true;
+			break;
+		case 'f':
+			m.flushUnits = r.flushUnits = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+		case 'd':
+			if ( !parsePattern(optarg, (opt == 't') ? txReady : dmaValid) ) {
+				fprintf(stderr, "Invalid pattern: %s\n", optarg);
+				retVal = 1; goto exit;
+			}
+			((opt == 't') ? txReadySet : dmaValidSet) = true;
+			break;
+		case 'b':
+			m.bufSize = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			m.numBufs = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			m.count = strtoull(optarg, NULL, 0);
+			break;
+		case 'C':
+			m.coalesce = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			m.latMin = m.latMax = (uint32_t)strtoul(optarg, &end, 0);
+			if ( *end == ',' ) {
+				m.latMax = (uint32_t)strtoul(end + 1, NULL, 0);
+			}
+			break;
+		case 'i':
+			m.reads = (uint32_t)strtoul(optarg, &end, 0);
+			if ( *end == ',' ) {
+				m.writes = (uint32_t)strtoul(end + 1, NULL, 0);
+			}
+			break;
+		case 'x':
+			m.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			traceFile = optarg;
+			break;
+		case 'm':
+			r.minor = (int)strtol(optarg, NULL, 0);
+			break;
+		case 'g':
+			r.maxGap = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			retVal = 1; goto exit;
+		}
+	}
+	if ( optind != argc ) {
+		usage(argv[0]);
+		retVal = 1; goto exit;
+	}
+	if ( m.bufSize < 128 || m.bufSize % 128 || m.bufSize / 128 > 1023 ) {
+		fprintf(stderr, "The buffer size must be a multiple of 128 bytes, up to 1023 TLPs\n");
+		retVal = 1; goto exit;
+	}
+	if ( !m.numBufs || !m.coalesce || m.latMax < m.latMin || m.flushUnits > 0xFFFF ) {
+		usage(argv[0]);
+		retVal = 1; goto exit;
+	}
+	if ( traceFile ) {
+		trace = fopen(traceFile, "r");
+		if ( !trace ) {
+			perror(traceFile);
+			retVal = 2; goto exit;
+		}
+	}
+	if ( outFile ) {
+		out = fopen(outFile, binary ? "wb" : "w");
+		if ( !out ) {
+			perror(outFile);
+			retVal = 2; goto exit;
+		}
+	}
+
+	{
+		// A trace sets its own patterns, unless they're overridden
+		stim_writer w(out, binary);
+		host h(w);
+		if ( !trace || txReadySet ) {
+			w.Pattern(false, txReady);
+		}
+		if ( !trace || dmaValidSet ) {
+			w.Pattern(true, dmaValid);
+		}
+		if ( !trace ) {
+			w.Idle(4);
+		}
+		if ( status ) {
+			h.Write(DMA_ADDR_REG, STATUS_BUS | FL_DMABASE_STATUS);
+		}
+		if ( trace ) {
+			if ( replay(trace, traceFile, r, h, w) ) {
+				retVal = 3; goto exit;
+			}
+		} else {
+			runModel(m, h, w);
+		}
+		if ( !w.Finish() ) {
+			fprintf(stderr, "Failed to write stimulus\n");
+			retVal = 2; goto exit;
+		}
+		fprintf(
+			stderr, "Wrote %llu cycles of stimulus: %llu TLPs, waiting for %llu MSIs\n",
+			(unsigned long long)w.cycles, (unsigned long long)w.tlps, (unsigned long long)w.msis
+		);
+	}
+exit:
+	if ( trace ) {
+		fclose(trace);
+	}
+	if ( out && out != stdout ) {
+		fclose(out);
+	}
+	return retVal;
+}
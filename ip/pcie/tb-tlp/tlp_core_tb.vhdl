@@ -26,17 +26,24 @@ library makestuff;
 use makestuff.hex_util.all;
 
 entity tlp_core_tb is
+	generic (
+		STIMULUS          : string  := "stimulus.txt";  -- hand-written, or from gen_stim
+		BINARY            : boolean := false;           -- STIMULUS is in gen_stim's binary format
+		WRITE_RESULTS     : boolean := true;            -- write the outgoing TLPs to results.txt
+		DRAIN_CYCLES      : natural := 1000             -- cycles to run on after the stimulus ends
+	);
 end entity;
 
 architecture behavioural of tlp_core_tb is
 	-- Constants
 	constant REG_ABITS        : natural := 3;
+	constant MAX_PATTERN      : natural := 1024;  -- must match gen_stim
 	
 	-- Clock, config & interrupt signals
 	signal pcieClk            : std_logic := '1';  -- 125MHz core clock
 	signal cfgBusDev          : std_logic_vector(12 downto 0);
 	signal msiReq             : std_logic;  -- application requests an MSI...
-	signal msiAck             : std_logic;  -- and waits for the IP to acknowledge
+	signal msiAck             : std_logic := '0';  -- and waits for the IP to acknowledge
 
 	-- Requests received from the CPU
 	signal rxData             : std_logic_vector(63 downto 0);
@@ -61,6 +68,23 @@ architecture behavioural of tlp_core_tb is
 	signal cpuRdValid         : std_logic;
 	signal cpuRdReady         : std_logic;
 
+	-- Incoming DMA stream: just a count of the qwords taken so far
+	signal dmaData            : std_logic_vector(63 downto 0) := (others => '0');
+	signal dmaValid           : std_logic;
+	signal dmaReady           : std_logic;
+
+	-- The patterns txReady and dmaValid cycle through, one bit per clock, as set by the stimulus
+	signal txPattern          : std_logic_vector(0 to MAX_PATTERN-1) := (others => '1');
+	signal txPatLen           : positive := 1;
+	signal txPos              : natural range 0 to MAX_PATTERN-1 := 0;
+	signal dmaPattern         : std_logic_vector(0 to MAX_PATTERN-1) := (others => '0');
+	signal dmaPatLen          : positive := 1;
+	signal dmaPos             : natural range 0 to MAX_PATTERN-1 := 0;
+
+	-- MSIs acknowledged so far, and whether the stimulus is all done
+	signal msiCount           : natural := 0;
+	signal stimDone           : boolean := false;
+
 	-- Register array
 	type RegArrayType is array (0 to 2**REG_ABITS-1) of std_logic_vector(31 downto 0);
 	signal regArray           : RegArrayType := (others => (others => 'X'));
@@ -100,9 +124,9 @@ begin
 			cpuRdValid_in    => cpuRdValid,
 			cpuRdReady_out   => cpuRdReady,
 
-			dmaData_in       => (others => 'X'),
-			dmaValid_in      => '0',
-			dmaReady_out     => open
+			dmaData_in       => dmaData,
+			dmaValid_in      => dmaValid,
+			dmaReady_out     => dmaReady
 		);
 
 	-- Infer registers
@@ -129,67 +153,363 @@ begin
 		end if;
 	end process;
 
+	-- Cycle through the txReady and dmaValid patterns
+	txReady <= txPattern(txPos);
+	dmaValid <= dmaPattern(dmaPos);
+	process(pcieClk)
+	begin
+		if ( rising_edge(pcieClk) ) then
+			if ( txPos + 1 >= txPatLen ) then
+				txPos <= 0;
+			else
+				txPos <= txPos + 1;
+			end if;
+			if ( dmaPos + 1 >= dmaPatLen ) then
+				dmaPos <= 0;
+			else
+				dmaPos <= dmaPos + 1;
+			end if;
+		end if;
+	end process;
+
+	-- The DMA source counts the qwords the core takes
+	process(pcieClk)
+	begin
+		if ( rising_edge(pcieClk) ) then
+			if ( dmaReady = '1' ) then
+				dmaData <= std_logic_vector(unsigned(dmaData) + 1);
+			end if;
+		end if;
+	end process;
+
+	-- Acknowledge each MSI the cycle after it's requested, and count them
+	process(pcieClk)
+	begin
+		if ( rising_edge(pcieClk) ) then
+			msiAck <= msiReq and not(msiAck);
+			if ( msiReq = '1' and msiAck = '1' ) then
+				msiCount <= msiCount + 1;
+			end if;
+		end if;
+	end process;
+
 	-- Drive the clocks
 	pcieClk <= not(pcieClk) after 4 ns;
 
-	-- Drive the unit under test. Read stimulus from stimulus.sim
+	-- Drive the unit under test. Read stimulus from the STIMULUS file: either text, in the format of
+	-- stimulus.txt plus gen_stim's @directives, or gen_stim's binary format (see gen_stim.cpp). Each
+	-- qword is held until the core is ready for it.
 	process
+		type ByteFile is file of character;
+		file txtFile          : text;
+		file binFile          : ByteFile;
 		variable inLine       : line;
-		file inFile           : text open read_mode is "stimulus.txt";
+		variable magic        : string(1 to 8);
+		variable op, hi, lo   : natural;
+		variable data         : std_logic_vector(63 downto 0);
+		variable flags        : std_logic_vector(7 downto 0);
+		variable pat          : std_logic_vector(0 to MAX_PATTERN-1);
+		variable patLen       : natural;
+		variable msiWaited    : natural := 0;
+
+		-- Present nothing to the core
+		procedure quiet is
+		begin
+			rxData <= (others => 'X');
+			rxValid <= '0';
+			rxSOP <= '0';
+			rxEOP <= '0';
+		end procedure;
+
+		-- Present one cycle of stimulus to the core, holding a valid qword until it's taken
+		procedure beat(d : std_logic_vector(63 downto 0); v, s, e : std_logic) is
+		begin
+			rxData <= d;
+			rxValid <= v;
+			rxSOP <= s;
+			rxEOP <= e;
+			loop
+				wait until rising_edge(pcieClk);
+				exit when v /= '1' or rxReady /= '0';
+			end loop;
+		end procedure;
+
+		procedure idle(n : natural) is
+		begin
+			quiet;
+			for i in 1 to n loop
+				wait until rising_edge(pcieClk);
+			end loop;
+		end procedure;
+
+		-- Wait for the core to raise the next MSI (if it hasn't already)
+		procedure waitMsi is
+		begin
+			quiet;
+			msiWaited := msiWaited + 1;
+			while ( msiCount < msiWaited ) loop
+				wait until rising_edge(pcieClk);
+			end loop;
+		end procedure;
+
+		-- Start cycling txReady or dmaValid through the first patLen bits of pat
+		procedure setPattern(dma : boolean) is
+		begin
+			assert patLen >= 1 and patLen <= MAX_PATTERN
+				report "Bad pattern length in " & STIMULUS severity failure;
+			if ( dma ) then
+				dmaPattern <= pat;
+				dmaPatLen <= patLen;
+			else
+				txPattern <= pat;
+				txPatLen <= patLen;
+			end if;
+		end procedure;
+
+		-- Get a pattern from the rest of a text directive
+		procedure textPattern(dma : boolean; arg : string) is
+		begin
+			patLen := 0;
+			for i in arg'range loop
+				if ( (arg(i) = '0' or arg(i) = '1') and patLen < MAX_PATTERN ) then
+					pat(patLen) := to_1(arg(i));
+					patLen := patLen + 1;
+				end if;
+			end loop;
+			setPattern(dma);
+		end procedure;
+
+		-- Get the next byte of the binary stimulus
+		procedure getByte(b : out natural) is
+			variable c : character;
+		begin
+			read(binFile, c);
+			b := character'pos(c);
+		end procedure;
+
+		-- Does the line start with the given directive?
+		function isDirective(l : string; d : string) return boolean is
+		begin
+			return l'length >= d'length and l(l'left to l'left + d'length - 1) = d;
+		end function;
+
+		function toNatural(s : string) return natural is
+			variable n : natural := 0;
+		begin
+			for i in s'range loop
+				if ( s(i) >= '0' and s(i) <= '9' ) then
+					n := 10*n + character'pos(s(i)) - character'pos('0');
+				end if;
+			end loop;
+			return n;
+		end function;
 	begin
-		rxData <= (others => 'X');
-		rxValid <= '0';
-		rxSOP <= '0';
-		rxEOP <= '0';
-		txReady <= '1';
+		quiet;
 		cfgBusDev <= '0' & x"CAF";
 		wait until rising_edge(pcieClk);
-		while ( not endfile(inFile) ) loop
-			readline(inFile, inLine);
-			while ( inLine.all'length = 0 or inLine.all(1) = '#' or inLine.all(1) = ht or inLine.all(1) = ' ' ) loop
-				readline(inFile, inLine);
+		if ( BINARY ) then
+			file_open(binFile, STIMULUS, read_mode);
+			for i in magic'range loop
+				read(binFile, magic(i));
+			end loop;
+			assert magic = "TLPSTIM1" report STIMULUS & " is not gen_stim binary stimulus" severity failure;
+			while ( not endfile(binFile) ) loop
+				getByte(op);
+				if ( op < 16#80# ) then
+					-- One cycle: bit 0 is rxValid, bit 1 rxSOP and bit 2 rxEOP
+					flags := std_logic_vector(to_unsigned(op, 8));
+					if ( flags(0) = '1' ) then
+						for i in 0 to 7 loop
+							getByte(lo);
+							data := data(55 downto 0) & std_logic_vector(to_unsigned(lo, 8));
+						end loop;
+						beat(data, '1', flags(1), flags(2));
+					else
+						beat((others => 'X'), '0', '0', '0');
+					end if;
+				elsif ( op = 16#80# ) then
+					getByte(hi);
+					getByte(lo);
+					idle(256*hi + lo);
+				elsif ( op = 16#C0# ) then
+					waitMsi;
+				elsif ( op = 16#C1# or op = 16#C2# ) then
+					getByte(hi);
+					getByte(lo);
+					patLen := 256*hi + lo;
+					for i in 0 to patLen - 1 loop
+						getByte(lo);
+						if ( i < MAX_PATTERN and lo = 0 ) then
+							pat(i) := '0';
+						elsif ( i < MAX_PATTERN ) then
+							pat(i) := '1';
+						end if;
+					end loop;
+					setPattern(op = 16#C2#);
+				else
+					report "Bad record in " & STIMULUS severity failure;
+				end if;
 			end loop;
-			rxData <=
-				to_4(inLine.all(1)) & to_4(inLine.all(2)) & to_4(inLine.all(3)) & to_4(inLine.all(4)) &
-				to_4(inLine.all(5)) & to_4(inLine.all(6)) & to_4(inLine.all(7)) & to_4(inLine.all(8)) &
-				to_4(inLine.all(9)) & to_4(inLine.all(10)) & to_4(inLine.all(11)) & to_4(inLine.all(12)) &
-				to_4(inLine.all(13)) & to_4(inLine.all(14)) & to_4(inLine.all(15)) & to_4(inLine.all(16));
-			rxValid <= to_1(inLine.all(18));
-			rxSOP <= to_1(inLine.all(20));
-			rxEOP <= to_1(inLine.all(22));
+			file_close(binFile);
+		else
+			file_open(txtFile, STIMULUS, read_mode);
+			while ( not endfile(txtFile) ) loop
+				readline(txtFile, inLine);
+				if ( inLine.all'length = 0 or inLine.all(1) = '#' or inLine.all(1) = ht or inLine.all(1) = ' ' ) then
+					null;
+				elsif ( isDirective(inLine.all, "@idle") ) then
+					idle(toNatural(inLine.all(6 to inLine.all'length)));
+				elsif ( isDirective(inLine.all, "@msi") ) then
+					waitMsi;
+				elsif ( isDirective(inLine.all, "@txready") ) then
+					textPattern(false, inLine.all(9 to inLine.all'length));
+				elsif ( isDirective(inLine.all, "@dmavalid") ) then
+					textPattern(true, inLine.all(10 to inLine.all'length));
+				else
+					beat(
+						to_4(inLine.all(1)) & to_4(inLine.all(2)) & to_4(inLine.all(3)) & to_4(inLine.all(4)) &
+						to_4(inLine.all(5)) & to_4(inLine.all(6)) & to_4(inLine.all(7)) & to_4(inLine.all(8)) &
+						to_4(inLine.all(9)) & to_4(inLine.all(10)) & to_4(inLine.all(11)) & to_4(inLine.all(12)) &
+						to_4(inLine.all(13)) & to_4(inLine.all(14)) & to_4(inLine.all(15)) & to_4(inLine.all(16)),
+						to_1(inLine.all(18)), to_1(inLine.all(20)), to_1(inLine.all(22))
+					);
+				end if;
+			end loop;
+			file_close(txtFile);
+		end if;
+		quiet;
+		for i in 1 to DRAIN_CYCLES loop
 			wait until rising_edge(pcieClk);
 		end loop;
-		rxData <= (others => 'X');
-		rxValid <= '0';
-		rxSOP <= '0';
-		rxEOP <= '0';
+		stimDone <= true;
 		wait;
 	end process;
 
-	-- Write results to results.sim
+	-- Measure the DMA traffic, and report on it once the stimulus is all done
 	process
-		variable outLine      : line;
-		file outFile          : text open write_mode is "results.txt";
+		type CycleQueue is array (0 to 63) of natural;
+		variable cycle        : natural := 0;
+		variable dmaQwords    : natural := 0;
+		variable dmaTLPs      : natural := 0;
+		variable firstDma     : natural := 0;
+		variable lastDma      : natural := 0;
+		variable txStalls     : natural := 0;  -- cycles the IP wasn't ready for the core's TLPs
+		variable rxStalls     : natural := 0;  -- cycles the core wasn't ready for the host's
+		variable msis         : natural := 0;
+		variable lastMsi      : natural := 0;
+		variable minGap       : natural := natural'high;
+		variable maxGap       : natural := 0;
+		variable reads        : CycleQueue;    -- when each outstanding register read arrived
+		variable rdHead       : natural := 0;
+		variable rdTail       : natural := 0;
+		variable rdDone       : natural := 0;
+		variable rdTotal      : natural := 0;
+		variable rdMax        : natural := 0;
+		variable permille     : natural;
 	begin
 		loop
-			wait until falling_edge(pcieClk);
-			write(
-				outLine,
-				from_4(txData(63 downto 60)) & from_4(txData(59 downto 56)) &
-				from_4(txData(55 downto 52)) & from_4(txData(51 downto 48)) &
-				from_4(txData(47 downto 44)) & from_4(txData(43 downto 40)) &
-				from_4(txData(39 downto 36)) & from_4(txData(35 downto 32)) &
-				from_4(txData(31 downto 28)) & from_4(txData(27 downto 24)) &
-				from_4(txData(23 downto 20)) & from_4(txData(19 downto 16)) &
-				from_4(txData(15 downto 12)) & from_4(txData(11 downto 8)) &
-				from_4(txData(7 downto 4)) & from_4(txData(3 downto 0)));
-			write(outLine, ' ');
-			write(outLine, txValid);
-			write(outLine, ' ');
-			write(outLine, txSOP);
-			write(outLine, ' ');
-			write(outLine, txEOP);
-			writeline(outFile, outLine);
+			wait until rising_edge(pcieClk);
+			exit when stimDone;
+			cycle := cycle + 1;
+			if ( dmaReady = '1' ) then
+				if ( dmaQwords = 0 ) then
+					firstDma := cycle;
+				end if;
+				lastDma := cycle;
+				dmaQwords := dmaQwords + 1;
+			end if;
+			if ( txReady = '0' ) then
+				txStalls := txStalls + 1;
+			end if;
+			if ( rxValid = '1' and rxReady = '0' ) then
+				rxStalls := rxStalls + 1;
+			end if;
+			if ( msiReq = '1' and msiAck = '1' ) then
+				if ( msis /= 0 ) then
+					if ( cycle - lastMsi < minGap ) then
+						minGap := cycle - lastMsi;
+					end if;
+					if ( cycle - lastMsi > maxGap ) then
+						maxGap := cycle - lastMsi;
+					end if;
+				end if;
+				msis := msis + 1;
+				lastMsi := cycle;
+			end if;
+
+			-- Register reads are answered in order, so match each completion to the oldest read
+			if ( rxValid = '1' and rxReady /= '0' and rxSOP = '1' and rxData(31 downto 24) = x"00" ) then
+				if ( rdHead - rdTail < reads'length ) then
+					reads(rdHead mod reads'length) := cycle;
+					rdHead := rdHead + 1;
+				end if;
+			end if;
+			if ( txValid = '1' and txReady = '1' and txSOP = '1' ) then
+				if ( txData(31 downto 24) = x"40" and txData(9 downto 0) = "0000100000" ) then
+					dmaTLPs := dmaTLPs + 1;
+				elsif ( txData(31 downto 24) = x"4A" and rdHead /= rdTail ) then
+					if ( cycle - reads(rdTail mod reads'length) > rdMax ) then
+						rdMax := cycle - reads(rdTail mod reads'length);
+					end if;
+					rdTotal := rdTotal + cycle - reads(rdTail mod reads'length);
+					rdDone := rdDone + 1;
+					rdTail := rdTail + 1;
+				end if;
+			end if;
 		end loop;
+
+		-- The core's 64-bit datapath could carry one qword every cycle from the first to the last
+		report "Ran " & integer'image(cycle) & " cycles of " & STIMULUS;
+		if ( dmaQwords /= 0 ) then
+			permille := integer(1000.0 * real(dmaQwords) / real(lastDma - firstDma + 1));
+			report
+				"DMA: " & integer'image(dmaTLPs) & " TLPs (" & integer'image(dmaQwords) & " qwords) in " &
+				integer'image(lastDma - firstDma + 1) & " cycles, " & integer'image(permille / 10) & "." &
+				integer'image(permille mod 10) & "% of the datapath";
+		end if;
+		if ( msis > 1 ) then
+			report
+				"MSIs: " & integer'image(msis) & ", every " & integer'image(minGap) & " to " &
+				integer'image(maxGap) & " cycles";
+		end if;
+		report
+			"Stalls: txReady low for " & integer'image(txStalls) & " cycles, rxReady low for " &
+			integer'image(rxStalls) & " cycles with a qword waiting";
+		if ( rdDone /= 0 ) then
+			report
+				"Register reads: " & integer'image(rdDone) & ", taking " & integer'image(rdTotal / rdDone) &
+				" cycles on average, and at most " & integer'image(rdMax);
+		end if;
+		std.env.stop(0);
+		wait;
 	end process;
+
+	-- Write results to results.txt, unless there are too many to be useful
+	results: if ( WRITE_RESULTS ) generate
+		process
+			variable outLine      : line;
+			file outFile          : text open write_mode is "results.txt";
+		begin
+			loop
+				wait until falling_edge(pcieClk);
+				write(
+					outLine,
+					from_4(txData(63 downto 60)) & from_4(txData(59 downto 56)) &
+					from_4(txData(55 downto 52)) & from_4(txData(51 downto 48)) &
+					from_4(txData(47 downto 44)) & from_4(txData(43 downto 40)) &
+					from_4(txData(39 downto 36)) & from_4(txData(35 downto 32)) &
+					from_4(txData(31 downto 28)) & from_4(txData(27 downto 24)) &
+					from_4(txData(23 downto 20)) & from_4(txData(19 downto 16)) &
+					from_4(txData(15 downto 12)) & from_4(txData(11 downto 8)) &
+					from_4(txData(7 downto 4)) & from_4(txData(3 downto 0)));
+				write(outLine, ' ');
+				write(outLine, txValid);
+				write(outLine, ' ');
+				write(outLine, txSOP);
+				write(outLine, ' ');
+				write(outLine, txEOP);
+				writeline(outFile, outLine);
+			end loop;
+		end process;
+	end generate;
 end architecture;
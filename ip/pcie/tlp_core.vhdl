@@ -61,7 +61,12 @@ entity tlp_core is
 		-- Incoming DMA stream
 		dmaData_in            : in  std_logic_vector(63 downto 0);
 		dmaValid_in           : in  std_logic;
-		dmaReady_out          : out std_logic
+		dmaReady_out          : out std_logic;
+
+		-- Outgoing DMA stream, read from host memory (discarded by default)
+		hostData_out          : out std_logic_vector(63 downto 0);
+		hostValid_out         : out std_logic;
+		hostReady_in          : in  std_logic := '1'
 	);
 end entity;
 
@@ -89,6 +94,16 @@ architecture rtl of tlp_core is
 		S_DMA0,
 		S_DMA1,
 		S_DMA2,
+		S_STAT0,
+		S_STAT1,
+		S_STAT2,
+		S_MRD0,
+		S_MRD1,
+		S_CPL0,
+		S_CPL1,
+		S_TXST0,
+		S_TXST1,
+		S_TXST2,
 		S_MSI
 	);
 	signal state              : StateType := S_IDLE;
@@ -101,17 +116,82 @@ architecture rtl of tlp_core is
 	signal rdData_next        : std_logic_vector(31 downto 0);
 	signal dmaAddr            : unsigned(28 downto 0) := (others => '0');
 	signal dmaAddr_next       : unsigned(28 downto 0);
+	signal dmaBase            : unsigned(28 downto 0) := (others => '0');
+	signal dmaBase_next       : unsigned(28 downto 0);
+	signal dmaActive          : std_logic := '0';
+	signal dmaActive_next     : std_logic;
 	signal qwCount            : unsigned(3 downto 0) := (others => '0');
 	signal qwCount_next       : unsigned(3 downto 0);
 	signal tlpCount           : unsigned(9 downto 0) := (others => '0');
 	signal tlpCount_next      : unsigned(9 downto 0);
+	signal doneCount          : unsigned(9 downto 0) := (others => '0');
+	signal doneCount_next     : unsigned(9 downto 0);
+	signal flushLimit         : unsigned(15 downto 0) := (others => '0');
+	signal flushLimit_next    : unsigned(15 downto 0);
+	signal idleCount          : unsigned(22 downto 0) := (others => '0');
+	signal idleCount_next     : unsigned(22 downto 0);
+	signal flushed            : std_logic := '0';
+	signal flushed_next       : std_logic;
+	signal statusAddr         : unsigned(28 downto 0) := (others => '0');
+	signal statusAddr_next    : unsigned(28 downto 0);
+	signal statusSeq          : unsigned(31 downto 0) := (others => '0');
+	signal statusSeq_next     : unsigned(31 downto 0);
+	signal statusEn           : std_logic := '0';
+	signal statusEn_next      : std_logic;
+	signal txAddr             : unsigned(28 downto 0) := (others => '0');
+	signal txAddr_next        : unsigned(28 downto 0);
+	signal txCount            : unsigned(9 downto 0) := (others => '0');
+	signal txCount_next       : unsigned(9 downto 0);
+	signal txPending          : std_logic := '0';
+	signal txPending_next     : std_logic;
+	signal rdQwLeft           : unsigned(6 downto 0) := (others => '0');
+	signal rdQwLeft_next      : unsigned(6 downto 0);
+	signal cplQwLeft          : unsigned(8 downto 0) := (others => '0');
+	signal cplQwLeft_next     : unsigned(8 downto 0);
+	signal txStatusAddr       : unsigned(28 downto 0) := (others => '0');
+	signal txStatusAddr_next  : unsigned(28 downto 0);
+	signal txSeq              : unsigned(31 downto 0) := (others => '0');
+	signal txSeq_next         : unsigned(31 downto 0);
+	signal txFailed           : std_logic := '0';
+	signal txFailed_next      : std_logic;
+	signal rdUnits            : unsigned(2 downto 0);
 	signal cpuChan            : std_logic_vector(REG_ABITS-1 downto 0);
 	signal foSOP              : std_logic;
 	signal foData             : std_logic_vector(63 downto 0);
 	signal foValid            : std_logic;
 	signal foReady            : std_logic;
+	signal dqInData           : std_logic_vector(54 downto 0);
+	signal dqInValid          : std_logic;
+	signal dqInReady          : std_logic;
+	signal dqOutData          : std_logic_vector(54 downto 0);
+	signal dqOutValid         : std_logic;
+	signal dqOutReady         : std_logic;
 	constant DMA_ADDR_REG     : std_logic_vector(REG_ABITS-1 downto 0) := (others => '0');
 	constant DMA_CTRL_REG     : std_logic_vector(REG_ABITS-1 downto 0) := std_logic_vector(unsigned(DMA_ADDR_REG) + 1);
+
+	-- DMA register protocol. Writing DMA_ADDR_REG with bit 0 clear sets the (128-byte aligned) bus
+	-- address of the next buffer. Writing it with bit 0 set instead sets the bus address of a 4KiB
+	-- page of status records, and resets the status sequence number; from then on, each completed
+	-- buffer is followed by a 64-bit status record written to the next of the page's 512 slots
+	-- (in turn), before the MSI. Its low 10 bits are the number of TLPs actually written, bit 31 is
+	-- set if the buffer was flushed early, and the top 32 bits are the status sequence number.
+	--
+	-- Writing DMA_CTRL_REG queues a buffer: bits 9:0 are the number of 128-byte TLPs to write, and
+	-- bits 31:16 are the flush timeout, in units of 128 cycles (1.024us). If the timeout is nonzero,
+	-- and at least one TLP has been written, and no more data arrives before it expires, the buffer
+	-- is closed out early. Zero means wait for the whole buffer, as before. Buffers are filled one
+	-- at a time, in order, from a 32-entry queue; whenever the source has nothing for the current
+	-- one, the core goes back to serving the host, so a quiet source never holds up register
+	-- accesses, or the completions of a host-to-FPGA transfer behind the buffers waiting in rx_fifo.
+	--
+	-- Writing DMA_CTRL_REG with bit 15 set instead starts a host-to-FPGA transfer: bits 9:0 are the
+	-- number of 128-byte units to read from the buffer at the last DMA_ADDR_REG address, which are
+	-- fetched with 512-byte memory reads (one outstanding at a time) and emitted on hostData_out.
+	-- Only one transfer may be in progress. Writing DMA_ADDR_REG with bit 1 set gives the bus
+	-- address of an 8-byte TX status word, and resets the TX sequence number: when each transfer
+	-- finishes, the number of transfers finished so far is written there, before the MSI. If one of
+	-- its reads gets a completion without data (an Unsupported Request or Completer Abort), the rest
+	-- of the transfer is abandoned, and bit 32 of the status word is set.
 begin
 	-- Infer registers
 	process(pcieClk_in)
@@ -122,8 +202,25 @@ begin
 			lowAddr <= lowAddr_next;
 			rdData <= rdData_next;
 			dmaAddr <= dmaAddr_next;
+			dmaBase <= dmaBase_next;
+			dmaActive <= dmaActive_next;
 			qwCount <= qwCount_next;
 			tlpCount <= tlpCount_next;
+			doneCount <= doneCount_next;
+			flushLimit <= flushLimit_next;
+			idleCount <= idleCount_next;
+			flushed <= flushed_next;
+			statusAddr <= statusAddr_next;
+			statusSeq <= statusSeq_next;
+			statusEn <= statusEn_next;
+			txAddr <= txAddr_next;
+			txCount <= txCount_next;
+			txPending <= txPending_next;
+			rdQwLeft <= rdQwLeft_next;
+			cplQwLeft <= cplQwLeft_next;
+			txStatusAddr <= txStatusAddr_next;
+			txSeq <= txSeq_next;
+			txFailed <= txFailed_next;
 		end if;
 	end process;
 
@@ -148,15 +245,42 @@ begin
 			oReady_in        => foReady
 		);
 
+	-- Queue of receive buffers: the bus address, TLP count and flush timeout of each
+	dqInData <= std_logic_vector(dmaBase) & foData(41 downto 32) & foData(63 downto 48);
+	desc_fifo: entity makestuff.buffer_fifo
+		generic map (
+			WIDTH            => 55,
+			DEPTH            => 5,
+			BLOCK_RAM        => "OFF"
+		)
+		port map (
+			clk_in           => pcieClk_in,
+
+			iData_in         => dqInData,
+			iValid_in        => dqInValid,
+			iReady_out       => dqInReady,
+
+			oData_out        => dqOutData,
+			oValid_out       => dqOutValid,
+			oReady_in        => dqOutReady
+		);
+
 	-- Derive channel from CPU address
 	cpuChan <= fpga_addr(foData(REG_ABITS+2 downto 2));
+
+	-- Size of the next memory read, in 128-byte units: up to four at a time
+	rdUnits <=
+		"100" when txCount >= 4 else
+		txCount(2 downto 0);
 	
 	-- Next state logic
 	process(
-		state, msgID, lowAddr, rdData, dmaAddr, qwCount, tlpCount, cpuChan,
-		cfgBusDev_in, msiAck_in, foData, foValid, foSOP, txReady_in,
+		state, msgID, lowAddr, rdData, dmaAddr, dmaBase, dmaActive, qwCount, tlpCount, cpuChan,
+		doneCount, flushLimit, idleCount, flushed, statusAddr, statusSeq, statusEn,
+		txAddr, txCount, txPending, rdQwLeft, cplQwLeft, txStatusAddr, txSeq, txFailed, rdUnits,
+		hostReady_in, cfgBusDev_in, msiAck_in, foData, foValid, foSOP, txReady_in,
 		cpuWrReady_in, cpuRdData_in, cpuRdValid_in,
-		dmaData_in, dmaValid_in)
+		dmaData_in, dmaValid_in, dqInReady, dqOutData, dqOutValid)
 	begin
 		-- Registers
 		state_next <= state;
@@ -164,11 +288,30 @@ begin
 		lowAddr_next <= lowAddr;
 		rdData_next <= rdData;
 		dmaAddr_next <= dmaAddr;
+		dmaBase_next <= dmaBase;
+		dmaActive_next <= dmaActive;
 		qwCount_next <= qwCount;
 		tlpCount_next <= tlpCount;
+		doneCount_next <= doneCount;
+		flushLimit_next <= flushLimit;
+		idleCount_next <= idleCount;
+		flushed_next <= flushed;
+		statusAddr_next <= statusAddr;
+		statusSeq_next <= statusSeq;
+		statusEn_next <= statusEn;
+		txAddr_next <= txAddr;
+		txCount_next <= txCount;
+		txPending_next <= txPending;
+		rdQwLeft_next <= rdQwLeft;
+		cplQwLeft_next <= cplQwLeft;
+		txStatusAddr_next <= txStatusAddr;
+		txSeq_next <= txSeq;
+		txFailed_next <= txFailed;
 
 		-- PCIe channel from CPU
 		foReady <= '0';  -- not ready to receive by default
+		dqInValid <= '0';
+		dqOutReady <= '0';
 
 		-- PCIe channel to CPU
 		txData_out <= (others => 'X');
@@ -182,6 +325,8 @@ begin
 		cpuWrValid_out <= '0';
 		cpuRdReady_out <= '0';
 		dmaReady_out <= '0';
+		hostData_out <= (others => 'X');
+		hostValid_out <= '0';
 		msiReq_out <= '0';
 
 		-- State machine
@@ -219,11 +364,31 @@ begin
 					if ( cpuChan = DMA_ADDR_REG ) then
 						state_next <= S_IDLE;
 						foReady <= '1';
-						dmaAddr_next <= unsigned(foData(63 downto 35));
-					elsif ( cpuChan = DMA_CTRL_REG ) then
-						state_next <= S_DMA0;
+						if ( foData(32) = '1' ) then
+							statusAddr_next <= unsigned(foData(63 downto 35));
+							statusSeq_next <= (others => '0');
+							statusEn_next <= '1';
+						elsif ( foData(33) = '1' ) then
+							txStatusAddr_next <= unsigned(foData(63 downto 35));
+							txSeq_next <= (others => '0');
+						else
+							dmaBase_next <= unsigned(foData(63 downto 35));
+						end if;
+					elsif ( cpuChan = DMA_CTRL_REG and foData(47) = '1' ) then
+						-- Start a host-to-FPGA transfer, which proceeds from S_IDLE
+						state_next <= S_IDLE;
 						foReady <= '1';
-						tlpCount_next <= unsigned(foData(41 downto 32));
+						txAddr_next <= dmaBase;
+						txCount_next <= unsigned(foData(41 downto 32));
+						txPending_next <= '1';
+						txFailed_next <= '0';
+					elsif ( cpuChan = DMA_CTRL_REG ) then
+						-- Queue up a receive buffer, to be started from S_IDLE
+						dqInValid <= '1';
+						if ( dqInReady = '1' ) then
+							state_next <= S_IDLE;
+							foReady <= '1';
+						end if;
 					else
 						cpuChan_out <= cpuChan;
 						cpuWrData_out <= foData(63 downto 32);
@@ -241,10 +406,31 @@ begin
 			when S_DMA0 =>
 				if ( dmaValid_in = '1' and txReady_in = '1' ) then
 					state_next <= S_DMA1;
+					idleCount_next <= (others => '0');
 					--txData_out <= cfgBusDev_in & "000" & x"AAFF400000" & "0" & std_logic_vector(qwCount) & "0";
 					txData_out <= cfgBusDev_in & "000" & x"AAFF40000020";
 					txValid_out <= '1';
 					txSOP_out <= '1';
+				elsif (
+					dmaValid_in = '0' and flushLimit /= 0 and doneCount /= 0 and
+					idleCount(22 downto 7) = flushLimit
+				) then
+					-- The source has been quiet part-way through a buffer for too long
+					flushed_next <= '1';
+					dmaActive_next <= '0';
+					if ( statusEn = '1' ) then
+						state_next <= S_STAT0;
+					else
+						state_next <= S_MSI;
+					end if;
+				elsif ( dmaValid_in = '0' ) then
+					if ( flushLimit /= 0 and doneCount /= 0 ) then
+						idleCount_next <= idleCount + 1;
+					end if;
+					if ( foValid = '1' ) then
+						-- Nothing to send, so see to the host meanwhile; S_IDLE comes back here
+						state_next <= S_IDLE;
+					end if;
 				end if;
 
 			when S_DMA1 =>
@@ -264,15 +450,111 @@ begin
 					if ( qwCount = 0 ) then
 						txEOP_out <= '1';
 						tlpCount_next <= tlpCount - 1;
+						doneCount_next <= doneCount + 1;
 						dmaAddr_next <= dmaAddr + 16;
-						if ( tlpCount = 1 ) then
-							state_next <= S_MSI;
-						else
+						if ( tlpCount /= 1 ) then
 							state_next <= S_DMA0;
+						elsif ( statusEn = '1' ) then
+							state_next <= S_STAT0;
+							dmaActive_next <= '0';
+						else
+							state_next <= S_MSI;
+							dmaActive_next <= '0';
 						end if;
 					end if;
 				end if;
 
+			-- We're writing the buffer's status record: a 2DW memory write
+			when S_STAT0 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_STAT1;
+					txData_out <= cfgBusDev_in & "000" & x"ABFF40000002";
+					txValid_out <= '1';
+					txSOP_out <= '1';
+				end if;
+
+			when S_STAT1 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_STAT2;
+					txData_out <= x"00000000" & std_logic_vector(statusAddr + resize(statusSeq(8 downto 0), 29)) & "000";
+					txValid_out <= '1';
+				end if;
+
+			when S_STAT2 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_MSI;
+					txData_out <= std_logic_vector(statusSeq) & flushed & "000000000000000000000" & std_logic_vector(doneCount);
+					txValid_out <= '1';
+					txEOP_out <= '1';
+					statusSeq_next <= statusSeq + 1;
+				end if;
+
+			-- We're asking to read the next chunk of a host-to-FPGA transfer: a 3DW memory read
+			when S_MRD0 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_MRD1;
+					txData_out <= cfgBusDev_in & "000" & x"01FF" & x"00000" & "0000" & std_logic_vector(rdUnits) & "00000";
+					txValid_out <= '1';
+					txSOP_out <= '1';
+				end if;
+
+			when S_MRD1 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_IDLE;
+					txData_out <= x"00000000" & std_logic_vector(txAddr) & "000";
+					txValid_out <= '1';
+					txEOP_out <= '1';
+					txAddr_next <= txAddr + (rdUnits & "0000");
+					txCount_next <= txCount - rdUnits;
+					rdQwLeft_next <= rdUnits & "0000";
+				end if;
+
+			-- A completion with data arrived for our memory read; skip the rest of its header...
+			when S_CPL0 =>
+				foReady <= '1';
+				if ( foValid = '1' ) then
+					state_next <= S_CPL1;
+				end if;
+
+			-- ...and pass its data along. The read may be split into several completions.
+			when S_CPL1 =>
+				hostData_out <= foData;
+				hostValid_out <= foValid;
+				foReady <= hostReady_in;
+				if ( foValid = '1' and hostReady_in = '1' ) then
+					cplQwLeft_next <= cplQwLeft - 1;
+					rdQwLeft_next <= rdQwLeft - 1;
+					if ( cplQwLeft = 1 ) then
+						state_next <= S_IDLE;
+					end if;
+				end if;
+
+			-- The host-to-FPGA transfer is done: write the TX status word
+			when S_TXST0 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_TXST1;
+					txData_out <= cfgBusDev_in & "000" & x"ABFF40000002";
+					txValid_out <= '1';
+					txSOP_out <= '1';
+				end if;
+
+			when S_TXST1 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_TXST2;
+					txData_out <= x"00000000" & std_logic_vector(txStatusAddr) & "000";
+					txValid_out <= '1';
+				end if;
+
+			when S_TXST2 =>
+				if ( txReady_in = '1' ) then
+					state_next <= S_MSI;
+					txData_out <= x"0000000" & "000" & txFailed & std_logic_vector(txSeq + 1);
+					txValid_out <= '1';
+					txEOP_out <= '1';
+					txSeq_next <= txSeq + 1;
+					txPending_next <= '0';
+				end if;
+
 			when S_MSI =>
 				msiReq_out <= '1';
 				if ( msiAck_in = '1' ) then
@@ -282,7 +564,15 @@ begin
 			-- S_IDLE and others
 			when others =>
 				foReady <= '1';
-				if ( foSOP = '1' and foValid = '1' ) then
+				if ( txPending = '1' and rdQwLeft = 0 ) then
+					-- Between the reads of a host-to-FPGA transfer; issue the next, or finish up
+					foReady <= '0';
+					if ( txCount /= 0 ) then
+						state_next <= S_MRD0;
+					else
+						state_next <= S_TXST0;
+					end if;
+				elsif ( foSOP = '1' and foValid = '1' ) then
 					-- We have the first two longwords in a new message...
 					if ( foData(31 downto 24) = x"40" ) then
 						-- The CPU is writing to the FPGA. We'll find out the address and data word
@@ -294,7 +584,32 @@ begin
 						-- We'll find out the address on the next cycle.
 						state_next <= S_READ_SOP;
 						msgID_next <= foData(63 downto 40);
+					elsif ( foData(31 downto 24) = x"4A" ) then
+						-- A completion with data, for our memory read. Its address is aligned, so its
+						-- data starts on the qword after next.
+						state_next <= S_CPL0;
+						cplQwLeft_next <= unsigned(foData(9 downto 1));
+					elsif ( foData(31 downto 24) = x"0A" and txPending = '1' ) then
+						-- A completion without data: our memory read failed, so give up on the
+						-- transfer, and report it in the status word
+						txCount_next <= (others => '0');
+						rdQwLeft_next <= (others => '0');
+						txFailed_next <= '1';
 					end if;
+				elsif ( dmaActive = '1' ) then
+					-- Nothing from the host, so carry on with the current buffer
+					state_next <= S_DMA0;
+				elsif ( dqOutValid = '1' ) then
+					-- Start the next queued buffer
+					state_next <= S_DMA0;
+					dqOutReady <= '1';
+					dmaActive_next <= '1';
+					dmaAddr_next <= unsigned(dqOutData(54 downto 26));
+					tlpCount_next <= unsigned(dqOutData(25 downto 16));
+					flushLimit_next <= unsigned(dqOutData(15 downto 0));
+					doneCount_next <= (others => '0');
+					idleCount_next <= (others => '0');
+					flushed_next <= '0';
 				end if;
 		end case;
 	end process;